@@ -3,18 +3,24 @@
 #define CSL_AST_H
 
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include <ostream>
 #include <cstring>
+#include <memory>
+#include <mutex>
 
 #include "util/memory.h"
+#include "util/handle.h"
 #include "operator.h"
 #include "type.h"
 #include "value.h"
 
 
 
+class ExprPool;
+
 class ASTBase {
 public:
     
@@ -39,7 +45,9 @@ public:
         FOR = 0x13,
         CONTINUE = 0x14,
         BREAK = 0x15,
-        RETURN = 0x16
+        RETURN = 0x16,
+        IMPORT = 0x17,
+        EXPR = 0x18     // expression statement
     };
 
     ASTBase() : mytype(NONE) {
@@ -50,8 +58,13 @@ public:
 
     }
 
-    virtual void print(std::ostream&, char indent='\t', int level = 0)const {
+    /* Print with the pool of the expressions of the tree */
+    virtual void print(std::ostream&, const ExprPool&, char indent='\t', int level = 0)const {
+
+    }
 
+    ASTType get_ast_type()const {
+        return mytype;
     }
 
     bool is_stmt()const {
@@ -75,7 +88,7 @@ public:
     }
 
     bool is_control()const {
-        return mytype >= IF;
+        return mytype >= IF && mytype <= RETURN;
     }
 
     /*  Notice: CSL Member class (AST, Token, ...) will not release *ANY* pointers
@@ -108,7 +121,7 @@ public:
 
 typedef ConstMemoryRef<StmtAST> StmtASTRef;
 
-// General Expression
+// General Expression; In the ExprPool of its tree, referenced by handle
 class ExprAST : public StmtAST {
 public:
 
@@ -120,24 +133,111 @@ public:
 
     }
 
-    virtual void print(std::ostream&, char indent='\t', int level = 0)const {
+    virtual void add_child(const Handle<ExprAST>& child) {
 
     }
 
-    virtual void add_child(const ConstMemoryRef<ExprAST>& child) {
+private:
+
+};
+
+typedef Handle<ExprAST> ExprASTHandle;     // in an ExprPool
+
+
+/* Expression nodes and their constants. Nodes of a tree refer to them by handle,
+   so a traversal of the tree is given the pool. Holds up to HandlePool::max_size
+   (2^32 - 65) nodes and as many constants; Constructing more throws CSLError */
+class ExprPool {
+public:
+
+    ExprPool() : _nodes(1 << 14), _constants(1 << 12), _counts() {
 
     }
 
+    ExprPool(const ExprPool&) = delete;
+    ExprPool& operator=(const ExprPool&) = delete;
+
+    /* Construct a new node of Ty in place */
+    template<typename Ty, typename... Args>
+    Handle<Ty> construct(Args&&... args) {
+        Handle<Ty> h = _nodes.template construct<Ty>(std::forward<Args>(args)...);
+        _kinds.push_back(static_cast<unsigned char>(Ty::node_type));
+        _counts[Ty::node_type]++;
+        return h;
+    }
+
+    template<typename... Args>
+    ConstantHandle construct_constant(Args&&... args) {
+        return _constants.construct(std::forward<Args>(args)...);
+    }
+
+    template<typename Ty>
+    Ty* get(const Handle<Ty>& h) {
+        return _nodes.get(h);
+    }
+
+    template<typename Ty>
+    const Ty& operator[](const Handle<Ty>& h)const {
+        return _nodes[h];
+    }
+
+    const Constant& operator[](const ConstantHandle& h)const {
+        return _constants[h];
+    }
+
+    /* Number of nodes */
+    size_t size()const {
+        return _nodes.size();
+    }
+
+    /* Number of nodes of a kind */
+    size_t count(ASTBase::ASTType type)const {
+        return _counts[type];
+    }
+
+    size_t constant_count()const {
+        return _constants.size();
+    }
+
+    /* Bytes reserved from system */
+    size_t capacity()const {
+        return _nodes.capacity() + _constants.capacity() + _kinds.capacity();
+    }
+
+    struct Checkpoint {
+        HandlePool<ExprAST>::Checkpoint nodes;
+        HandlePool<Constant>::Checkpoint constants;
+    };
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp = { _nodes.checkpoint(), _constants.checkpoint() };
+        return cp;
+    }
+
+    /* Destroy nodes and constants constructed after cp */
+    void rewind(const Checkpoint& cp) {
+        _nodes.rewind(cp.nodes);
+        _constants.rewind(cp.constants);
+        while (_kinds.size() > _nodes.size()) {
+            _counts[_kinds.back()]--;
+            _kinds.pop_back();
+        }
+    }
+
 private:
 
+    HandlePool<ExprAST> _nodes;
+    HandlePool<Constant> _constants;
+    std::vector<unsigned char> _kinds;  // by node index - 1
+    size_t _counts[ASTBase::EXPR + 1];  // of nodes by kind
 };
 
-typedef ConstMemoryRef<ExprAST> ExprASTRef;
-
 // Operator (1)
 class OpAST : public ExprAST {
 public:
 
+    static const ASTType node_type = OP;
+
     OpAST() : ExprAST(OP) {
 
     }
@@ -146,20 +246,20 @@ public:
 
     }
 
-    explicit OpAST(Operator op, const ExprASTRef& lhs) : op(op), lhs(lhs) {
+    explicit OpAST(Operator op, const ExprASTHandle& lhs) : op(op), lhs(lhs) {
 
     }
 
-    explicit OpAST(Operator op, const ExprASTRef& lhs, const ExprASTRef& rhs) : op(op),
+    explicit OpAST(Operator op, const ExprASTHandle& lhs, const ExprASTHandle& rhs) : op(op),
         lhs(lhs), rhs(rhs) {
 
     }
 
-    void add_child(const ExprASTRef& child) {
-        if (!lhs) {
+    void add_child(const ExprASTHandle& child) {
+        if (!lhs.exists()) {
             lhs = child;
         }
-        else if (!rhs) {
+        else if (!rhs.exists()) {
             rhs = child;
         }
         else {
@@ -167,39 +267,54 @@ public:
         }
     }
 
-    void print(std::ostream& os, char indent='\t', int level=0)const {
+    void print(std::ostream& os, const ExprPool& exprs, char indent='\t', int level=0)const {
         os << std::string(level, indent);
 
         print_op(op, os);
         os << std::endl;
-        lhs->print(os, indent, level + 1);
-        if (rhs.exists()) rhs->print(os, indent, level + 1);
+        exprs[lhs].print(os, exprs, indent, level + 1);
+        if (rhs.exists()) exprs[rhs].print(os, exprs, indent, level + 1);
+    }
+
+    Operator get_op()const {
+        return op;
+    }
+
+    const ExprASTHandle& get_lhs()const {
+        return lhs;
+    }
+
+    const ExprASTHandle& get_rhs()const {
+        return rhs;
     }
 
 private:
 
     Operator op;
-    ExprASTRef lhs, rhs;
+    ExprASTHandle lhs, rhs;
 };
 
 // VALUE (2)
 class ValueAST : public ExprAST {
 public:
 
+    static const ASTType node_type = VALUE;
+
     ValueAST() : ExprAST(VALUE) {
 
     }
 
-    explicit ValueAST(const ConstMemoryRef<Constant>& c) : data(c) {
+    explicit ValueAST(const ConstantHandle& c) : value(c) {
     }
 
-    void add_child(const ExprASTRef&) {
+    void add_child(const ExprASTHandle&) {
         throw std::out_of_range("Cannot add child to identifier");
     }
 
-    void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
         os << std::string(level, indent);
 
+        const Constant* data = &exprs[value];
         data->get_type()->print(os);
         os << ' ';
 
@@ -223,15 +338,21 @@ public:
         os << std::endl;
     }
 
+    const ConstantHandle& get_value()const {
+        return value;
+    }
+
 private:
 
-    const ConstMemoryRef<Constant> data;
+    const ConstantHandle value;
 
 };
 
 // ID (3)
 class IdAST : public ExprAST {
 public:
+
+    static const ASTType node_type = ID;
     IdAST() : ExprAST(ID) {
 
     }
@@ -240,11 +361,11 @@ public:
 
     }
 
-    void add_child(const ExprASTRef&) {
+    void add_child(const ExprASTHandle&) {
         throw std::out_of_range("Cannot add child to identifier");
     }
 
-    void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    void print(std::ostream& os, const ExprPool&, char indent = '\t', int level = 0)const {
         os << std::string(level, indent);
 
         os << "id " << name.to_cstr() << std::endl;
@@ -263,6 +384,8 @@ private:
 class CallAST : public ExprAST {
 public:
 
+    static const ASTType node_type = CALL;
+
     CallAST() : ExprAST(CALL) {
 
     }
@@ -270,67 +393,102 @@ public:
     ~CallAST() {
     }
 
-    void add_child(const ExprASTRef& child) {
-        if (!callee) {
-            if (child->is_id()) {
-                callee = child.cast<IdAST>();
-            }
-            else {
-                throw std::runtime_error("Not an id");
-            }
-        }
-        else {
-            argv.push_back(child);
+    /* An argument; The callee is set first by set_callee() */
+    void add_child(const ExprASTHandle& child) {
+        if (!callee.exists()) {
+            throw std::runtime_error("Not an id");
         }
+        argv.push_back(child);
     }
 
-    void set_callee(const ConstMemoryRef<IdAST>& callee) {
+    void set_callee(const Handle<IdAST>& callee) {
         this->callee = callee;
     }
 
-    void add_arg(const ExprASTRef& arg) {
+    void add_arg(const ExprASTHandle& arg) {
         argv.push_back(arg);
     }
 
-    void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
         os << std::string(level, indent) << std::endl;
 
         os << "function call" << std::endl;
-        callee->print(os, indent, level + 1);
+        exprs[callee].print(os, exprs, indent, level + 1);
         for (const auto& arg : argv) {
-            arg->print(os, indent, level+1);
+            exprs[arg].print(os, exprs, indent, level+1);
         }
     }
 
+    const Handle<IdAST>& get_callee()const {
+        return callee;
+    }
+
+    const std::vector<ExprASTHandle>& get_args()const {
+        return argv;
+    }
+
 private:
-    ConstMemoryRef<IdAST> callee;
-    std::vector<ExprASTRef> argv;
+    Handle<IdAST> callee;
+    std::vector<ExprASTHandle> argv;
 };
 
 // LIST (5)
 class ListAST : public ExprAST {
 public:
 
+    static const ASTType node_type = LIST;
+
     ListAST() : ExprAST(LIST) {
 
     }
 
-    void add_child(const ExprASTRef& child) {
+    void add_child(const ExprASTHandle& child) {
         member.push_back(child);
     }
 
-    void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
         os << std::string(level, indent);
 
         os << "initialization list" << std::endl;
         for (const auto& m : member) {
-            m->print(os, indent, level + 1);
+            exprs[m].print(os, exprs, indent, level + 1);
         }
     }
 
+    const std::vector<ExprASTHandle>& get_members()const {
+        return member;
+    }
+
+private:
+
+    std::vector<ExprASTHandle> member;
+};
+
+// Expression statement (EXPR)
+class ExprStmtAST : public StmtAST {
+public:
+
+    static const ASTType node_type = EXPR;
+
+    ExprStmtAST() : StmtAST(EXPR) {
+
+    }
+
+    explicit ExprStmtAST(const ExprASTHandle& expr) : StmtAST(EXPR), expr(expr) {
+
+    }
+
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
+        exprs[expr].print(os, exprs, indent, level);
+    }
+
+    const ExprASTHandle& get_expr()const {
+        return expr;
+    }
+
 private:
 
-    std::vector<ExprASTRef> member;
+    ExprASTHandle expr;
 };
 
 // Declaration of function/class/variable
@@ -350,6 +508,8 @@ public:
 class TypeAST : public ASTBase {
 public:
 
+    static const ASTType node_type = TYPE;
+
     enum RelationToChild {
         NONE = 0,
         POINTER,
@@ -391,6 +551,12 @@ public:
         return child.cast<Type>();
     }
 
+    /* Interned name of a class type */
+    const char* get_class_name()const {
+        assert(relation == CLASS && "Is not class type");
+        return child.get();
+    }
+
     bool is_primitive_type()const {
         return relation == NONE;
     }
@@ -407,7 +573,7 @@ public:
         return relation == CLASS;
     }
 
-    virtual void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    virtual void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
 
         os << std::string(level, indent);
 
@@ -420,7 +586,7 @@ public:
             break;
         case TypeAST::POINTER:
             os << "[Pointer of]" << std::endl;
-            child.cast<TypeAST>()->print(os, indent, level + 1);
+            child.cast<TypeAST>()->print(os, exprs, indent, level + 1);
             break;
         case TypeAST::CLASS:
             os << "Custom type: " << child.cast<char>().get() << std::endl;
@@ -443,23 +609,33 @@ typedef ConstMemoryRef<TypeAST> TypeASTRef;
 class ArrayTypeAST : public TypeAST {
 public:
 
+    static const ASTType node_type = TYPE;
+
     ArrayTypeAST() : TypeAST() {
 
     }
 
-    ArrayTypeAST(const TypeASTRef& typee, const ExprASTRef& expr_size) : TypeAST(typee), expr_size(expr_size) {
+    ArrayTypeAST(const TypeASTRef& typee, const ExprASTHandle& expr_size) : TypeAST(typee), expr_size(expr_size) {
 
     }
 
-    void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
         os << std::string(level, indent);
         os << "[Array type]" << std::endl;
-        child.cast<TypeAST>()->print(os, indent, level + 1);
-        expr_size->print(os, indent, level + 1);
+        child.cast<TypeAST>()->print(os, exprs, indent, level + 1);
+        exprs[expr_size].print(os, exprs, indent, level + 1);
+    }
+
+    ConstMemoryRef<TypeAST> get_element_type()const {
+        return child.cast<TypeAST>();
+    }
+
+    const ExprASTHandle& get_size_expr()const {
+        return expr_size;
     }
 private:
 
-    ExprASTRef expr_size;
+    ExprASTHandle expr_size;
 };
 
 
@@ -467,6 +643,8 @@ private:
 class VarDeclAST : public DeclAST {
 public:
 
+    static const ASTType node_type = DECL;
+
     VarDeclAST() : DeclAST(DECL) {
 
     }
@@ -475,7 +653,7 @@ public:
 
     }
 
-    explicit VarDeclAST(const TypeASTRef& type, const StringRef& name, const ExprASTRef& initializer) :
+    explicit VarDeclAST(const TypeASTRef& type, const StringRef& name, const ExprASTHandle& initializer) :
         vartype(type), varname(name), initializer(initializer) {
 
     }
@@ -483,28 +661,41 @@ public:
     ~VarDeclAST() {
     }
 
-    void print(std::ostream& os, char indent = '\t', int level = 0)const {
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
         os << std::string(level, indent) << std::endl;
         os << "DEFINE " << varname.to_cstr() << std::endl;
-        vartype->print(os, indent, level + 1);
+        vartype->print(os, exprs, indent, level + 1);
         if (initializer.exists()) {
-            initializer->print(os, indent, level + 1);
+            exprs[initializer].print(os, exprs, indent, level + 1);
         }
     }
 
+    const TypeASTRef& get_type()const {
+        return vartype;
+    }
+
+    StringRef get_name()const {
+        return varname;
+    }
+
+    const ExprASTHandle& get_initializer()const {
+        return initializer;
+    }
 
 private:
     TypeASTRef vartype;
     StringRef varname;
-    ExprASTRef initializer;
+    ExprASTHandle initializer;
 };
 
-typedef typename ConstMemoryRef<VarDeclAST> VarDeclASTRef;
+typedef ConstMemoryRef<VarDeclAST> VarDeclASTRef;
 
 
 class BlockStmtAST : public StmtAST {
 public:
 
+    static const ASTType node_type = BLOCK;
+
     BlockStmtAST() : StmtAST(BLOCK) {
 
     }
@@ -517,44 +708,80 @@ public:
         stmt_list.push_back(d);
     }
 
-    void print(std::ostream& os, char indent='\t', unsigned level=0)const {
+    /* A function or class definition */
+    void append(const ConstMemoryRef<DeclAST>& d) {
+        def_list.push_back(d);
+    }
+
+    void print(std::ostream& os, const ExprPool& exprs, char indent='\t', int level=0)const {
         os << std::string(level, indent) << "[Block]" << std::endl;
         for (const auto& d : decl_list) {
-            d->print(os, indent, level + 1);
+            d->print(os, exprs, indent, level + 1);
+        }
+        for (const auto& d : def_list) {
+            d->print(os, exprs, indent, level + 1);
         }
         for (const auto& s : stmt_list) {
-            s->print(os, indent, level + 1);
+            s->print(os, exprs, indent, level + 1);
         }
     }
 
+    const std::vector<ConstMemoryRef<VarDeclAST> >& get_decls()const {
+        return decl_list;
+    }
+
+    const std::vector<StmtASTRef>& get_stmts()const {
+        return stmt_list;
+    }
+
+    /* Functions and classes, in source order */
+    const std::vector<ConstMemoryRef<DeclAST> >& get_defs()const {
+        return def_list;
+    }
+
 private:
 
     std::vector<ConstMemoryRef<VarDeclAST> > decl_list;
+    std::vector<ConstMemoryRef<DeclAST> > def_list;
     std::vector<StmtASTRef> stmt_list;
 };
 
-typedef typename ConstMemoryRef<BlockStmtAST> BlockStmtASTRef;
+typedef ConstMemoryRef<BlockStmtAST> BlockStmtASTRef;
 
 class IfAST : public StmtAST {
 
 public:
 
+    static const ASTType node_type = IF;
+
     IfAST() : StmtAST(IF) {
 
     }
 
-    explicit IfAST(const ExprASTRef& expr_cond, const StmtASTRef& true_stmt) :
+    explicit IfAST(const ExprASTHandle& expr_cond, const StmtASTRef& true_stmt) :
         condition(expr_cond), true_stmt(true_stmt) {
 
     }
 
-    explicit IfAST(const ExprASTRef& expr_cond, const StmtASTRef& true_stmt, const StmtASTRef& false_stmt) :
+    explicit IfAST(const ExprASTHandle& expr_cond, const StmtASTRef& true_stmt, const StmtASTRef& false_stmt) :
         condition(expr_cond), true_stmt(true_stmt), false_stmt(false_stmt) {
 
     }
 
+    const ExprASTHandle& get_condition()const {
+        return condition;
+    }
+
+    const StmtASTRef& get_true_stmt()const {
+        return true_stmt;
+    }
+
+    const StmtASTRef& get_false_stmt()const {
+        return false_stmt;
+    }
+
 private:
-    ExprASTRef condition;
+    ExprASTHandle condition;
     StmtASTRef true_stmt;
     StmtASTRef false_stmt;
 };
@@ -563,17 +790,27 @@ private:
 class WhileAST : public StmtAST {
 public:
 
+    static const ASTType node_type = WHILE;
+
     WhileAST() : StmtAST(WHILE) {
 
     }
 
-    explicit WhileAST(const ExprASTRef& expr_cond, const StmtASTRef& stmt) :
+    explicit WhileAST(const ExprASTHandle& expr_cond, const StmtASTRef& stmt) :
         condition(expr_cond), loop_stmt(stmt) {
 
     }
 
+    const ExprASTHandle& get_condition()const {
+        return condition;
+    }
+
+    const StmtASTRef& get_loop_stmt()const {
+        return loop_stmt;
+    }
+
 private:
-    ExprASTRef condition;
+    ExprASTHandle condition;
     StmtASTRef loop_stmt;
 };
 
@@ -581,11 +818,13 @@ private:
 class ForAST : public StmtAST {
 public:
 
+    static const ASTType node_type = FOR;
+
     ForAST() : StmtAST(FOR) {
 
     }
 
-    explicit ForAST(const ExprASTRef& init_expr, const ExprASTRef& cond_expr, const ExprASTRef& loop_expr, 
+    explicit ForAST(const ExprASTHandle& init_expr, const ExprASTHandle& cond_expr, const ExprASTHandle& loop_expr, 
         const StmtASTRef& loop_stmt) :
         init_expr(init_expr),
         condition(cond_expr),
@@ -595,16 +834,34 @@ public:
     }
 
 
+    const ExprASTHandle& get_init_expr()const {
+        return init_expr;
+    }
+
+    const ExprASTHandle& get_condition()const {
+        return condition;
+    }
+
+    const ExprASTHandle& get_loop_expr()const {
+        return loop_expr;
+    }
+
+    const StmtASTRef& get_loop_stmt()const {
+        return loop_stmt;
+    }
+
 private:
-    ExprASTRef init_expr;
-    ExprASTRef condition;
-    ExprASTRef loop_expr;
+    ExprASTHandle init_expr;
+    ExprASTHandle condition;
+    ExprASTHandle loop_expr;
     StmtASTRef loop_stmt;
 };
 
 class ContinueAST : public StmtAST {
 public:
 
+    static const ASTType node_type = CONTINUE;
+
     ContinueAST() : StmtAST(CONTINUE) {
 
     }
@@ -614,6 +871,8 @@ public:
 
 class BreakAST : public StmtAST {
 public:
+
+    static const ASTType node_type = BREAK;
     BreakAST() : StmtAST(BREAK) {
 
     }
@@ -622,28 +881,83 @@ public:
 class ReturnAST : public StmtAST {
 public:
 
+    static const ASTType node_type = RETURN;
+
     ReturnAST() : StmtAST(RETURN) {
 
     }
 
-    explicit ReturnAST(const ExprASTRef& ret_expr) : ret_expr(ret_expr) {
+    explicit ReturnAST(const ExprASTHandle& ret_expr) : ret_expr(ret_expr) {
+
+    }
+
+    const ExprASTHandle& get_ret_expr()const {
+        return ret_expr;
+    }
+
+private:
+
+    ExprASTHandle ret_expr;
+};
+
+
+struct Module;
+
+/* import "path"; The imported module is shared with every file importing it,
+   and lives as long as one refers to it */
+class ImportAST : public StmtAST {
+public:
+
+    static const ASTType node_type = IMPORT;
+
+    ImportAST(const StringRef& path, const std::shared_ptr<const Module>& module) : 
+        StmtAST(IMPORT), path(path), module(module) {
+
+    }
+
+    void print(std::ostream& os, const ExprPool&, char indent = '\t', int level = 0)const {
+        os << std::string(level, indent) << "[Import] " << path.to_cstr() << std::endl;
+    }
+
+    StringRef get_path()const {
+        return path;
+    }
 
+    const std::shared_ptr<const Module>& get_module()const {
+        return module;
     }
 
 private:
 
-    ExprASTRef ret_expr;
+    StringRef path;
+    std::shared_ptr<const Module> module;
 };
 
 /* FUNCTION(7) */
+/* Parses the function bodies a lazy parse left in source */
+class BodySource {
+public:
+
+    virtual ~BodySource() {
+
+    }
+
+    /* Body at [begin, end) of source, '{' to '}', seeing the first class_count classes
+       of the context and the ones it defines; Sets exprs to the pool of its expressions */
+    virtual BlockStmtASTRef parse_body(size_t begin, size_t end, size_t class_count, const ExprPool*& exprs) = 0;
+};
+
 class FunctionAST : public DeclAST {
 public:
 
-    FunctionAST() : DeclAST(FUNCTION) {
+    static const ASTType node_type = FUNCTION;
+
+    FunctionAST() : DeclAST(FUNCTION), body_parsed(false), body_exprs(nullptr) {
 
     }
 
-    explicit FunctionAST(const StringRef& name) : name(name) {
+    explicit FunctionAST(const StringRef& name) : DeclAST(FUNCTION), name(name), body_parsed(false),
+        body_exprs(nullptr) {
 
     }
 
@@ -661,8 +975,79 @@ public:
         ret_type = type;
     }
 
-    void set_body_ast(const BlockStmtASTRef& body_ast) {
+    /* exprs: pool of the expressions of the body if not the one of the tree, as of a
+       body parsed in another context */
+    void set_body_ast(const BlockStmtASTRef& body_ast, const ExprPool* exprs = nullptr) {
         body = body_ast;
+        body_parsed = true;
+        body_exprs = exprs;
+    }
+
+    /* Body left in source, parsed by the first get_body() */
+    void set_lazy_body(const std::shared_ptr<BodySource>& source, size_t begin, size_t end, size_t class_count) {
+        body_source = source;
+        body_begin = begin;
+        body_end = end;
+        body_classes = class_count;
+    }
+
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
+        os << std::string(level, indent) << "[Function] " << name.to_cstr() << std::endl;
+        for (size_t i = 0; i < arg_types.size(); i++) {
+            os << std::string(level + 1, indent) << "ARG " << (arg_names[i].exists() ? arg_names[i].to_cstr() : "") << std::endl;
+            arg_types[i]->print(os, exprs, indent, level + 2);
+        }
+        if (ret_type.exists()) {
+            ret_type->print(os, exprs, indent, level + 1);
+        }
+        if (has_body()) {
+            const BlockStmtASTRef& b = get_body();
+            b->print(os, get_body_exprs(exprs), indent, level + 1);
+        }
+    }
+
+    StringRef get_name()const {
+        return name;
+    }
+
+    const std::vector<TypeASTRef>& get_arg_types()const {
+        return arg_types;
+    }
+
+    const std::vector<StringRef>& get_arg_names()const {
+        return arg_names;
+    }
+
+    const TypeASTRef& get_return_type()const {
+        return ret_type;
+    }
+
+    /* Body, parsed now if left in source; Thread-safe, also with traversals of the tree
+       on other threads, as the body is parsed into pools of its own. Throws what parsing
+       it throws, and parses again on the next call */
+    const BlockStmtASTRef& get_body()const {
+        if (body_source) {
+            std::call_once(body_once, [this]() {
+                body = body_source->parse_body(body_begin, body_end, body_classes, body_exprs);
+                body_parsed = true;
+            });
+        }
+        return body;
+    }
+
+    /* Pool of the expressions of the body, of a tree of the pool exprs */
+    const ExprPool& get_body_exprs(const ExprPool& exprs)const {
+        return body_exprs ? *body_exprs : exprs;
+    }
+
+    /* A definition, not only a declaration */
+    bool has_body()const {
+        return body_source || body.exists();
+    }
+
+    /* False while the body is left in source */
+    bool is_body_parsed()const {
+        return body_parsed;
     }
 
 private:
@@ -671,21 +1056,28 @@ private:
     std::vector<StringRef> arg_names;
     TypeASTRef ret_type;
 
-    BlockStmtASTRef body;
+    mutable BlockStmtASTRef body;
+    mutable std::atomic<bool> body_parsed;
+    mutable std::once_flag body_once;
+    mutable const ExprPool* body_exprs;         // nullptr if the pool of the tree
+    std::shared_ptr<BodySource> body_source;    // if lazy
+    size_t body_begin, body_end, body_classes;
 };
 
-typedef typename ConstMemoryRef<FunctionAST> FunctionASTRef;
+typedef ConstMemoryRef<FunctionAST> FunctionASTRef;
 
 
 // CLASS (8)
 class ClassAST : public DeclAST {
 public:
 
+    static const ASTType node_type = CLASS;
+
     ClassAST() : DeclAST(CLASS) {
 
     }
 
-    explicit ClassAST(const StringRef& name) : name(name) {
+    explicit ClassAST(const StringRef& name) : DeclAST(CLASS), name(name) {
 
     }
 
@@ -697,6 +1089,28 @@ public:
         ast_methods.push_back(ast_method);
     }
 
+    void print(std::ostream& os, const ExprPool& exprs, char indent = '\t', int level = 0)const {
+        os << std::string(level, indent) << "[Class] " << name.to_cstr() << std::endl;
+        for (const auto& m : ast_members) {
+            m->print(os, exprs, indent, level + 1);
+        }
+        for (const auto& m : ast_methods) {
+            m->print(os, exprs, indent, level + 1);
+        }
+    }
+
+    StringRef get_name()const {
+        return name;
+    }
+
+    const std::vector<VarDeclASTRef>& get_members()const {
+        return ast_members;
+    }
+
+    const std::vector<FunctionASTRef>& get_methods()const {
+        return ast_methods;
+    }
+
 private:
 
     StringRef name;
@@ -705,6 +1119,6 @@ private:
 
 };
 
-typedef typename ConstMemoryRef<ClassAST> ClassASTRef;
+typedef ConstMemoryRef<ClassAST> ClassASTRef;
 
 #endif // !CSL_AST_H
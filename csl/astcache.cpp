@@ -0,0 +1,872 @@
+#include "astcache.h"
+#include "util/errors.h"
+#include "util/hash.h"
+#include "util/mappedfile.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+
+/* File layout, all sections following the header in this order:
+     Header
+     StringEntry[string_count]      names and literals, by text in bytes
+     ConstantEntry[constant_count]  values, by data in bytes
+     NodeRecord[node_count]         nodes, children before their parents; expressions and
+                                    constants are built in the ExprPool of the context
+     uint32_t[ref_count]            lists of nodes and names, by start and count in records
+     char[byte_count]               text of strings and data of constants
+   A reference is 1 + an index in its section, 0 for null. Nothing in it is a
+   pointer, so it is read in place from the mapped file. */
+
+namespace {
+
+const char magic[4] = { 'C', 'S', 'L', 'A' };
+const uint32_t format = 2;
+
+// Node classes; NodeRecord::tag
+enum Tag : uint8_t {
+    T_OP = 1, T_VALUE, T_ID, T_CALL, T_LIST, T_VARDECL, T_FUNCTION, T_CLASS,
+    T_TYPE, T_ARRAYTYPE, T_BLOCK, T_IF, T_WHILE, T_FOR, T_CONTINUE, T_BREAK,
+    T_RETURN, T_IMPORT, T_EXPRSTMT, T_END
+};
+
+// Sets of tags, checked for each reference to a node
+const uint32_t K_EXPR = 1 << T_OP | 1 << T_VALUE | 1 << T_ID | 1 << T_CALL | 1 << T_LIST;
+const uint32_t K_STMT = 1 << T_EXPRSTMT | 1 << T_BLOCK | 1 << T_IF | 1 << T_WHILE | 1 << T_FOR |
+    1 << T_CONTINUE | 1 << T_BREAK | 1 << T_RETURN | 1 << T_IMPORT;
+const uint32_t K_TYPE = 1 << T_TYPE | 1 << T_ARRAYTYPE;
+const uint32_t K_DEF = 1 << T_FUNCTION | 1 << T_CLASS;
+
+// Types of TypeAST and constants, as (kind << 8 | Type::TypeID); 0 for none
+enum TypeKind : uint32_t {
+    TK_PRIMITIVE = 1,   // shared PrimitiveType of the context
+    TK_PLAIN,           // a Type of its own
+    TK_STRING           // shared string type of the context
+};
+
+struct Header {
+    char magic[4];
+    uint32_t format;
+    uint64_t version;       // ASTCache::version() of the writer
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t string_count;
+    uint32_t constant_count;
+    uint32_t node_count;
+    uint32_t ref_count;
+    uint32_t byte_count;
+    uint32_t root;          // the BlockStmtAST of the file
+};
+
+struct StringEntry {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t interned;      // 1 if in the symbol table
+};
+
+struct ConstantEntry {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct NodeRecord {
+    uint8_t tag;
+    uint8_t relation;       // of TypeAST
+    uint16_t op;            // of OpAST
+    uint32_t ref[6];        // by tag, see Writer::node()
+};
+
+
+#define CSL_ASTCACHE_STR2(x) #x
+#define CSL_ASTCACHE_STR(x) CSL_ASTCACHE_STR2(x)
+
+#if defined(_MSC_VER)
+#define CSL_ASTCACHE_COMPILER "msvc " CSL_ASTCACHE_STR(_MSC_FULL_VER)
+#elif defined(__VERSION__)
+#define CSL_ASTCACHE_COMPILER __VERSION__
+#else
+#define CSL_ASTCACHE_COMPILER "unknown"
+#endif
+
+
+class Writer {
+public:
+
+    explicit Writer(const ExprPool& exprs) : _exprs(&exprs) {
+
+    }
+
+    std::string write(uint64_t hash, size_t size, const BlockStmtASTRef& ast) {
+        if (!ast.exists()) {
+            throw CSLError("AST cache: no tree");
+        }
+        uint32_t root = node(ast);
+
+        Header h;
+        memcpy(h.magic, magic, sizeof(magic));
+        h.format = format;
+        h.version = ASTCache::version();
+        h.source_hash = hash;
+        h.source_size = size;
+        h.string_count = static_cast<uint32_t>(_strings.size());
+        h.constant_count = static_cast<uint32_t>(_constants.size());
+        h.node_count = static_cast<uint32_t>(_records.size());
+        h.ref_count = static_cast<uint32_t>(_refs.size());
+        h.byte_count = static_cast<uint32_t>(_bytes.size());
+        h.root = root;
+
+        std::string out;
+        out.reserve(sizeof(h) + _strings.size() * sizeof(StringEntry) + _constants.size() * sizeof(ConstantEntry) +
+            _records.size() * sizeof(NodeRecord) + _refs.size() * sizeof(uint32_t) + _bytes.size());
+        append(out, &h, sizeof(h));
+        append(out, _strings.data(), _strings.size() * sizeof(StringEntry));
+        append(out, _constants.data(), _constants.size() * sizeof(ConstantEntry));
+        append(out, _records.data(), _records.size() * sizeof(NodeRecord));
+        append(out, _refs.data(), _refs.size() * sizeof(uint32_t));
+        out.append(_bytes);
+        return out;
+    }
+
+private:
+
+    static void append(std::string& out, const void* data, size_t size) {
+        out.append(static_cast<const char*>(data), size);
+    }
+
+    template<typename Ty>
+    static const Ty* ptr(const ConstMemoryRef<Ty>& ref) {
+        return ref.exists() ? ref.get() : nullptr;
+    }
+
+    /* Reference of a node, written with its children if not yet. A node shared in
+       the tree (a type of several declarations) is written once: one with more
+       references than owners, the refs held here for it, is looked up */
+    template<typename Ty>
+    uint32_t node(const ConstMemoryRef<Ty>& ref, int owners = 1) {
+        if (!ref.exists()) {
+            return 0;
+        }
+        const ASTBase* p = ref.get();
+        bool shared = ref.use_count() > owners;
+        if (shared) {
+            auto iter = _shared.find(p);
+            if (iter != _shared.end()) {
+                return iter->second;
+            }
+        }
+        uint32_t index = write(p);
+        if (shared) {
+            _shared[p] = index;
+        }
+        return index;
+    }
+
+    /* Reference of an expression, written with its children; Expressions are not shared */
+    template<typename Ty>
+    uint32_t node(const Handle<Ty>& h) {
+        return h.exists() ? write(&(*_exprs)[h]) : 0;
+    }
+
+    uint32_t write(const ASTBase* p) {
+        NodeRecord r = NodeRecord();
+        const std::type_info& type = typeid(*p);
+        if (type == typeid(OpAST)) {
+            const OpAST* n = static_cast<const OpAST*>(p);
+            r.tag = T_OP;
+            r.op = static_cast<uint16_t>(n->get_op());
+            r.ref[0] = node(n->get_lhs());
+            r.ref[1] = node(n->get_rhs());
+        }
+        else if (type == typeid(ValueAST)) {
+            r.tag = T_VALUE;
+            r.ref[0] = constant((*_exprs)[static_cast<const ValueAST*>(p)->get_value()]);
+        }
+        else if (type == typeid(IdAST)) {
+            r.tag = T_ID;
+            r.ref[0] = string(static_cast<const IdAST*>(p)->get_name());
+        }
+        else if (type == typeid(CallAST)) {
+            const CallAST* n = static_cast<const CallAST*>(p);
+            r.tag = T_CALL;
+            r.ref[0] = node(n->get_callee());
+            list(n->get_args(), r.ref[1], r.ref[2]);
+        }
+        else if (type == typeid(ListAST)) {
+            r.tag = T_LIST;
+            list(static_cast<const ListAST*>(p)->get_members(), r.ref[1], r.ref[2]);
+        }
+        else if (type == typeid(VarDeclAST)) {
+            const VarDeclAST* n = static_cast<const VarDeclAST*>(p);
+            r.tag = T_VARDECL;
+            r.ref[0] = node(n->get_type());
+            r.ref[1] = string(n->get_name());
+            r.ref[2] = node(n->get_initializer());
+        }
+        else if (type == typeid(FunctionAST)) {
+            const FunctionAST* n = static_cast<const FunctionAST*>(p);
+            r.tag = T_FUNCTION;
+            r.ref[0] = string(n->get_name());
+            std::vector<uint32_t> args;
+            for (size_t i = 0; i < n->get_arg_types().size(); i++) {
+                args.push_back(node(n->get_arg_types()[i]));
+                args.push_back(string(n->get_arg_names()[i]));
+            }
+            list(args, r.ref[1], r.ref[2]);
+            r.ref[3] = node(n->get_return_type());
+            const ExprPool* outer = _exprs;
+            _exprs = &n->get_body_exprs(*outer);
+            r.ref[4] = node(n->get_body());
+            _exprs = outer;
+        }
+        else if (type == typeid(ClassAST)) {
+            const ClassAST* n = static_cast<const ClassAST*>(p);
+            r.tag = T_CLASS;
+            r.ref[0] = string(n->get_name());
+            list(n->get_members(), r.ref[1], r.ref[2]);
+            list(n->get_methods(), r.ref[3], r.ref[4]);
+        }
+        else if (type == typeid(TypeAST)) {
+            const TypeAST* n = static_cast<const TypeAST*>(p);
+            r.tag = T_TYPE;
+            r.relation = static_cast<uint8_t>(n->get_relation());
+            switch (n->get_relation()) {
+            case TypeAST::NONE:
+                r.ref[0] = type_code(ptr(n->get_type()));
+                break;
+            case TypeAST::POINTER:
+                r.ref[0] = node(n->get_pointee(), 2);
+                break;
+            case TypeAST::CLASS:
+                r.ref[0] = string(n->get_class_name());
+                break;
+            default:
+                throw CSLError("AST cache: unsupported type node");
+            }
+        }
+        else if (type == typeid(ArrayTypeAST)) {
+            const ArrayTypeAST* n = static_cast<const ArrayTypeAST*>(p);
+            r.tag = T_ARRAYTYPE;
+            r.ref[0] = node(n->get_element_type(), 2);
+            r.ref[1] = node(n->get_size_expr());
+        }
+        else if (type == typeid(BlockStmtAST)) {
+            const BlockStmtAST* n = static_cast<const BlockStmtAST*>(p);
+            r.tag = T_BLOCK;
+            list(n->get_decls(), r.ref[0], r.ref[1]);
+            list(n->get_defs(), r.ref[2], r.ref[3]);
+            list(n->get_stmts(), r.ref[4], r.ref[5]);
+        }
+        else if (type == typeid(IfAST)) {
+            const IfAST* n = static_cast<const IfAST*>(p);
+            r.tag = T_IF;
+            r.ref[0] = node(n->get_condition());
+            r.ref[1] = node(n->get_true_stmt());
+            r.ref[2] = node(n->get_false_stmt());
+        }
+        else if (type == typeid(WhileAST)) {
+            const WhileAST* n = static_cast<const WhileAST*>(p);
+            r.tag = T_WHILE;
+            r.ref[0] = node(n->get_condition());
+            r.ref[1] = node(n->get_loop_stmt());
+        }
+        else if (type == typeid(ForAST)) {
+            const ForAST* n = static_cast<const ForAST*>(p);
+            r.tag = T_FOR;
+            r.ref[0] = node(n->get_init_expr());
+            r.ref[1] = node(n->get_condition());
+            r.ref[2] = node(n->get_loop_expr());
+            r.ref[3] = node(n->get_loop_stmt());
+        }
+        else if (type == typeid(ContinueAST)) {
+            r.tag = T_CONTINUE;
+        }
+        else if (type == typeid(BreakAST)) {
+            r.tag = T_BREAK;
+        }
+        else if (type == typeid(ReturnAST)) {
+            r.tag = T_RETURN;
+            r.ref[0] = node(static_cast<const ReturnAST*>(p)->get_ret_expr());
+        }
+        else if (type == typeid(ImportAST)) {
+            r.tag = T_IMPORT;
+            r.ref[0] = string(static_cast<const ImportAST*>(p)->get_path());
+        }
+        else if (type == typeid(ExprStmtAST)) {
+            r.tag = T_EXPRSTMT;
+            r.ref[0] = node(static_cast<const ExprStmtAST*>(p)->get_expr());
+        }
+        else {
+            throw CSLError(std::string("AST cache: unsupported node ") + type.name());
+        }
+
+        _records.push_back(r);
+        return static_cast<uint32_t>(_records.size());
+    }
+
+    template<typename Ref>
+    void list(const std::vector<Ref>& nodes, uint32_t& start, uint32_t& count) {
+        std::vector<uint32_t> refs;
+        refs.reserve(nodes.size());
+        for (const auto& n : nodes) {
+            refs.push_back(node(n));
+        }
+        list(refs, start, count);
+    }
+
+    void list(const std::vector<uint32_t>& refs, uint32_t& start, uint32_t& count) {
+        start = static_cast<uint32_t>(_refs.size());
+        count = static_cast<uint32_t>(refs.size());
+        _refs.insert(_refs.end(), refs.begin(), refs.end());
+    }
+
+    uint32_t string(const StringRef& s) {
+        return s.exists() ? string(s.to_cstr()) : 0;
+    }
+
+    /* Reference of a string of a ConstStringPool; Interned ones are written once per pool.
+       A tree with bodies parsed in parallel or lazily has names of several pools (Context::parts),
+       whose symbols collide: those not of the first pool seen of a symbol are looked up
+       by address */
+    uint32_t string(const char* text) {
+        const StringHeader& header = reinterpret_cast<const StringHeader*>(text)[-1];
+        bool interned = header.symbol != ConstStringPool::no_symbol;
+        bool other_pool = false;
+        if (interned && header.symbol < _symbols.size() && _symbols[header.symbol].second != 0) {
+            if (_symbols[header.symbol].first == text) {
+                return _symbols[header.symbol].second;
+            }
+            auto iter = _other_pools.find(text);
+            if (iter != _other_pools.end()) {
+                return iter->second;
+            }
+            other_pool = true;
+        }
+        StringEntry e = { static_cast<uint32_t>(_bytes.size()), header.length, interned ? 1u : 0u };
+        _bytes.append(text, header.length);
+        _strings.push_back(e);
+        uint32_t ref = static_cast<uint32_t>(_strings.size());
+        if (other_pool) {
+            _other_pools[text] = ref;
+        }
+        else if (interned) {
+            if (header.symbol >= _symbols.size()) {
+                _symbols.resize(header.symbol + 1, std::make_pair(nullptr, 0));
+            }
+            _symbols[header.symbol] = std::make_pair(text, ref);
+        }
+        return ref;
+    }
+
+    uint32_t constant(const Constant& c) {
+        ConstantEntry e = { type_code(ptr(c.get_type())), static_cast<uint32_t>(_bytes.size()),
+            static_cast<uint32_t>(c.get_size()) };
+        _bytes.append(c.get_string(), c.get_size());
+        _constants.push_back(e);
+        return static_cast<uint32_t>(_constants.size());
+    }
+
+    static uint32_t type_code(const Type* t) {
+        if (!t) {
+            return 0;
+        }
+        const std::type_info& type = typeid(*t);
+        if (type == typeid(PrimitiveType)) {
+            return TK_PRIMITIVE << 8 | t->get_id();
+        }
+        if (type == typeid(Type) && t->is_primitive()) {
+            return TK_PLAIN << 8 | t->get_id();
+        }
+        if (type == typeid(PointerType)) {
+            TypeRef pointee = static_cast<const PointerType*>(t)->get_pointee();
+            if (typeid(*pointee) == typeid(PrimitiveType) && pointee->get_id() == Type::CHAR) {
+                return TK_STRING << 8;
+            }
+        }
+        throw CSLError("AST cache: unsupported type");
+    }
+
+    std::vector<StringEntry> _strings;
+    std::vector<ConstantEntry> _constants;
+    std::vector<NodeRecord> _records;
+    std::vector<uint32_t> _refs;
+    std::string _bytes;
+
+    std::vector<std::pair<const char*, uint32_t> > _symbols;   // interned strings written, by symbol
+    std::unordered_map<const char*, uint32_t> _other_pools;     // of other pools, by address
+    std::unordered_map<const void*, uint32_t> _shared;  // of shared nodes
+
+    const ExprPool* _exprs;     // of the expressions of the nodes being written
+};
+
+
+class Reader {
+public:
+
+    Reader(const char* data, size_t length, Context& context, const ASTCache::Importer& import) :
+        _data(data), _length(length), _context(context), _import(import) {
+
+    }
+
+    BlockStmtASTRef read(uint64_t hash, size_t size) {
+        Header h;
+        if (_length < sizeof(h)) {
+            invalid("truncated");
+        }
+        memcpy(&h, _data, sizeof(h));
+        if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.format != format || h.version != ASTCache::version()) {
+            invalid("other version");
+        }
+        if (h.source_hash != hash || h.source_size != size) {
+            invalid("other source");
+        }
+
+        // 64-bit sums of 32-bit counts do not overflow
+        uint64_t strings = sizeof(h);
+        uint64_t constants = strings + uint64_t(h.string_count) * sizeof(StringEntry);
+        uint64_t records = constants + uint64_t(h.constant_count) * sizeof(ConstantEntry);
+        uint64_t refs = records + uint64_t(h.node_count) * sizeof(NodeRecord);
+        uint64_t bytes = refs + uint64_t(h.ref_count) * sizeof(uint32_t);
+        if (bytes + h.byte_count != _length) {
+            invalid("truncated");
+        }
+        _refs = _data + refs;
+        _ref_count = h.ref_count;
+        _bytes = _data + bytes;
+        _byte_count = h.byte_count;
+
+        _strings.reserve(h.string_count);
+        for (uint32_t i = 0; i < h.string_count; i++) {
+            StringEntry e;
+            memcpy(&e, _data + strings + i * sizeof(e), sizeof(e));
+            const char* text = bytes_at(e.offset, e.length);
+            _strings.push_back(e.interned ? _context.strpool.intern(text, text + e.length) :
+                _context.strpool.assign(text, text + e.length));
+        }
+
+        _constants.reserve(h.constant_count);
+        for (uint32_t i = 0; i < h.constant_count; i++) {
+            ConstantEntry e;
+            memcpy(&e, _data + constants + i * sizeof(e), sizeof(e));
+            TypeRef type = type_of(e.type);
+            if (!type.exists()) {
+                invalid("constant without type");
+            }
+            _constants.push_back(_context.exprpool.construct_constant(type, bytes_at(e.offset, e.size),
+                size_t(e.size)));
+        }
+
+        _nodes.reserve(h.node_count);
+        _exprs.reserve(h.node_count);
+        _tags.reserve(h.node_count);
+        for (uint32_t i = 0; i < h.node_count; i++) {
+            NodeRecord r;
+            memcpy(&r, _data + records + i * sizeof(r), sizeof(r));
+            if (r.tag < T_END && K_EXPR & 1u << r.tag) {
+                _exprs.push_back(expr_node(r));
+                _nodes.push_back(ASTRef());
+            }
+            else {
+                _nodes.push_back(node(r));
+                _exprs.push_back(ExprASTHandle());
+            }
+            _tags.push_back(r.tag);
+        }
+
+        return ref<BlockStmtAST>(h.root, 1 << T_BLOCK);
+    }
+
+private:
+
+    static void invalid(const char* what) {
+        throw ASTCache::Invalid(std::string("Invalid AST cache: ") + what);
+    }
+
+    const char* bytes_at(uint32_t offset, uint32_t size)const {
+        if (uint64_t(offset) + size > _byte_count) {
+            invalid("out of bounds");
+        }
+        return _bytes + offset;
+    }
+
+    /* Node of a reference to an earlier node, with a tag in kinds */
+    template<typename Ty>
+    ConstMemoryRef<Ty> ref(uint32_t r, uint32_t kinds)const {
+        if (r == 0) {
+            return ConstMemoryRef<Ty>();
+        }
+        if (r > _nodes.size() || !(kinds & 1u << _tags[r - 1])) {
+            invalid("bad node reference");
+        }
+        return _nodes[r - 1].cast<Ty>();
+    }
+
+    /* Expression of a reference to an earlier node, with a tag in kinds of K_EXPR */
+    template<typename Ty = ExprAST>
+    Handle<Ty> expr(uint32_t r, uint32_t kinds = K_EXPR)const {
+        if (r == 0) {
+            return Handle<Ty>();
+        }
+        if (r > _exprs.size() || !(kinds & 1u << _tags[r - 1])) {
+            invalid("bad node reference");
+        }
+        return _exprs[r - 1].template cast<Ty>();
+    }
+
+    template<typename Ty>
+    std::vector<ConstMemoryRef<Ty> > refs(uint32_t start, uint32_t count, uint32_t kinds)const {
+        std::vector<ConstMemoryRef<Ty> > ret;
+        ret.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            ret.push_back(ref<Ty>(ref_at(start, count, i), kinds));
+        }
+        return ret;
+    }
+
+    std::vector<ExprASTHandle> expr_list(uint32_t start, uint32_t count)const {
+        std::vector<ExprASTHandle> ret;
+        ret.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            ret.push_back(expr(ref_at(start, count, i)));
+        }
+        return ret;
+    }
+
+    uint32_t ref_at(uint32_t start, uint32_t count, uint32_t i)const {
+        if (uint64_t(start) + count > _ref_count) {
+            invalid("out of bounds");
+        }
+        uint32_t r;
+        memcpy(&r, _refs + (size_t(start) + i) * sizeof(uint32_t), sizeof(r));
+        return r;
+    }
+
+    StringRef string(uint32_t r)const {
+        if (r > _strings.size()) {
+            invalid("bad string reference");
+        }
+        return r == 0 ? StringRef() : _strings[r - 1];
+    }
+
+    ConstantHandle constant(uint32_t r)const {
+        if (r == 0 || r > _constants.size()) {
+            invalid("bad constant reference");
+        }
+        return _constants[r - 1];
+    }
+
+    TypeRef type_of(uint32_t code) {
+        uint32_t id = code & 0xff;
+        if (code == 0) {
+            return TypeRef();
+        }
+        if (code >> 8 == TK_PRIMITIVE && id <= Type::FLOAT) {
+            return _context.get_primitive_type(static_cast<Type::TypeID>(id));
+        }
+        if (code >> 8 == TK_PLAIN && id <= Type::FLOAT) {
+            return _context.typepool.construct<Type>(static_cast<Type::TypeID>(id)).to_const();
+        }
+        if (code == TK_STRING << 8) {
+            return _context.get_string_type();
+        }
+        invalid("bad type");
+        return TypeRef();
+    }
+
+    template<typename Ty, typename... Args>
+    ASTRef make(Args&&... args) {
+        return _context.astpool.construct<Ty>(std::forward<Args>(args)...).to_const().template cast<ASTBase>();
+    }
+
+    /* Expression of a record, by the constructors the parser uses */
+    ExprASTHandle expr_node(const NodeRecord& r) {
+        const uint32_t* a = r.ref;
+        ExprPool& pool = _context.exprpool;
+        switch (r.tag) {
+        case T_OP: {
+            ExprASTHandle rhs = expr(a[1]);
+            if (rhs.exists()) {
+                return pool.construct<OpAST>(static_cast<Operator>(r.op), expr(a[0]), rhs);
+            }
+            return pool.construct<OpAST>(static_cast<Operator>(r.op), expr(a[0]));
+        }
+        case T_VALUE:
+            return pool.construct<ValueAST>(constant(a[0]));
+        case T_ID:
+            return pool.construct<IdAST>(string(a[0]));
+        case T_CALL: {
+            Handle<CallAST> call = pool.construct<CallAST>();
+            pool.get(call)->set_callee(expr<IdAST>(a[0], 1 << T_ID));
+            for (const auto& arg : expr_list(a[1], a[2])) {
+                pool.get(call)->add_arg(arg);
+            }
+            return call;
+        }
+        case T_LIST: {
+            Handle<ListAST> list = pool.construct<ListAST>();
+            for (const auto& m : expr_list(a[1], a[2])) {
+                pool.get(list)->add_child(m);
+            }
+            return list;
+        }
+        default:
+            break;
+        }
+        invalid("bad node tag");
+        return ExprASTHandle();
+    }
+
+    /* Node of a record, by the constructors the parser uses */
+    ASTRef node(const NodeRecord& r) {
+        const uint32_t* a = r.ref;
+        switch (r.tag) {
+        case T_VARDECL:
+            return make<VarDeclAST>(ref<TypeAST>(a[0], K_TYPE), string(a[1]), expr(a[2]));
+        case T_FUNCTION: {
+            MemoryRef<FunctionAST> func = _context.astpool.construct<FunctionAST>(string(a[0]));
+            if (a[2] % 2 != 0) {
+                invalid("bad argument list");
+            }
+            for (uint32_t i = 0; i < a[2]; i += 2) {
+                func->add_argument(ref<TypeAST>(ref_at(a[1], a[2], i), K_TYPE), string(ref_at(a[1], a[2], i + 1)));
+            }
+            func->set_return_type(ref<TypeAST>(a[3], K_TYPE));
+            func->set_body_ast(ref<BlockStmtAST>(a[4], 1 << T_BLOCK));
+            return func.to_const().cast<ASTBase>();
+        }
+        case T_CLASS: {
+            StringRef name = string(a[0]);
+            MemoryRef<ClassAST> cls = _context.astpool.construct<ClassAST>(name);
+            for (const auto& m : refs<VarDeclAST>(a[1], a[2], 1 << T_VARDECL)) {
+                cls->add_member(m);
+            }
+            for (const auto& m : refs<FunctionAST>(a[3], a[4], 1 << T_FUNCTION)) {
+                cls->add_method(m);
+            }
+            // as parsing the declaration does, for later parses in the context
+            if (name.exists() && name.symbol() != ConstStringPool::no_symbol) {
+                _context.define_class(name.symbol());
+            }
+            return cls.to_const().cast<ASTBase>();
+        }
+        case T_TYPE:
+            switch (r.relation) {
+            case TypeAST::NONE: {
+                TypeRef type = type_of(a[0]);
+                if (!type.exists()) {
+                    invalid("type node without type");
+                }
+                return make<TypeAST>(type);
+            }
+            case TypeAST::POINTER: {
+                TypeASTRef pointee = ref<TypeAST>(a[0], K_TYPE);
+                if (!pointee.exists()) {
+                    invalid("pointer without pointee");
+                }
+                return make<TypeAST>(pointee);
+            }
+            case TypeAST::CLASS: {
+                StringRef name = string(a[0]);
+                if (!name.exists()) {
+                    invalid("class type without name");
+                }
+                return make<TypeAST>(name);
+            }
+            default:
+                invalid("bad type relation");
+            }
+            break;
+        case T_ARRAYTYPE:
+            return make<ArrayTypeAST>(ref<TypeAST>(a[0], K_TYPE), expr(a[1]));
+        case T_BLOCK: {
+            MemoryRef<BlockStmtAST> block = _context.astpool.construct<BlockStmtAST>();
+            for (const auto& d : refs<VarDeclAST>(a[0], a[1], 1 << T_VARDECL)) {
+                block->append(d);
+            }
+            for (const auto& d : refs<DeclAST>(a[2], a[3], K_DEF)) {
+                block->append(d);
+            }
+            for (const auto& s : refs<StmtAST>(a[4], a[5], K_STMT)) {
+                block->append(s);
+            }
+            return block.to_const().cast<ASTBase>();
+        }
+        case T_IF: {
+            StmtASTRef false_stmt = ref<StmtAST>(a[2], K_STMT);
+            if (false_stmt.exists()) {
+                return make<IfAST>(expr(a[0]), ref<StmtAST>(a[1], K_STMT), false_stmt);
+            }
+            return make<IfAST>(expr(a[0]), ref<StmtAST>(a[1], K_STMT));
+        }
+        case T_WHILE:
+            return make<WhileAST>(expr(a[0]), ref<StmtAST>(a[1], K_STMT));
+        case T_FOR:
+            return make<ForAST>(expr(a[0]), expr(a[1]), expr(a[2]), ref<StmtAST>(a[3], K_STMT));
+        case T_CONTINUE:
+            return make<ContinueAST>();
+        case T_BREAK:
+            return make<BreakAST>();
+        case T_RETURN:
+            return make<ReturnAST>(expr(a[0]));
+        case T_IMPORT: {
+            StringRef path = string(a[0]);
+            if (!path.exists()) {
+                invalid("import without path");
+            }
+            // imported again, which finds changes of the imported file
+            return make<ImportAST>(path, _import(path.to_string()));
+        }
+        case T_EXPRSTMT: {
+            ExprASTHandle e = expr(a[0]);
+            if (!e.exists()) {
+                invalid("expression statement without expression");
+            }
+            return make<ExprStmtAST>(e);
+        }
+        default:
+            break;
+        }
+        invalid("bad node tag");
+        return ASTRef();
+    }
+
+    const char* _data;
+    size_t _length;
+    const char* _refs;
+    uint32_t _ref_count;
+    const char* _bytes;
+    uint32_t _byte_count;
+
+    Context& _context;
+    const ASTCache::Importer& _import;
+
+    std::vector<StringRef> _strings;
+    std::vector<ConstantHandle> _constants;
+    std::vector<ASTRef> _nodes;             // by record, null for expressions
+    std::vector<ExprASTHandle> _exprs;      // by record, null for other nodes
+    std::vector<uint8_t> _tags;
+};
+
+}   // namespace
+
+
+ASTCache::ASTCache(const std::string& dir) : _dir(dir), _stats() {
+    if (!_dir.empty() && _dir.back() != '/' && _dir.back() != '\\') {
+        _dir += '/';
+    }
+}
+
+uint64_t ASTCache::version() {
+    // a build of other compiler or data layout writes files of another name
+    static const uint64_t key = [] {
+        const uint16_t endian = 1;
+        std::string s = "csl ast " + std::to_string(format) + " " CSL_ASTCACHE_COMPILER " " +
+            std::to_string(sizeof(void*)) + std::to_string(sizeof(unsigned)) + std::to_string(sizeof(double)) +
+            (*reinterpret_cast<const char*>(&endian) ? " le" : " be");
+        return hash_bytes(s.data(), s.size());
+    }();
+    return key;
+}
+
+std::string ASTCache::path_of(uint64_t hash, size_t size)const {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%llx-%016llx.ast", static_cast<unsigned long long>(hash),
+        static_cast<unsigned long long>(size), static_cast<unsigned long long>(version()));
+    return _dir + name;
+}
+
+BlockStmtASTRef ASTCache::load(uint64_t hash, size_t size, Context& context, const Importer& import) {
+    MappedFile file;
+    try {
+        file.open(path_of(hash, size));
+    }
+    catch (const CSLError&) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.misses++;
+        return BlockStmtASTRef();
+    }
+
+    Instrument::Scope timer(context.instrument, "cache load");
+    Context::Checkpoint cp = context.checkpoint();
+    try {
+        BlockStmtASTRef ast = deserialize(file.data(), file.size(), hash, size, context, import);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.hits++;
+        return ast;
+    }
+    catch (const Invalid&) {
+        context.rewind(cp);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.misses++;
+        _stats.invalid++;
+        return BlockStmtASTRef();
+    }
+    catch (...) {
+        // of an import, which parsing the source would meet too
+        context.rewind(cp);
+        throw;
+    }
+}
+
+bool ASTCache::store(uint64_t hash, size_t size, const BlockStmtASTRef& ast, const ExprPool& exprs) {
+    std::string data;
+    try {
+        data = serialize(hash, size, ast, exprs);
+    }
+    catch (const CSLError&) {
+        return false;
+    }
+
+#if defined(_WIN32)
+    _mkdir(_dir.c_str());
+#else
+    mkdir(_dir.c_str(), 0777);
+#endif
+
+    // written aside and renamed, so readers see a whole file or none
+    static std::atomic<unsigned> counter(0);
+    std::string path = path_of(hash, size);
+    std::string temp = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "." +
+        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "." + std::to_string(counter++);
+    FILE* fp = fopen(temp.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    ok = fclose(fp) == 0 && ok;
+    if (ok && std::rename(temp.c_str(), path.c_str()) != 0) {
+        // rename does not replace files on Windows
+        std::remove(path.c_str());
+        ok = std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) {
+        std::remove(temp.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.stores++;
+    return true;
+}
+
+std::string ASTCache::serialize(uint64_t hash, size_t size, const BlockStmtASTRef& ast, const ExprPool& exprs) {
+    return Writer(exprs).write(hash, size, ast);
+}
+
+BlockStmtASTRef ASTCache::deserialize(const char* data, size_t length, uint64_t hash, size_t size,
+    Context& context, const Importer& import) {
+    return Reader(data, length, context, import).read(hash, size);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef CSL_ASTCACHE_H
+#define CSL_ASTCACHE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "util/errors.h"
+#include "ast.h"
+#include "context.h"
+
+
+/* Trees of parsed files serialized in a directory, one file per source content
+   and compiler version, so a later run reads the tree back instead of lexing and
+   parsing an unchanged file. Imports are stored by path and imported again on
+   load, so changes of imported files are seen. Thread-safe. */
+class ASTCache {
+public:
+
+    /* Module of an import path as written in the source */
+    typedef std::function<std::shared_ptr<const Module>(const std::string&)> Importer;
+
+    /* Bytes not of a tree of this format, build and source content */
+    class Invalid : public CSLError {
+    public:
+        using CSLError::CSLError;
+    };
+
+    struct Stats {
+        size_t hits;
+        size_t misses;      // with invalid ones
+        size_t invalid;     // files found but not readable, e.g. truncated
+        size_t stores;
+    };
+
+    /* The directory is created on the first store if missing */
+    explicit ASTCache(const std::string& dir);
+
+    ASTCache(const ASTCache&) = delete;
+    ASTCache& operator=(const ASTCache&) = delete;
+
+    /* Key of the format and of the build writing it; Files of other versions are not read */
+    static uint64_t version();
+
+    /* Cache file of source content */
+    std::string path_of(uint64_t hash, size_t size)const;
+
+    /* Tree of source content read into context, or null if not cached or invalid.
+       Nothing is left in context on failure */
+    BlockStmtASTRef load(uint64_t hash, size_t size, Context& context, const Importer& import);
+
+    /* Save ast of source content, with its expressions in exprs; false if it cannot
+       be serialized or written */
+    bool store(uint64_t hash, size_t size, const BlockStmtASTRef& ast, const ExprPool& exprs);
+
+    /* Serialize ast of source content, with its expressions in exprs, to bytes;
+       Throws CSLError for nodes or types the format does not cover */
+    static std::string serialize(uint64_t hash, size_t size, const BlockStmtASTRef& ast, const ExprPool& exprs);
+
+    /* Tree of serialized bytes, built in context's pools; Throws Invalid if the
+       bytes are not of this version and source content, or what import throws */
+    static BlockStmtASTRef deserialize(const char* data, size_t length, uint64_t hash, size_t size,
+        Context& context, const Importer& import);
+
+    const std::string& dir()const {
+        return _dir;
+    }
+
+    Stats stats()const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+private:
+
+    std::string _dir;       // with trailing separator
+    Stats _stats;
+    mutable std::mutex _mutex;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#pragma once
+
+#ifndef CSL_ASTPOOL_H
+#define CSL_ASTPOOL_H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/memory.h"
+#include "ast.h"
+
+
+/* Pool of AST nodes with a slab of fixed-size slots per node class, so nodes
+   of the same kind (Ty::node_type) are contiguous. Nodes live until the pool
+   is cleared or destroyed, which frees their pages as a whole, or until it is
+   rewound past them, which keeps their pages for reuse. */
+class ASTPool {
+public:
+
+    /* Memory used by nodes of one kind */
+    struct Stats {
+        size_t nodes;   // nodes constructed
+        size_t slots;   // slots in allocated pages
+        size_t bytes;   // bytes of allocated pages
+        size_t pages;
+    };
+
+    ASTPool() {
+
+    }
+
+    ASTPool(const ASTPool&) = delete;
+    ASTPool& operator=(const ASTPool&) = delete;
+
+    ~ASTPool() {
+        clear();
+    }
+
+    /* Construct a new node in place */
+    template<typename Ty, typename... Args>
+    MemoryRef<Ty> construct(Args&&... args) {
+        static_assert(std::is_base_of<ASTBase, Ty>::value, "Not an AST node");
+
+        SlabPool& slab = get_slab<Ty>().pool;
+        Slot<Ty>* slot = static_cast<Slot<Ty>*>(slab.allocate());
+        Ty* node;
+        try {
+            node = new (&slot->object) Ty(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            slab.pop_back();
+            throw;
+        }
+        return MemoryRef<Ty>::_build(new (&slot->block) MemoryBlock(node));
+    }
+
+    /* Destroy all nodes and free all pages */
+    void clear() {
+        // nodes refer to nodes of other slabs, so no page is freed before all are destroyed
+        for (auto& slab : _slabs) {
+            if (slab) {
+                for (size_t i = 0; i < slab->pool.size(); i++) {
+                    slab->destroy(slab->pool.slot(i));
+                }
+            }
+        }
+        _slabs.clear();
+    }
+
+    /* Node count of each slab */
+    typedef std::vector<size_t> Checkpoint;
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp(_slabs.size(), 0);
+        for (size_t i = 0; i < _slabs.size(); i++) {
+            cp[i] = _slabs[i] ? _slabs[i]->pool.size() : 0;
+        }
+        return cp;
+    }
+
+    /* Destroy nodes constructed after cp; Pages are kept for reuse */
+    void rewind(const Checkpoint& cp) {
+        for (size_t i = 0; i < _slabs.size(); i++) {
+            if (_slabs[i]) {
+                size_t keep = i < cp.size() ? cp[i] : 0;
+                for (size_t j = keep; j < _slabs[i]->pool.size(); j++) {
+                    _slabs[i]->destroy(_slabs[i]->pool.slot(j));
+                }
+            }
+        }
+        for (size_t i = 0; i < _slabs.size(); i++) {
+            if (_slabs[i]) {
+                _slabs[i]->pool.truncate(i < cp.size() ? cp[i] : 0);
+            }
+        }
+    }
+
+    Stats stats(ASTBase::ASTType type)const {
+        Stats s = { 0, 0, 0, 0 };
+        for (const auto& slab : _slabs) {
+            if (slab && slab->type == type) {
+                s.nodes += slab->pool.size();
+                s.slots += slab->pool.capacity();
+                s.bytes += slab->pool.capacity() * slab->pool.slot_size();
+                s.pages += slab->pool.page_count();
+            }
+        }
+        return s;
+    }
+
+    /* Number of nodes */
+    size_t size()const {
+        size_t n = 0;
+        for (const auto& slab : _slabs) {
+            n += slab ? slab->pool.size() : 0;
+        }
+        return n;
+    }
+
+    /* Bytes of allocated pages */
+    size_t capacity()const {
+        size_t n = 0;
+        for (const auto& slab : _slabs) {
+            n += slab ? slab->pool.capacity() * slab->pool.slot_size() : 0;
+        }
+        return n;
+    }
+
+    /* Occupancy of each kind in use, one per line */
+    /* Node kinds, numbered 0 to kind_count - 1 */
+    enum { kind_count = 18 };
+
+    static ASTBase::ASTType kind(size_t i) {
+        static const ASTBase::ASTType types[kind_count] = {
+            ASTBase::OP, ASTBase::VALUE, ASTBase::ID, ASTBase::CALL, ASTBase::LIST,
+            ASTBase::DECL, ASTBase::FUNCTION, ASTBase::CLASS, ASTBase::TYPE,
+            ASTBase::BLOCK, ASTBase::IF, ASTBase::WHILE, ASTBase::FOR,
+            ASTBase::CONTINUE, ASTBase::BREAK, ASTBase::RETURN, ASTBase::IMPORT, ASTBase::EXPR
+        };
+        return types[i];
+    }
+
+    static const char* kind_name(size_t i) {
+        static const char* names[kind_count] = {
+            "op", "value", "id", "call", "list", "decl", "function", "class", "type",
+            "block", "if", "while", "for", "continue", "break", "return", "import", "expr"
+        };
+        return names[i];
+    }
+
+    void print_stats(std::ostream& os)const {
+        for (size_t i = 0; i < kind_count; i++) {
+            Stats s = stats(kind(i));
+            if (s.pages == 0) {
+                continue;
+            }
+            os << kind_name(i) << ": " << s.nodes << " nodes, " << s.bytes << " bytes in " << s.pages
+                << " pages, " << 100.0 * s.nodes / s.slots << "% used" << std::endl;
+        }
+    }
+
+private:
+
+    template<typename Ty>
+    struct Slot {
+        MemoryBlock block;
+        typename std::aligned_storage<sizeof(Ty), alignof(Ty)>::type object;
+    };
+
+    struct Slab {
+        ASTBase::ASTType type;
+        SlabPool pool;
+        void (*destroy)(void* slot);
+
+        Slab(ASTBase::ASTType type, size_t slot_size, size_t slot_align, void (*destroy)(void*)) :
+            type(type), pool(slot_size, slot_align), destroy(destroy) {
+
+        }
+    };
+
+    /* Dense index of node class, shared by all pools */
+    static size_t next_class_index() {
+        static std::atomic<size_t> count(0);
+        return count++;
+    }
+
+    template<typename Ty>
+    Slab& get_slab() {
+        static const size_t index = next_class_index();
+        if (index >= _slabs.size()) {
+            _slabs.resize(index + 1);
+        }
+        if (!_slabs[index]) {
+            _slabs[index].reset(new Slab(Ty::node_type, sizeof(Slot<Ty>), alignof(Slot<Ty>),
+                [](void* slot) { reinterpret_cast<Ty*>(&static_cast<Slot<Ty>*>(slot)->object)->~Ty(); }));
+        }
+        return *_slabs[index];
+    }
+
+    std::vector<std::unique_ptr<Slab>> _slabs;     // by class index
+};
+
+#endif
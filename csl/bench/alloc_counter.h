@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef CSL_BENCH_ALLOC_COUNTER_H
+#define CSL_BENCH_ALLOC_COUNTER_H
+
+#include <cstdlib>
+#include <new>
+
+/* Counts global operator new calls. Only include into a single translation unit */
+struct AllocCounter {
+    static size_t& count() {
+        static size_t n = 0;
+        return n;
+    }
+};
+
+void* operator new(size_t size) {
+    AllocCounter::count()++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    AllocCounter::count()++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "../lexer.h"
+#include "../tokenstream.h"
+#include "../util/threadpool.h"
+#include "alloc_counter.h"
+#include "report.h"
+
+#include <chrono>
+#include <regex>
+#include <thread>
+
+class LexerBench {
+public:
+
+    /* src is a program; repeat sizes the generated kernel input */
+    LexerBench(BenchReport& report, const std::string& src, size_t repeat=20000) : 
+        report(report), src(src), repeat(repeat) {
+
+    }
+
+    // tokens/s and bytes/s of the table-driven scanner, and its speedup over the former
+    // std::regex matcher on a prefix of regex_size bytes of the program
+    void bench_scanner(size_t regex_size = 1 << 20) {
+
+        size_t n = 0;
+        double t = time_it([&]() { n = lex_scanner(src); });
+
+        std::string prefix = make_prefix(regex_size);
+        size_t n_scan = 0, n_regex = 0;
+        double t_scan = time_it([&]() { n_scan = lex_scanner(prefix); });
+        double t_regex = time_it([&]() { n_regex = lex_regex(prefix); });
+
+        assert(n_scan == n_regex);
+
+        report.begin("lexer.scanner", "lexer " + std::to_string(src.size()) + " bytes, " + std::to_string(n) + " tokens");
+        report.add("scanner", { { "tokens/s", n / t }, { "MB/s", src.size() / t / 1e6 } });
+        report.add("regex", { { "tokens/s", n_regex / t_regex }, { "MB/s", prefix.size() / t_regex / 1e6 },
+            { "x slower", t_regex / t_scan } });
+    }
+
+    // tokens/s and bytes/s of each scan kernel level on long whitespace, identifier and string runs
+    void bench_kernels() {
+
+        std::string long_src = make_long_source();
+        ScanKernels::Level saved = Scanner::get_kernel_level();
+
+        report.begin("lexer.kernels", "scan kernels " + std::to_string(long_src.size()) + " bytes");
+
+        const char* names[] = { "scalar", "sse2", "avx2" };
+        for (int level = ScanKernels::SCALAR; level <= ScanKernels::AVX2; level++) {
+            Scanner::set_kernel_level(static_cast<ScanKernels::Level>(level));
+            if (Scanner::get_kernel_level() != level) {
+                report.note(std::string(names[level]) + ": not supported");
+                continue;
+            }
+            size_t n = 0;
+            double t = time_it([&]() { n = lex_scanner(long_src); });
+            report.add(names[level], { { "tokens/s", n / t }, { "MB/s", long_src.size() / t / 1e6 } });
+        }
+
+        Scanner::set_kernel_level(saved);
+    }
+
+    // heap allocations per token: zero-copy tokens against materializing every id/value text
+    void bench_allocations() {
+
+        Context context;
+
+        StrReader reader(src);
+        Lexer lexer;
+        lexer.load(&reader, &context);
+        TokenStream tokens;
+
+        size_t n0 = AllocCounter::count();
+        tokens.fill(lexer);
+        size_t n_lex = AllocCounter::count() - n0;
+
+        // what the lexer did before: copy into std::string, then into string pool
+        n0 = AllocCounter::count();
+        size_t n_pool = 0;
+        for (size_t i = 0; i < tokens.size(); i++, tokens.advance()) {
+            const Token& token = tokens.peek();
+            if (token.is_type(Token::ID) || token.is_type(Token::VALUE)) {
+                context.strpool.assign(token.get_text(reader.begin_ptr()).copy());
+                n_pool++;   // malloc of pool string is not counted by operator new
+            }
+        }
+        size_t n_copy = AllocCounter::count() - n0 + n_pool;
+
+        report.begin("lexer.allocations", "allocations " + std::to_string(tokens.size()) + " tokens");
+        report.add("zero-copy", { { "allocations/token", double(n_lex) / tokens.size() } });
+        report.add("materialized", { { "allocations/token", double(n_lex + n_copy) / tokens.size() } });
+    }
+
+    // tokens/s of sequential lexing against parallel lexing on 1..N threads
+    void bench_parallel() {
+
+        Context context;
+
+        auto lex = [&](ThreadPool* pool) {
+            StrReader reader(src);
+            Lexer lexer;
+            lexer.load(&reader, &context);
+            std::vector<Token> tokens;
+            pool ? lexer.tokenize(tokens, *pool) : lexer.tokenize(tokens);
+            return tokens.size();
+        };
+
+        size_t n = 0;
+        double t_seq = time_it([&]() { n = lex(nullptr); });
+
+        report.begin("lexer.parallel", "parallel lexer " + std::to_string(src.size()) + " bytes, " + std::to_string(n) + " tokens");
+        report.add("sequential", { { "tokens/s", n / t_seq } });
+
+        size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<size_t> thread_counts;
+        for (size_t threads = 1; threads < max_threads; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(max_threads);
+
+        for (size_t threads : thread_counts) {
+            ThreadPool pool(threads);
+            size_t n_par = 0;
+            double t = time_it([&]() { n_par = lex(&pool); });
+            assert(n_par == n);
+            report.add(std::to_string(threads) + " threads", { { "tokens/s", n_par / t }, { "x sequential", t_seq / t } });
+        }
+    }
+
+private:
+
+    // At most size bytes of the program, cut after a line
+    std::string make_prefix(size_t size)const {
+        if (src.size() <= size) {
+            return src;
+        }
+        size_t end = src.rfind('\n', size);
+        return src.substr(0, end == std::string::npos ? size : end + 1);
+    }
+
+    std::string make_long_source()const {
+        std::string ws(64, ' ');
+        std::string snippet = 
+            "generated_table_entry_with_a_rather_long_identifier_name_" + std::string("0123456789") + ws + "=" + ws +
+            "\"" + std::string(200, 'x') + "\\n" + std::string(100, 'y') + "\";\n" + ws + ws + "\t\n";
+
+        std::string long_src;
+        for (size_t i = 0; i < repeat / 4; i++) {
+            long_src += snippet;
+        }
+        return long_src;
+    }
+
+    size_t lex_scanner(const std::string& src)const {
+        Context context;
+        StrReader reader(src);
+        Lexer lexer;
+        lexer.load(&reader, &context);
+
+        size_t n = 0;
+        while (!lexer.get_token().is_type(Token::EOF)) {
+            n++;
+        }
+        return n;
+    }
+
+    // Token boundaries as matched by the regex lexer before the scanner
+    size_t lex_regex(const std::string& src)const {
+        static const std::regex re_list[] = {
+            std::regex("'(?:\\\\.|[^'\\\\])*'"),
+            std::regex("\"(?:\\\\.|[^\"\\\\])*\""),
+            std::regex("\\+\\+|\\-\\-|\\!\\=|\\-\\>|[\\+\\-\\*\\/\\%\\=\\^\\<\\>]\\=?|[\\.\\,\\:\\;\\{\\}\\(\\)\\[\\]]"),
+            std::regex("\\d*(?:\\.|e[+\\-]?)\\d+"),
+            std::regex("\\d+"),
+            std::regex("[_a-zA-Z][_0-9a-zA-Z]*")
+        };
+        static const std::regex re_ws("[ \\t\\n]+");
+
+        Context context;
+        size_t n = 0;
+        std::smatch m;
+        auto iter = src.begin();
+
+        while (iter != src.end()) {
+            if (std::regex_search(iter, src.end(), m, re_ws, std::regex_constants::match_continuous)) {
+                iter += m.length(0);
+                continue;
+            }
+            bool found = false;
+            for (const auto& re : re_list) {
+                if (std::regex_search(iter, src.end(), m, re, std::regex_constants::match_continuous)) {
+                    context.strpool.assign(&*iter, &*iter + m.length(0));
+                    iter += m.length(0);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                break;
+            }
+            n++;
+        }
+        return n;
+    }
+
+    template<typename Fn>
+    static double time_it(Fn fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BenchReport& report;
+    const std::string& src;
+    size_t repeat;
+};
@@ -0,0 +1,172 @@
+#include "../astpool.h"
+#include "../context.h"
+#include "../util/handle.h"
+#include "alloc_counter.h"
+#include "report.h"
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <vector>
+
+class MemoryBench {
+public:
+
+    explicit MemoryBench(BenchReport& report) : report(report) {
+
+    }
+
+    // nodes/s and heap allocations of building expression nodes: arena and slab
+    // pools against the former list-based pool, and trees linked by handle
+    void bench_ast_pools(size_t n = 1 << 22) {
+
+        ConstStringPool strpool;
+        StringRef name = strpool.assign("x");
+
+        report.begin("memory.ast_pools", "AST pools " + std::to_string(2 * n) + " nodes");
+        {
+            ListPool pool;
+            bench_pool("list", pool, name, n);
+        }
+        {
+            MemoryPool pool;
+            bench_pool("arena", pool, name, n);
+        }
+        {
+            ASTPool pool;
+            bench_pool("slabs", pool, name, n);
+        }
+        {
+            ExprPool pool;
+            size_t n0 = AllocCounter::count();
+            double t = time_it([&]() {
+                ExprASTHandle tree = pool.construct<IdAST>(name);
+                for (size_t i = 0; i < n; i++) {
+                    tree = pool.construct<OpAST>(Operator::ADD, tree, pool.construct<IdAST>(name));
+                }
+            });
+            size_t allocs = AllocCounter::count() - n0;
+            report.add("handles", { { "nodes/s", 2 * n / t }, { "allocations/node", double(allocs) / (2 * n) } });
+        }
+    }
+
+    // bytes, copy and dereference time of refcounted refs against 32-bit handles,
+    // on constants visited in shuffled order
+    void bench_handles(size_t n = 1 << 22) {
+
+        Context context;
+        TypeRef int_type = context.get_primitive_type(Type::INT);
+        MemoryPool ref_pool;
+        HandlePool<Constant> handle_pool;
+        std::vector<ConstantRef> refs;
+        std::vector<ConstantHandle> handles;
+        for (size_t i = 0; i < n; i++) {
+            int value = static_cast<int>(i);
+            const char* data = reinterpret_cast<const char*>(&value);
+            refs.push_back(ref_pool.construct<Constant>(int_type, data, sizeof(value)).to_const());
+            handles.push_back(handle_pool.construct(int_type, data, sizeof(value)));
+        }
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++) {
+            order[i] = (i * 2654435761u) % n;   // n is a power of 2, so a permutation
+        }
+
+        report.begin("memory.handles", "refs " + std::to_string(n) + " constants");
+        bench_visit("ref", refs, order, [&](const ConstantRef& r) { return r->get_int(); });
+        bench_visit("handle", handles, order, [&](const ConstantHandle& h) { return handle_pool[h].get_int(); });
+    }
+
+    // strings/s and heap allocations per string of ConstStringPool: copies by assign(),
+    // and intern() of new and of known names
+    void bench_strpool(size_t n = 1 << 20) {
+
+        std::vector<std::string> names;
+        for (size_t i = 0; i < n; i++) {
+            names.push_back("name_" + std::to_string(i * 7919 % n));
+        }
+
+        report.begin("memory.strpool", "string pool " + std::to_string(n) + " strings");
+        ConstStringPool pool;
+        bench_strings("assign", names, [&](const std::string& s) { return pool.assign(s).length(); });
+        bench_strings("intern new", names, [&](const std::string& s) { return pool.intern(s).symbol(); });
+        bench_strings("intern known", names, [&](const std::string& s) { return pool.intern(s).symbol(); });
+    }
+
+private:
+
+    template<typename Pool>
+    void bench_pool(const char* title, Pool& pool, const StringRef& name, size_t n) {
+        size_t n0 = AllocCounter::count();
+        double t = time_it([&]() {
+            for (size_t i = 0; i < n; i++) {
+                pool.template construct<IdAST>(name);
+                pool.template construct<OpAST>(Operator::ADD);
+            }
+        });
+        size_t allocs = AllocCounter::count() - n0;
+        report.add(title, { { "nodes/s", 2 * n / t }, { "allocations/node", double(allocs) / (2 * n) } });
+    }
+
+    template<typename Refs, typename Deref>
+    void bench_visit(const char* title, const Refs& refs, const std::vector<size_t>& order, Deref deref) {
+        size_t n = refs.size();
+        unsigned sum = 0;
+        double t_copy = time_it([&]() {
+            Refs copy = refs;   // as passing by value
+            sum += copy.size();
+        });
+        double t_visit = time_it([&]() {
+            for (size_t i : order) {
+                sum += deref(refs[i]);
+            }
+        });
+        report.add(title, { { "bytes", double(sizeof(refs[0])) }, { "ns/copy", t_copy / n * 1e9 },
+            { "ns/visit", t_visit / n * 1e9 } });
+        sink = sum;
+    }
+
+    template<typename Fn>
+    void bench_strings(const char* title, const std::vector<std::string>& names, Fn fn) {
+        size_t n0 = AllocCounter::count();
+        unsigned sum = 0;
+        double t = time_it([&]() {
+            for (const auto& s : names) {
+                sum += fn(s);
+            }
+        });
+        size_t allocs = AllocCounter::count() - n0;
+        report.add(title, { { "strings/s", names.size() / t }, { "allocations/string", double(allocs) / names.size() } });
+        sink = sum;
+    }
+
+    /* MemoryPool before the arena: a heap object and a list node per object.
+       Objects were freed without running destructors */
+    class ListPool {
+    public:
+
+        ~ListPool() {
+            for (auto& block : _mylist) {
+                ::operator delete(block.ptr);
+            }
+        }
+
+        template<typename Ty, typename... Args>
+        MemoryRef<Ty> construct(Args&&... args) {
+            _mylist.push_front(MemoryBlock(new Ty(std::forward<Args>(args)...)));
+            return MemoryRef<Ty>::_build(&_mylist.front());
+        }
+
+    private:
+        std::list<MemoryBlock> _mylist;
+    };
+
+    template<typename Fn>
+    static double time_it(Fn fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BenchReport& report;
+    volatile unsigned sink;     // keeps results of timed loops alive
+};
@@ -0,0 +1,348 @@
+#include "../parser.h"
+#include "alloc_counter.h"
+#include "report.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ParserBench {
+public:
+
+    /* src is a program for parse_string; exprs are lines for parse_line_expr */
+    ParserBench(BenchReport& report, const std::string& src, const std::vector<std::string>& exprs) :
+        report(report), src(src), exprs(exprs) {
+
+    }
+
+    // bytes/s, AST nodes/s, lex and parse time and resident memory of parsing a
+    // large program, with occupancy of AST slabs by kind
+    void bench_parse() {
+
+        size_t nodes = 0, capacity = 0, rss = 0;
+        std::ostringstream pool_stats;
+        Instrument instrument;
+
+        size_t rss_start = current_rss();
+        double t = time_it([&]() {
+            RDParser parser;
+            Context context;
+            context.instrument = &instrument;
+            parser.load_context(&context);
+            parser.parse_string(src);
+            nodes = context.astpool.size() + context.exprpool.size();
+            capacity = context.astpool.capacity() + context.exprpool.capacity();
+            context.astpool.print_stats(pool_stats);
+            rss = current_rss();    // tokens and AST are all alive here
+        });
+
+        report.begin("parser.parse", "parser " + std::to_string(src.size() >> 20) + " MB, " +
+            std::to_string(nodes) + " AST nodes");
+        report.add("parse_string", { { "MB/s", src.size() / t / 1e6 }, { "nodes/s", nodes / t } });
+        report.add("phases", { { "s lex", instrument.seconds("lex") }, { "s parse", instrument.seconds("parse") } });
+        report.add("memory", { { "MB AST pool", double(capacity >> 20) }, { "MB RSS growth", double((rss - rss_start) >> 20) } });
+
+        std::istringstream lines(pool_stats.str());
+        for (std::string line; std::getline(lines, line); ) {
+            report.note(line);
+        }
+
+        if (!trace_file.empty()) {
+            std::ofstream out(trace_file, std::ios::binary);
+            instrument.write_trace(out);
+        }
+    }
+
+    /* Write the Chrome trace of bench_parse() to filename */
+    void set_trace_file(const std::string& filename) {
+        trace_file = filename;
+    }
+
+    // expressions/s, nodes/s and heap allocations per parse of short expressions on a
+    // shared context, with and without rewinding it to a checkpoint after each parse
+    void bench_line_expr(size_t n = 1 << 20) {
+
+        // nodes and bytes of each expression
+        std::vector<size_t> expr_nodes;
+        {
+            RDParser parser;
+            Context context;
+            parser.load_context(&context);
+            for (const auto& expr : exprs) {
+                size_t size0 = context.exprpool.size();
+                parser.parse_line_expr(expr);
+                expr_nodes.push_back(context.exprpool.size() - size0);
+            }
+        }
+        size_t bytes = 0, nodes = 0;
+        for (size_t i = 0; i < n; i++) {
+            bytes += exprs[i % exprs.size()].size();
+            nodes += expr_nodes[i % exprs.size()];
+        }
+        report.begin("parser.line_expr", "line expressions " + std::to_string(n) + " parses");
+
+        for (bool rewind : { false, true }) {
+            RDParser parser;
+            Context context;
+            parser.load_context(&context);
+            parser.parse_line_expr(exprs[0]);  // warm up
+            Context::Checkpoint cp = context.checkpoint();
+
+            size_t n0 = AllocCounter::count();
+            double t = time_it([&]() {
+                for (size_t i = 0; i < n; i++) {
+                    parser.parse_line_expr(exprs[i % exprs.size()]);
+                    if (rewind) {
+                        context.rewind(cp);
+                    }
+                }
+            });
+            size_t allocs = AllocCounter::count() - n0;
+            report.add(rewind ? "rewind" : "grow", { { "parses/s", n / t }, { "nodes/s", nodes / t },
+                { "MB/s", bytes / t / 1e6 }, { "allocations/parse", double(allocs) / n },
+                { "KB AST pool", double(context.exprpool.capacity() >> 10) } });
+        }
+    }
+
+    // parses/s and heap allocations per parse of expressions nested depth levels
+    // deep, rewinding the context after each parse
+    void bench_nested_expr(const std::vector<std::string>& nested, unsigned depth, size_t n) {
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; i++) {
+            bytes += nested[i % nested.size()].size();
+        }
+        report.begin("parser.nested_expr", "expressions nested " + std::to_string(depth) + " deep, " +
+            std::to_string(n) + " parses");
+
+        RDParser parser;
+        Context context;
+        parser.load_context(&context);
+        parser.parse_line_expr(nested[0]);  // warm up
+        Context::Checkpoint cp = context.checkpoint();
+
+        size_t n0 = AllocCounter::count();
+        double t = time_it([&]() {
+            for (size_t i = 0; i < n; i++) {
+                parser.parse_line_expr(nested[i % nested.size()]);
+                context.rewind(cp);
+            }
+        });
+        size_t allocs = AllocCounter::count() - n0;
+        report.add("parse", { { "parses/s", n / t }, { "MB/s", bytes / t / 1e6 },
+            { "ns/level", t / n / depth * 1e9 }, { "allocations/parse", double(allocs) / n } });
+    }
+
+    // bytes/s of parsing independent sources with RDParser::parse_all on 1..N threads,
+    // against parsing them one after another
+    void bench_parallel(const std::vector<std::string>& sources) {
+
+        size_t bytes = 0;
+        for (const auto& source : sources) {
+            bytes += source.size();
+        }
+
+        // trees are kept, as by parse_all()
+        double t_seq = time_it([&]() {
+            std::vector<ParseUnit> units(sources.size());
+            RDParser parser;
+            for (size_t i = 0; i < sources.size(); i++) {
+                units[i].context.reset(new Context());
+                parser.load_context(units[i].context.get());
+                units[i].ast = parser.parse_string(sources[i]);
+            }
+        });
+
+        report.begin("parser.parallel", "parallel parser " + std::to_string(sources.size()) + " sources, " +
+            std::to_string(bytes >> 20) + " MB");
+        report.add("sequential", { { "MB/s", bytes / t_seq / 1e6 } });
+
+        size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<size_t> thread_counts;
+        for (size_t threads = 1; threads < max_threads; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(max_threads);
+
+        for (size_t threads : thread_counts) {
+            ThreadPool pool(threads);
+            double t = time_it([&]() {
+                std::vector<ParseUnit> units = RDParser::parse_all(sources, pool);
+                for (const auto& unit : units) {
+                    if (unit.error) {
+                        std::rethrow_exception(unit.error);
+                    }
+                }
+            });
+            report.add(std::to_string(threads) + " threads", { { "MB/s", bytes / t / 1e6 }, { "x sequential", t_seq / t } });
+        }
+    }
+
+    // imports/s of files through a ModuleCache: parsed on the first import,
+    // then found by content hash
+    void bench_import(const std::vector<std::string>& sources) {
+
+        std::string main_src;
+        size_t bytes = 0;
+        for (size_t i = 0; i < sources.size(); i++) {
+            std::string filename = "bench_module_" + std::to_string(i) + ".csl";
+            std::ofstream(filename, std::ios::binary) << sources[i];
+            main_src += "import \"" + filename + "\";\n";
+            bytes += sources[i].size();
+        }
+
+        report.begin("parser.import", "imports " + std::to_string(sources.size()) + " files, " +
+            std::to_string(bytes >> 20) + " MB");
+        ModuleCache cache;
+        for (const char* name : { "miss", "hit" }) {
+            RDParser parser;
+            Context context;
+            context.modules = &cache;
+            parser.load_context(&context);
+            double t = time_it([&]() { parser.parse_string(main_src); });
+            report.add(name, { { "imports/s", sources.size() / t }, { "MB/s", bytes / t / 1e6 } });
+        }
+        ModuleCache::Stats stats = cache.stats();
+        report.note(std::to_string(stats.hits) + " hits, " + std::to_string(stats.misses) + " misses");
+
+        for (size_t i = 0; i < sources.size(); i++) {
+            remove(("bench_module_" + std::to_string(i) + ".csl").c_str());
+        }
+    }
+
+    // startup of a file: lexed and parsed cold, parsed and stored in an ASTCache,
+    // then read back from the cache file
+    void bench_ast_cache() {
+
+        const char* filename = "bench_ast_cache.csl";
+        std::ofstream(filename, std::ios::binary) << src;
+        ASTCache cache("bench_ast_cache");
+
+        report.begin("parser.ast_cache", std::to_string(src.size() >> 10) + " KB source");
+        double t_cold = 0;
+        for (const char* name : { "cold", "store", "load" }) {
+            RDParser parser;
+            Context context;
+            if (std::string(name) != "cold") {
+                context.ast_cache = &cache;
+            }
+            parser.load_context(&context);
+            double t = time_it([&]() { parser.parse_file(filename); });
+            t_cold = t_cold > 0 ? t_cold : t;
+            report.add(name, { { "MB/s", src.size() / t / 1e6 }, { "x cold", t_cold / t } });
+        }
+
+        uint64_t hash = hash_bytes(src.data(), src.size());
+        std::string cached = cache.path_of(hash, src.size());
+        std::ifstream file(cached, std::ios::binary | std::ios::ate);
+        ASTCache::Stats stats = cache.stats();
+        report.note(std::to_string(file.tellg()) + " bytes cached, " + std::to_string(stats.hits) + " hits, " +
+            std::to_string(stats.stores) + " stores");
+        file.close();
+
+        remove(cached.c_str());
+        remove("bench_ast_cache");
+        remove(filename);
+    }
+
+    // load time and memory of a module of functions with bodies parsed at once, and
+    // with bodies left in source; then the time to parse all bodies left
+    void bench_lazy(const std::string& module, size_t functions) {
+
+        const char* filename = "bench_lazy.csl";
+        std::ofstream(filename, std::ios::binary) << module;
+
+        report.begin("parser.lazy", std::to_string(functions) + " functions, " +
+            std::to_string(module.size() >> 10) + " KB source");
+        double t_eager = 0;
+        for (bool lazy : { false, true }) {
+            RDParser parser;
+            Context context;
+            parser.load_context(&context);
+            parser.set_lazy_bodies(lazy);
+            BlockStmtASTRef tree;
+            double t = time_it([&]() { tree = parser.parse_file(filename).cast<BlockStmtAST>(); });
+            t_eager = lazy ? t_eager : t;
+            size_t kept = lazy ? module.size() : 0;    // source copied for the bodies
+            report.add(lazy ? "lazy" : "eager", { { "ms load", t * 1e3 }, { "x eager", t_eager / t },
+                { "AST nodes", double(context.astpool.size() + context.exprpool.size()) },
+                { "KB memory", double((context.astpool.capacity() + context.exprpool.capacity() + kept) >> 10) } });
+
+            if (lazy) {
+                double t_bodies = time_it([&]() {
+                    for (const auto& d : tree->get_defs()) {
+                        d.cast<FunctionAST>()->get_body();
+                    }
+                });
+                report.add("lazy, all bodies", { { "ms load", (t + t_bodies) * 1e3 }, { "x eager", t_eager / (t + t_bodies) },
+                    { "AST nodes", double(context.astpool.size() + context.exprpool.size()) },
+                    { "KB memory", double((context.astpool.capacity() + context.exprpool.capacity() + kept) >> 10) } });
+            }
+        }
+        remove(filename);
+    }
+
+    // bytes/s of parsing a module of functions with bodies parsed on 1..N threads,
+    // against parsing it in one pass
+    void bench_parallel_bodies(const std::string& module, size_t functions) {
+
+        double t_seq = time_it([&]() {
+            RDParser parser;
+            Context context;
+            parser.load_context(&context);
+            parser.parse_string(module);
+        });
+
+        report.begin("parser.parallel_bodies", std::to_string(functions) + " functions, " +
+            std::to_string(module.size() >> 10) + " KB source");
+        report.add("sequential", { { "MB/s", module.size() / t_seq / 1e6 } });
+
+        size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<size_t> thread_counts;
+        for (size_t threads = 1; threads < max_threads; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(max_threads);
+
+        size_t parts = 0;
+        for (size_t threads : thread_counts) {
+            ThreadPool pool(threads);
+            RDParser parser;
+            Context context;
+            parser.load_context(&context);
+            parser.set_thread_pool(&pool);
+            parser.set_parallel_bodies(true);
+            double t = time_it([&]() { parser.parse_string(module); });
+            parts = context.parts.size();
+            report.add(std::to_string(threads) + " threads", { { "MB/s", module.size() / t / 1e6 }, { "x sequential", t_seq / t } });
+        }
+        report.note(std::to_string(parts) + " body contexts");
+    }
+
+private:
+
+    static size_t current_rss() {
+        std::ifstream statm("/proc/self/statm");
+        size_t pages = 0, resident = 0;
+        if (statm >> pages >> resident) {
+            return resident * 4096;
+        }
+        return 0;
+    }
+
+    template<typename Fn>
+    static double time_it(Fn fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BenchReport& report;
+    const std::string& src;
+    const std::vector<std::string>& exprs;
+    std::string trace_file;
+};
@@ -0,0 +1,186 @@
+#include "../lexer.h"
+#include "../tokenstream.h"
+#include "../util/mappedfile.h"
+#include "report.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <streambuf>
+#include <vector>
+
+class SourceBench {
+public:
+
+    /* src is repeated to make files and streams of any size */
+    SourceBench(BenchReport& report, const std::string& src, const char* filename = "bench_source.csl") : 
+        report(report), src(src), filename(filename) {
+
+    }
+
+    // startup latency (open + first token) and full lexing time of a file:
+    // read into a string and copied into StrReader, against a mapped view
+    void bench_startup(const std::vector<size_t>& sizes) {
+
+        report.begin("source.startup", "source files");
+        for (size_t size : sizes) {
+            write_source(size);
+
+            size_t n_copy = 0, n_map = 0;
+            double t_copy_first = 0, t_map_first = 0;
+            double t_copy = time_it([&]() { n_copy = lex_copied(t_copy_first); });
+            double t_map = time_it([&]() { n_map = lex_mapped(t_map_first); });
+
+            assert(n_copy == n_map);
+
+            std::string mb = std::to_string(size >> 20) + " MB";
+            report.note(mb + ", " + std::to_string(n_map) + " tokens");
+            report.add("copied " + mb, { { "ms first token", t_copy_first * 1e3 }, { "ms all", t_copy * 1e3 } });
+            report.add("mapped " + mb, { { "ms first token", t_map_first * 1e3 }, { "ms all", t_map * 1e3 } });
+
+            remove(filename);
+        }
+    }
+
+    // tokens/s and resident memory while streaming a generated program through a pipe-like
+    // std::istream, as RDParser::parse_stream does
+    void bench_stream(size_t size) {
+
+        GeneratedSource gen(make_block(), size);
+        std::istream is(&gen);
+
+        Context context;
+        StreamReader reader(is);
+        Lexer lexer;
+        lexer.load(&reader, &context);
+        TokenStream tokens;
+
+        size_t rss_start = current_rss();
+        size_t rss_max = rss_start;
+        size_t n = 0;
+
+        double t = time_it([&]() {
+            tokens.attach(lexer);
+            for (; !tokens.peek().is_type(Token::EOF); tokens.advance()) {
+                if (++n % (1 << 22) == 0) {
+                    rss_max = std::max(rss_max, current_rss());
+                }
+            }
+        });
+
+        report.begin("source.stream", "stream " + std::to_string(size >> 20) + " MB, " + std::to_string(n) + " tokens");
+        report.add("stream", { { "tokens/s", n / t }, { "MB/s", size / t / 1e6 },
+            { "MB RSS start", double(rss_start >> 20) }, { "MB RSS max", double(rss_max >> 20) } });
+    }
+
+private:
+
+    /* Repeats a block up to size bytes */
+    class GeneratedSource : public std::streambuf {
+    public:
+
+        GeneratedSource(const std::string& block, size_t size) : block(block), left(size) {
+
+        }
+
+    protected:
+
+        int_type underflow() {
+            if (left == 0) {
+                return traits_type::eof();
+            }
+            size_t n = std::min(block.size(), left);
+            left -= n;
+            setg(&block[0], &block[0], &block[0] + n);
+            return traits_type::to_int_type(block[0]);
+        }
+
+    private:
+
+        std::string block;
+        size_t left;
+    };
+
+    // Resident set size in bytes; 0 if not available
+    static size_t current_rss() {
+        std::ifstream statm("/proc/self/statm");
+        size_t pages = 0, resident = 0;
+        if (statm >> pages >> resident) {
+            return resident * 4096;
+        }
+        return 0;
+    }
+
+    // 1 MB of whole lines of the program, padded with spaces
+    std::string make_block()const {
+        const size_t size = 1 << 20;
+        std::string block;
+        while (block.size() < size) {
+            size_t end = src.rfind('\n', size - block.size());
+            if (end == std::string::npos) {
+                break;
+            }
+            block.append(src, 0, end + 1);
+        }
+        block.resize(size, ' ');
+        return block;
+    }
+
+    void write_source(size_t size)const {
+        std::string block = make_block();
+
+        std::ofstream out(filename, std::ios::binary);
+        for (size_t n = 0; n < size; n += block.size()) {
+            out.write(block.data(), std::min(block.size(), size - n));
+        }
+    }
+
+    // What loading a file took before: read into a string, copied again by StrReader
+    size_t lex_copied(double& t_first)const {
+        auto start = std::chrono::steady_clock::now();
+
+        std::ifstream in(filename, std::ios::binary);
+        in.seekg(0, std::ios::end);
+        std::string text(static_cast<size_t>(in.tellg()), '\0');
+        in.seekg(0);
+        in.read(&text[0], text.size());
+
+        StrReader reader(text);
+        return lex(reader, start, t_first);
+    }
+
+    size_t lex_mapped(double& t_first)const {
+        auto start = std::chrono::steady_clock::now();
+
+        MappedFile file(filename);
+        StrReader reader(file.data(), file.end());
+        return lex(reader, start, t_first);
+    }
+
+    size_t lex(StrReader& reader, std::chrono::steady_clock::time_point start, double& t_first)const {
+        Context context;
+        Lexer lexer;
+        lexer.load(&reader, &context);
+
+        size_t n = 1;
+        lexer.get_token();
+        t_first = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        while (!lexer.get_token().is_type(Token::EOF)) {
+            n++;
+        }
+        return n;
+    }
+
+    template<typename Fn>
+    static double time_it(Fn fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BenchReport& report;
+    const std::string& src;
+    const char* filename;
+};
@@ -0,0 +1,142 @@
+#include "../util/strmap.h"
+#include "alloc_counter.h"
+#include "report.h"
+
+#include <cassert>
+#include <chrono>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class StrMapBench {
+public:
+
+    StrMapBench(BenchReport& report, size_t lookups=1 << 22) : report(report), lookups(lookups) {
+
+    }
+
+    // inserts/s, lookups/s (hits and misses by StringTmpRef into a source buffer) and
+    // heap allocations per insert: flat table against the former map-based StrMap and
+    // std::unordered_map, for a typename-cache-sized and a large key set
+    void bench_lookup() {
+        for (size_t n : { size_t(64), size_t(1) << 16 }) {
+            std::string text = make_keys(2 * n);   // first n are inserted, last n are misses
+            std::vector<StringTmpRef> keys = split_keys(text);
+
+            report.begin("strmap.lookup", "string maps " + std::to_string(n) + " keys");
+            {
+                StrMap<int> map;
+                bench_map("flat " + std::to_string(n), map, keys,
+                    [](StrMap<int>& m, const StringTmpRef& k, int v) { m.insert(k, v); },
+                    [](const StrMap<int>& m, const StringTmpRef& k) { return m.has_key(k); });
+            }
+            {
+                OldStrMap<int> map;
+                bench_map("std::map " + std::to_string(n), map, keys,
+                    [](OldStrMap<int>& m, const StringTmpRef& k, int v) { m.insert({ k.copy(), v }); },
+                    [](const OldStrMap<int>& m, const StringTmpRef& k) { return m.has_key(k); });
+            }
+            {
+                std::unordered_map<std::string, int> map;
+                bench_map("unordered_map " + std::to_string(n), map, keys,
+                    [](std::unordered_map<std::string, int>& m, const StringTmpRef& k, int v) { m.insert({ k.copy(), v }); },
+                    [](const std::unordered_map<std::string, int>& m, const StringTmpRef& k) { return m.count(k.copy()) != 0; });
+            }
+        }
+    }
+
+private:
+
+    template<typename Map, typename Insert, typename Find>
+    void bench_map(const std::string& title, Map& map, const std::vector<StringTmpRef>& keys, Insert insert, Find find) {
+        size_t n = keys.size() / 2;
+
+        size_t n0 = AllocCounter::count();
+        double t_insert = time_it([&]() {
+            for (size_t i = 0; i < n; i++) {
+                insert(map, keys[i], static_cast<int>(i));
+            }
+        });
+        size_t allocs = AllocCounter::count() - n0;
+
+        size_t found = 0, rounds = lookups / n;
+        double t_hit = time_it([&]() {
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < n; i++) {
+                    found += find(map, keys[i]);
+                }
+            }
+        });
+        double t_miss = time_it([&]() {
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t i = n; i < 2 * n; i++) {
+                    found += find(map, keys[i]);
+                }
+            }
+        });
+        assert(found == rounds * n);
+        sink = found;
+
+        report.add(title, { { "inserts/s", n / t_insert }, { "hits/s", rounds * n / t_hit },
+            { "misses/s", rounds * n / t_miss }, { "allocations/insert", double(allocs) / n } });
+    }
+
+    /* StrMap before the flat table: std::map with strncmp ordering over a list of key copies */
+    template<typename Ty>
+    class OldStrMap {
+    public:
+
+        bool has_key(const StringTmpRef& str)const {
+            return _map.find(str) != _map.end();
+        }
+
+        void insert(const std::pair<std::string, Ty>& p) {
+            _strkeys.push_front(p.first);
+            auto insert_ret = _map.insert({ StringTmpRef(_strkeys.front()), p.second });
+            if (!insert_ret.second) {
+                _strkeys.pop_front();
+            }
+        }
+
+    private:
+        std::list<std::string> _strkeys;
+        std::map<StringTmpRef, Ty> _map;
+    };
+
+    // identifier-like keys separated by spaces, sharing prefixes as in real programs
+    static std::string make_keys(size_t n) {
+        const char* stems[] = { "count", "value", "node_", "Parser", "i", "table_index", "tmp" };
+        std::string text;
+        for (size_t i = 0; i < n; i++) {
+            text += stems[i % 7];
+            text += std::to_string(i);
+            text += ' ';
+        }
+        return text;
+    }
+
+    static std::vector<StringTmpRef> split_keys(const std::string& text) {
+        std::vector<StringTmpRef> keys;
+        const char* p = text.data();
+        const char* end = p + text.size();
+        while (p < end) {
+            const char* sp = static_cast<const char*>(memchr(p, ' ', end - p));
+            keys.push_back(StringTmpRef(p, sp));
+            p = sp + 1;
+        }
+        return keys;
+    }
+
+    template<typename Fn>
+    static double time_it(Fn fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BenchReport& report;
+    size_t lookups;
+    volatile size_t sink;   // keeps results of timed loops alive
+};
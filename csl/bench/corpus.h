@@ -0,0 +1,342 @@
+#pragma once
+
+#ifndef CSL_BENCH_CORPUS_H
+#define CSL_BENCH_CORPUS_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Proportions of a generated program */
+struct CorpusShape {
+    // relative frequency of statement kinds
+    unsigned decl, assign, cond, loop, block;
+
+    unsigned depth;         // deepest nesting of blocks
+    unsigned terms;         // most operands of an expression
+    unsigned idents;        // distinct identifiers
+    unsigned ident_length;  // letters of an identifier, before its number
+    unsigned list_length;   // most values of an initializer list
+    unsigned strings;       // percentage of literals that are strings or chars
+
+    /* Statements of all kinds, like hand-written code */
+    static CorpusShape mixed() {
+        CorpusShape s = { 4, 6, 3, 2, 1, 3, 6, 500, 5, 8, 10 };
+        return s;
+    }
+
+    /* Mostly long expressions */
+    static CorpusShape expr() {
+        CorpusShape s = { 1, 10, 1, 1, 0, 1, 24, 200, 4, 4, 5 };
+        return s;
+    }
+
+    /* Deeply nested control flow with short expressions */
+    static CorpusShape nested() {
+        CorpusShape s = { 2, 3, 6, 6, 2, 12, 3, 100, 3, 4, 5 };
+        return s;
+    }
+
+    /* Data tables: long initializer lists of literals */
+    static CorpusShape tables() {
+        CorpusShape s = { 10, 1, 0, 0, 0, 1, 2, 50, 6, 64, 40 };
+        return s;
+    }
+
+    /* Many distinct long identifiers */
+    static CorpusShape identifiers() {
+        CorpusShape s = { 4, 6, 2, 2, 1, 2, 6, 200000, 16, 4, 5 };
+        return s;
+    }
+
+    static CorpusShape by_name(const std::string& name) {
+        if (name == "mixed") return mixed();
+        if (name == "expr") return expr();
+        if (name == "nested") return nested();
+        if (name == "tables") return tables();
+        if (name == "idents") return identifiers();
+        throw std::invalid_argument("Unknown corpus shape: " + name);
+    }
+};
+
+
+/* Deterministic generator of CSL programs that RDParser::parse_string accepts.
+   The same shape and seed give the same text on every platform. */
+class CorpusGenerator {
+public:
+
+    explicit CorpusGenerator(const CorpusShape& shape, uint64_t seed = 1) : shape(shape), state(seed) {
+        static const char* stems[] = { "value", "count", "node", "total", "index", "ptr", "item", "delta" };
+        for (unsigned i = 0; i < shape.idents || i == 0; i++) {
+            // a trailing number keeps names clear of reserved words
+            std::string name = stems[i % 8];
+            while (name.size() < shape.ident_length) {
+                name += static_cast<char>('a' + next(26));
+            }
+            name.resize(shape.ident_length > 0 ? shape.ident_length : 1);
+            names.push_back(name + std::to_string(i));
+        }
+    }
+
+    /* Top-level statements of about size bytes, each on its own lines */
+    std::string program(size_t size) {
+        std::string src;
+        src.reserve(size + 1024);
+        while (src.size() < size) {
+            statement(src, 0);
+        }
+        return src;
+    }
+
+    /* A module of functions with bodies of a few statements, then a call of each */
+    std::string module(size_t functions) {
+        static const char* types[] = { "int", "float", "char", "bool" };
+        std::string src;
+        for (size_t i = 0; i < functions; i++) {
+            src += "fn func" + std::to_string(i) + "(a: int, b: " + types[next(4)] + "*) -> int {\n";
+            unsigned n = 2 + next(4);
+            for (unsigned j = 0; j < n; j++) {
+                statement(src, 1);
+            }
+            src += "    return a;\n}\n";
+        }
+        for (size_t i = 0; i < functions; i++) {
+            src += name() + " = func" + std::to_string(i) + "(" + name() + ", " + name() + ");\n";
+        }
+        return src;
+    }
+
+    /* An expression for RDParser::parse_line_expr */
+    std::string expression() {
+        std::string src;
+        expression(src, 1);
+        return src;
+    }
+
+    /* An expression nested depth levels deep in brackets, arguments and indices,
+       with operators of all precedences at each level */
+    std::string nested_expression(unsigned depth) {
+        std::string src;
+        nested_expression(src, depth);
+        return src;
+    }
+
+private:
+
+    void statement(std::string& src, unsigned level) {
+        indent(src, level);
+        unsigned total = shape.decl + shape.assign + shape.cond + shape.loop + shape.block;
+        unsigned pick = next(total > 0 ? total : 1);
+        bool can_nest = level < shape.depth;
+
+        if (pick < shape.decl) {
+            declaration(src);
+        }
+        else if ((pick -= shape.decl) < shape.assign || !can_nest) {
+            src += name();
+            src += next(4) == 0 ? " += " : " = ";
+            expression(src, 1);
+            src += ";\n";
+        }
+        else if ((pick -= shape.assign) < shape.cond) {
+            src += "if (";
+            expression(src, 1);
+            src += ") ";
+            block(src, level);
+            if (next(2) == 0) {
+                indent(src, level);
+                src += "else ";
+                block(src, level);
+            }
+        }
+        else if ((pick -= shape.cond) < shape.loop) {
+            if (next(2) == 0) {
+                src += "while (";
+                expression(src, 1);
+                src += ") ";
+            }
+            else {
+                std::string i = name();
+                src += "for (" + i + " = 0; " + i + " < ";
+                expression(src, 2);
+                src += "; " + i + "++) ";
+            }
+            block(src, level);
+        }
+        else {
+            block(src, level);
+        }
+    }
+
+    void block(std::string& src, unsigned level) {
+        src += "{\n";
+        unsigned n = 1 + next(3);
+        for (unsigned i = 0; i < n; i++) {
+            statement(src, level + 1);
+        }
+        if (next(8) == 0) {
+            indent(src, level + 1);
+            src += next(2) ? "break;\n" : "continue;\n";
+        }
+        indent(src, level);
+        src += "}\n";
+    }
+
+    void declaration(std::string& src) {
+        static const char* types[] = { "int", "float", "char", "bool" };
+        src += types[next(4)];
+        bool list = shape.list_length > 0 && next(3) == 0;
+        unsigned length = list ? 1 + next(shape.list_length) : 0;
+        if (list) {
+            src += "[" + std::to_string(length) + "]";
+        }
+        else if (next(6) == 0) {
+            src += "*";
+        }
+        src += " ";
+        src += name();
+        src += " = ";
+        if (list) {
+            src += "{";
+            for (unsigned i = 0; i < length; i++) {
+                src += i ? ", " : "";
+                literal(src);
+            }
+            src += "}";
+        }
+        else {
+            expression(src, 1);
+        }
+        src += ";\n";
+    }
+
+    void expression(std::string& src, unsigned level) {
+        static const char* ops[] = { "+", "-", "*", "/", "%", "^", "==", "!=", "<", "<=", ">", ">=", "and", "or" };
+        unsigned terms = 1 + next(shape.terms > 0 ? shape.terms : 1);
+        for (unsigned i = 0; i < terms; i++) {
+            if (i > 0) {
+                src += " ";
+                src += ops[next(14)];
+                src += " ";
+            }
+            operand(src, level);
+        }
+    }
+
+    void nested_expression(std::string& src, unsigned depth) {
+        static const char* ops[] = { "+", "-", "*", "/", "%", "^", "==", "!=", "<", "<=", ">", ">=", "and", "or" };
+        unsigned terms = 2 + next(4);
+        unsigned deep = next(terms);
+        for (unsigned i = 0; i < terms; i++) {
+            if (i > 0) {
+                src += " ";
+                src += ops[next(14)];
+                src += " ";
+            }
+            if (i != deep || depth == 0) {
+                operand(src, 4);
+                continue;
+            }
+            switch (next(3)) {
+            case 0:
+                src += "(";
+                nested_expression(src, depth - 1);
+                src += ")";
+                break;
+            case 1:
+                src += name() + "(" + name() + ", ";
+                nested_expression(src, depth - 1);
+                src += ")";
+                break;
+            default:
+                src += name() + "[";
+                nested_expression(src, depth - 1);
+                src += "]";
+                break;
+            }
+        }
+    }
+
+    void operand(std::string& src, unsigned level) {
+        unsigned pick = next(16);
+        bool can_nest = level < 4;
+        if (pick < 5) {
+            src += name();
+        }
+        else if (pick < 9) {
+            literal(src);
+        }
+        else if (pick < 10 && can_nest) {
+            src += "(";
+            expression(src, level + 1);
+            src += ")";
+        }
+        else if (pick < 11 && can_nest) {
+            src += name() + "(";
+            unsigned n = next(4);
+            for (unsigned i = 0; i < n; i++) {
+                src += i ? ", " : "";
+                expression(src, level + 1);
+            }
+            src += ")";
+        }
+        else if (pick < 12 && can_nest) {
+            src += name() + "[";
+            expression(src, level + 1);
+            src += "]";
+        }
+        else if (pick < 13) {
+            src += name() + (next(2) ? "." : "->") + name();
+        }
+        else if (pick < 14) {
+            src += next(2) ? "-" : "not ";
+            src += name();
+        }
+        else if (pick < 15) {
+            src += name() + (next(2) ? "++" : "--");
+        }
+        else {
+            src += name();
+        }
+    }
+
+    void literal(std::string& src) {
+        if (next(100) < shape.strings) {
+            static const char* strings[] = { "\"item\"", "\"a \\\"quoted\\\" name\"", "\"path\\\\to\\\\file\\n\"",
+                "'c'", "'\\n'", "\"\"" };
+            src += strings[next(6)];
+            return;
+        }
+        // no exponents: the lexer reads 2.5e-3 as 2.5, e-3
+        switch (next(4)) {
+        case 0: src += std::to_string(next(10)); break;
+        case 1: src += std::to_string(next(100000)); break;
+        case 2: src += std::to_string(next(1000)) + "." + std::to_string(next(100)); break;
+        default: src += "0." + std::to_string(next(1000)); break;
+        }
+    }
+
+    const std::string& name() {
+        return names[next(static_cast<uint32_t>(names.size()))];
+    }
+
+    void indent(std::string& src, unsigned level) {
+        src.append(4 * level, ' ');
+    }
+
+    // splitmix64
+    uint32_t next(uint32_t bound) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+        return static_cast<uint32_t>((z >> 32) * bound >> 32);
+    }
+
+    CorpusShape shape;
+    uint64_t state;
+    std::vector<std::string> names;
+};
+
+#endif
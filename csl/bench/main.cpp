@@ -0,0 +1,193 @@
+#include "bench_lexer.h"
+#include "bench_memory.h"
+#include "bench_source.h"
+#include "bench_strmap.h"
+#include "bench_parser.h"
+#include "corpus.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+/* Usage: csl_bench [options]
+     --quick         small inputs, for a smoke run
+     --size N        corpus bytes, with optional K/M/G suffix (default 32M; 1M if --quick)
+     --shape NAME    corpus shape: mixed, expr, nested, tables, idents (default mixed)
+     --seed N        corpus seed (default 1)
+     --depth N, --terms N, --idents N
+                     override the shape
+     --filter TEXT   run only benchmarks whose name contains TEXT
+     --json FILE     write results as JSON
+     --trace FILE    write a Chrome trace of parser.parse
+     --corpus FILE   write the generated corpus to FILE and exit
+     --list          list benchmarks and exit */
+
+struct BenchOptions {
+    bool quick = false;
+    size_t size = 0;
+    std::string shape = "mixed";
+    uint64_t seed = 1;
+    long depth = -1, terms = -1, idents = -1;
+    std::string filter;
+    std::string json;
+    std::string trace;
+    std::string corpus;
+    bool list = false;
+};
+
+static size_t parse_size(const std::string& arg) {
+    char* end = nullptr;
+    size_t size = std::strtoull(arg.c_str(), &end, 10);
+    const char* suffix = *end ? strchr("KMG", toupper(*end)) : nullptr;
+    if (suffix) {
+        size <<= 10 * (suffix - "KMG" + 1);
+        end++;
+    }
+    if (end == arg.c_str() || *end != '\0') {
+        throw std::invalid_argument("Invalid size: " + arg);
+    }
+    return size;
+}
+
+static BenchOptions parse_options(int argc, char** argv) {
+    BenchOptions opts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value of " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--quick") opts.quick = true;
+        else if (arg == "--size") opts.size = parse_size(value());
+        else if (arg == "--shape") opts.shape = value();
+        else if (arg == "--seed") opts.seed = std::strtoull(value().c_str(), nullptr, 10);
+        else if (arg == "--depth") opts.depth = std::atol(value().c_str());
+        else if (arg == "--terms") opts.terms = std::atol(value().c_str());
+        else if (arg == "--idents") opts.idents = std::atol(value().c_str());
+        else if (arg == "--filter") opts.filter = value();
+        else if (arg == "--json") opts.json = value();
+        else if (arg == "--trace") opts.trace = value();
+        else if (arg == "--corpus") opts.corpus = value();
+        else if (arg == "--list") opts.list = true;
+        else throw std::invalid_argument("Unknown option: " + arg);
+    }
+    if (opts.size == 0) {
+        opts.size = opts.quick ? 1 << 20 : 32 << 20;
+    }
+    return opts;
+}
+
+int main(int argc, char** argv) {
+
+    BenchOptions opts;
+    CorpusShape shape;
+    try {
+        opts = parse_options(argc, argv);
+        shape = CorpusShape::by_name(opts.shape);
+    }
+    catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+    if (opts.depth >= 0) shape.depth = static_cast<unsigned>(opts.depth);
+    if (opts.terms >= 0) shape.terms = static_cast<unsigned>(opts.terms);
+    if (opts.idents >= 0) shape.idents = static_cast<unsigned>(opts.idents);
+
+    // input sizes scale down for a quick run
+    size_t scale = opts.quick ? 32 : 1;
+
+    CorpusGenerator gen(shape, opts.seed);
+    std::string src = gen.program(opts.size);
+    std::vector<std::string> exprs;
+    for (int i = 0; i < 256; i++) {
+        exprs.push_back(gen.expression());
+    }
+    const unsigned nested_depth = 64;
+    std::vector<std::string> nested;
+    for (int i = 0; i < 64; i++) {
+        nested.push_back(gen.nested_expression(nested_depth));
+    }
+
+    if (!opts.corpus.empty()) {
+        std::ofstream out(opts.corpus, std::ios::binary);
+        out << src;
+        return out ? 0 : 1;
+    }
+
+    BenchReport report(opts.filter);
+    report.set_config("size", double(src.size()));
+    report.set_config("shape", opts.shape);
+    report.set_config("seed", double(opts.seed));
+    report.set_config("depth", shape.depth);
+    report.set_config("terms", shape.terms);
+    report.set_config("idents", shape.idents);
+    report.set_config("quick", opts.quick ? 1 : 0);
+
+    // independent sources of the same total size
+    auto make_sources = [&]() {
+        CorpusGenerator source_gen(shape, opts.seed + 1);
+        std::vector<std::string> sources;
+        for (int i = 0; i < 64; i++) {
+            sources.push_back(source_gen.program(opts.size / 64));
+        }
+        return sources;
+    };
+
+    const size_t module_functions = 10000 / scale;
+    auto make_module = [&]() {
+        return CorpusGenerator(shape, opts.seed + 2).module(module_functions);
+    };
+
+    ParserBench parser_bench(report, src, exprs);
+    parser_bench.set_trace_file(opts.trace);
+    MemoryBench memory_bench(report);
+    LexerBench lexer_bench(report, src, 20000 / scale);
+    StrMapBench strmap_bench(report, (1 << 22) / scale);
+    SourceBench source_bench(report, src);
+
+    // parser first, while the heap is small
+    std::vector<std::pair<const char*, std::function<void()>>> benches = {
+        { "parser.parse", [&]() { parser_bench.bench_parse(); } },
+        { "parser.line_expr", [&]() { parser_bench.bench_line_expr((1 << 20) / scale); } },
+        { "parser.nested_expr", [&]() { parser_bench.bench_nested_expr(nested, nested_depth, (1 << 16) / scale); } },
+        { "parser.parallel", [&]() { parser_bench.bench_parallel(make_sources()); } },
+        { "parser.import", [&]() { parser_bench.bench_import(make_sources()); } },
+        { "parser.ast_cache", [&]() { parser_bench.bench_ast_cache(); } },
+        { "parser.lazy", [&]() { parser_bench.bench_lazy(make_module(), module_functions); } },
+        { "parser.parallel_bodies", [&]() { parser_bench.bench_parallel_bodies(make_module(), module_functions); } },
+        { "memory.ast_pools", [&]() { memory_bench.bench_ast_pools((1 << 22) / scale); } },
+        { "memory.handles", [&]() { memory_bench.bench_handles((1 << 22) / scale); } },
+        { "memory.strpool", [&]() { memory_bench.bench_strpool((1 << 20) / scale); } },
+        { "lexer.scanner", [&]() { lexer_bench.bench_scanner((1 << 20) / scale); } },
+        { "lexer.kernels", [&]() { lexer_bench.bench_kernels(); } },
+        { "lexer.allocations", [&]() { lexer_bench.bench_allocations(); } },
+        { "lexer.parallel", [&]() { lexer_bench.bench_parallel(); } },
+        { "strmap.lookup", [&]() { strmap_bench.bench_lookup(); } },
+        { "source.startup", [&]() {
+            if (opts.quick) source_bench.bench_startup({ 1 << 20 });
+            else source_bench.bench_startup({ 1 << 20, 100 << 20, size_t(1) << 30 });
+        } },
+        { "source.stream", [&]() { source_bench.bench_stream(opts.quick ? 16 << 20 : size_t(2) << 30); } },
+    };
+
+    for (const auto& bench : benches) {
+        if (!report.selected(bench.first)) {
+            continue;
+        }
+        if (opts.list) {
+            std::cout << bench.first << std::endl;
+        }
+        else {
+            bench.second();
+        }
+    }
+
+    if (!opts.json.empty() && !report.write_json(opts.json)) {
+        std::cerr << "Cannot write " << opts.json << std::endl;
+        return 1;
+    }
+    return 0;
+}
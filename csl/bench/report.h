@@ -0,0 +1,133 @@
+#pragma once
+
+#ifndef CSL_BENCH_REPORT_H
+#define CSL_BENCH_REPORT_H
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Results of a benchmark run. Printed as they are added, and written as JSON
+   ({"config": {...}, "results": [{"bench", "case", "unit", "value"}...]}),
+   so runs can be compared to track regressions. */
+class BenchReport {
+public:
+
+    struct Metric {
+        const char* unit;
+        double value;
+    };
+
+    explicit BenchReport(const std::string& filter = "") : _filter(filter) {
+
+    }
+
+    /* Run configuration, written with results */
+    void set_config(const std::string& key, const std::string& value) {
+        _config.push_back(std::make_pair(key, quote(value)));
+    }
+
+    void set_config(const std::string& key, double value) {
+        _config.push_back(std::make_pair(key, number(value)));
+    }
+
+    /* Whether a benchmark is selected by the filter (a substring of its name) */
+    bool selected(const std::string& bench)const {
+        return _filter.empty() || bench.find(_filter) != std::string::npos;
+    }
+
+    /* Start a benchmark; Results are added to it until the next one */
+    void begin(const std::string& bench, const std::string& title) {
+        _bench = bench;
+        std::cout << title << std::endl;
+    }
+
+    /* Metrics of a case, printed on one line */
+    void add(const std::string& name, std::initializer_list<Metric> metrics) {
+        std::cout << "  " << name << ":";
+        const char* sep = " ";
+        for (const Metric& m : metrics) {
+            std::cout << sep << m.value << " " << m.unit;
+            sep = ", ";
+            Result r = { _bench, name, m.unit, m.value };
+            _results.push_back(r);
+        }
+        std::cout << std::endl;
+    }
+
+    /* Free-form detail line, not recorded */
+    void note(const std::string& line) {
+        std::cout << "    " << line << std::endl;
+    }
+
+    bool write_json(const std::string& filename)const {
+        std::ofstream out(filename, std::ios::binary);
+        out << "{\n  \"config\": {";
+        for (size_t i = 0; i < _config.size(); i++) {
+            out << (i ? ", " : "") << quote(_config[i].first) << ": " << _config[i].second;
+        }
+        out << "},\n  \"results\": [\n";
+        for (size_t i = 0; i < _results.size(); i++) {
+            const Result& r = _results[i];
+            out << "    {\"bench\": " << quote(r.bench) << ", \"case\": " << quote(r.name)
+                << ", \"unit\": " << quote(r.unit) << ", \"value\": " << number(r.value) << "}"
+                << (i + 1 < _results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+
+    size_t size()const {
+        return _results.size();
+    }
+
+private:
+
+    struct Result {
+        std::string bench;
+        std::string name;
+        std::string unit;
+        double value;
+    };
+
+    static std::string quote(const std::string& s) {
+        std::string ret = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                ret += '\\';
+                ret += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                ret += buf;
+            }
+            else {
+                ret += c;
+            }
+        }
+        return ret + "\"";
+    }
+
+    // JSON has no inf/nan
+    static std::string number(double value) {
+        if (!std::isfinite(value)) {
+            return "null";
+        }
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.10g", value);
+        return buf;
+    }
+
+    std::string _filter;
+    std::string _bench;
+    std::vector<std::pair<std::string, std::string>> _config;   // key, JSON value
+    std::vector<Result> _results;
+};
+
+#endif
@@ -2,13 +2,164 @@
 #ifndef CSL_CONTEXT_H
 #define CSL_CONTEXT_H
 
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "util/memory.h"
+#include "astpool.h"
+#include "instrument.h"
+#include "type.h"
+
+class ModuleCache;
+class ASTCache;
 
 class Context {
 public:
 
+    // contexts of function bodies parsed in parallel or lazily, referred to by nodes of astpool
+    std::vector<std::unique_ptr<Context> > parts;
+
     ConstStringPool strpool;
-    MemoryPool astpool, constantpool, typepool;
+    // declared so that each pool is destroyed before the pools it refers to
+    MemoryPool typepool;
+    ExprPool exprpool;      // expressions and constants of trees in astpool
+    ASTPool astpool;
+    ByteArena literalpool;  // string literals with escapes decoded by lexer
+
+    Instrument* instrument; // counters and phase timers; nullptr to skip. Not owned
+
+    ModuleCache* modules;   // parsed files for import; nullptr to parse every import. Not owned
+
+    ASTCache* ast_cache;    // trees of files stored on disk; nullptr to parse every file. Not owned
+
+    std::mutex body_mutex;  // held while a lazy function body is parsed into a part
+
+    Context() : instrument(nullptr), modules(nullptr), ast_cache(nullptr) {
+
+    }
+
+    /* Pass object counts of pools to instrument */
+    void sample_pools() {
+#if CSL_INSTRUMENT
+        if (instrument) {
+            Instrument::Counters c = Instrument::Counters();
+            for (size_t i = 0; i < ASTPool::kind_count; i++) {
+                c.ast_nodes[i] = astpool.stats(ASTPool::kind(i)).nodes + exprpool.count(ASTPool::kind(i));
+            }
+            c.strpool_bytes = strpool.bytes();
+            c.symbols = strpool.symbol_count();
+            c.constants = exprpool.constant_count();
+            c.types = typepool.size();
+            instrument->sample(c);
+        }
+#endif
+    }
+
+    /* Allocation state of all pools */
+    struct Checkpoint {
+        ConstStringPool::Checkpoint strpool;
+        MemoryPool::Checkpoint typepool;
+        ExprPool::Checkpoint exprpool;
+        ASTPool::Checkpoint astpool;
+        ByteArena::Checkpoint literalpool;
+        bool has_primitive_type[Type::FLOAT + 1];
+        bool has_string_type;
+        size_t class_count;
+        size_t part_count;
+    };
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp;
+        cp.strpool = strpool.checkpoint();
+        cp.typepool = typepool.checkpoint();
+        cp.exprpool = exprpool.checkpoint();
+        cp.astpool = astpool.checkpoint();
+        cp.literalpool = literalpool.checkpoint();
+        for (int i = 0; i <= Type::FLOAT; i++) {
+            cp.has_primitive_type[i] = primitive_types[i].exists();
+        }
+        cp.has_string_type = string_type.exists();
+        cp.class_count = _class_symbols.size();
+        cp.part_count = parts.size();
+        return cp;
+    }
+
+    /* Release everything allocated in pools after cp, keeping their memory for
+       reuse. References to released objects must be dropped before */
+    void rewind(const Checkpoint& cp) {
+        for (int i = 0; i <= Type::FLOAT; i++) {
+            if (!cp.has_primitive_type[i]) {
+                primitive_types[i] = nullptr;
+            }
+        }
+        if (!cp.has_string_type) {
+            string_type = nullptr;
+        }
+        while (_class_symbols.size() > cp.class_count) {
+            _class_order[_class_symbols.back()] = 0;
+            _class_symbols.pop_back();
+        }
+
+        // referring pools first, as in destruction
+        astpool.rewind(cp.astpool);
+        exprpool.rewind(cp.exprpool);
+        typepool.rewind(cp.typepool);
+        strpool.rewind(cp.strpool);
+        literalpool.rewind(cp.literalpool);
+        parts.resize(cp.part_count);
+    }
+
+    /* Shared primitive type (void, bool, char, int, float) */
+    TypeRef get_primitive_type(Type::TypeID id) {
+        assert(id <= Type::FLOAT && "Not a primitive type");
+        if (!primitive_types[id].exists()) {
+            primitive_types[id] = typepool.construct<PrimitiveType>(id).to_const().cast<Type>();
+        }
+        return primitive_types[id];
+    }
+
+    /* Shared type of string literals (char*) */
+    TypeRef get_string_type() {
+        if (!string_type.exists()) {
+            string_type = typepool.construct<PointerType>(get_primitive_type(Type::CHAR)).to_const().cast<Type>();
+        }
+        return string_type;
+    }
+
+    /* Make an interned name a type name of later parses in this context */
+    void define_class(uint32_t symbol) {
+        if (!is_class(symbol)) {
+            if (symbol >= _class_order.size()) {
+                _class_order.resize(symbol + 1, 0);
+            }
+            _class_symbols.push_back(symbol);
+            _class_order[symbol] = static_cast<uint32_t>(_class_symbols.size());
+        }
+    }
+
+    bool is_class(uint32_t symbol)const {
+        return symbol < _class_order.size() && _class_order[symbol] != 0;
+    }
+
+    /* Classes defined before the class of symbol; class_count() if not a class */
+    size_t class_order(uint32_t symbol)const {
+        return is_class(symbol) ? _class_order[symbol] - 1 : class_count();
+    }
+
+    /* Number of classes defined; Grows with each new class */
+    size_t class_count()const {
+        return _class_symbols.size();
+    }
+
+private:
+
+    TypeRef primitive_types[Type::FLOAT + 1];
+    TypeRef string_type;
+
+    std::vector<uint32_t> _class_symbols;   // in order of definition
+    std::vector<uint32_t> _class_order;     // by symbol, 1 + index in _class_symbols; 0 if not a class
 };
 
 
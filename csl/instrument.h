@@ -0,0 +1,246 @@
+#pragma once
+
+#ifndef CSL_INSTRUMENT_H
+#define CSL_INSTRUMENT_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "astpool.h"
+
+/* Instrumentation hooks; With 0 they compile to nothing */
+#ifndef CSL_INSTRUMENT
+#define CSL_INSTRUMENT 1
+#endif
+
+#if CSL_INSTRUMENT
+#define CSL_COUNT(instrument, counter, n) \
+    do { if (instrument) { (instrument)->counters.counter += (n); } } while (0)
+#else
+#define CSL_COUNT(instrument, counter, n) ((void)0)
+#endif
+
+
+/* Counters and phase timers of a Context, attached by setting Context::instrument.
+   Without one, hooks cost a null check. Counters are updated by the thread owning
+   the context; phases may be timed from any thread. */
+class Instrument {
+public:
+
+    struct Counters {
+        size_t tokens;      // tokens lexed, without EOF
+        size_t scans;       // Scanner::scan() calls, with lexemes relexed by parallel lexing
+
+        // objects in pools, as of the last sample
+        size_t ast_nodes[ASTPool::kind_count];  // by ASTPool::kind()
+        size_t strpool_bytes;
+        size_t symbols;
+        size_t constants;
+        size_t types;
+    };
+
+    /* A timed phase; Nested phases are inside their parent */
+    struct Event {
+        const char* name;
+        uint64_t start;     // ns since the instrument was created
+        uint64_t duration;  // ns
+        unsigned thread;    // numbered in order of first event
+    };
+
+    /* Total time of a phase name */
+    struct Phase {
+        const char* name;
+        size_t count;
+        double seconds;
+    };
+
+    /* Times its lifetime as a phase of instrument, unless it is nullptr.
+       name is kept, so it should be a string literal */
+    class Scope {
+    public:
+
+        Scope(Instrument* instrument, const char* name) {
+#if CSL_INSTRUMENT
+            _instrument = instrument;
+            _name = name;
+            _start = instrument ? instrument->now() : 0;
+#endif
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+#if CSL_INSTRUMENT
+            if (_instrument) {
+                _instrument->record(_name, _start, _instrument->now() - _start);
+            }
+#endif
+        }
+
+    private:
+#if CSL_INSTRUMENT
+        Instrument* _instrument;
+        const char* _name;
+        uint64_t _start;
+#endif
+    };
+
+    Counters counters;
+
+    Instrument() : _origin(std::chrono::steady_clock::now()) {
+        clear();
+    }
+
+    Instrument(const Instrument&) = delete;
+    Instrument& operator=(const Instrument&) = delete;
+
+    void clear() {
+        counters = Counters();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _events.clear();
+        _samples.clear();
+    }
+
+    /* Record pool counters, also as a point of their timeline */
+    void sample(const Counters& pools) {
+        for (size_t i = 0; i < ASTPool::kind_count; i++) {
+            counters.ast_nodes[i] = pools.ast_nodes[i];
+        }
+        counters.strpool_bytes = pools.strpool_bytes;
+        counters.symbols = pools.symbols;
+        counters.constants = pools.constants;
+        counters.types = pools.types;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        Sample s = { now(), counters };
+        _samples.push_back(s);
+    }
+
+    /* Phases in order of completion */
+    std::vector<Event> events()const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _events;
+    }
+
+    /* Phase totals by name, in order of first completion */
+    std::vector<Phase> phases()const {
+        std::vector<Phase> ret;
+        for (const Event& e : events()) {
+            size_t i = 0;
+            while (i < ret.size() && std::string(ret[i].name) != e.name) {
+                i++;
+            }
+            if (i == ret.size()) {
+                Phase p = { e.name, 0, 0.0 };
+                ret.push_back(p);
+            }
+            ret[i].count++;
+            ret[i].seconds += e.duration * 1e-9;
+        }
+        return ret;
+    }
+
+    /* Seconds of all phases named name */
+    double seconds(const char* name)const {
+        for (const Phase& p : phases()) {
+            if (std::string(p.name) == name) {
+                return p.seconds;
+            }
+        }
+        return 0.0;
+    }
+
+    /* {"counters": {...}, "phases": [{"name", "count", "seconds"}...]} */
+    void write_json(std::ostream& os)const {
+        const Counters& c = counters;
+        os << "{\n  \"counters\": {\"tokens\": " << c.tokens << ", \"scans\": " << c.scans
+            << ", \"strpool_bytes\": " << c.strpool_bytes << ", \"symbols\": " << c.symbols
+            << ", \"constants\": " << c.constants << ", \"types\": " << c.types << ",\n    \"ast_nodes\": {";
+        for (size_t i = 0; i < ASTPool::kind_count; i++) {
+            os << (i ? ", " : "") << "\"" << ASTPool::kind_name(i) << "\": " << c.ast_nodes[i];
+        }
+        os << "}},\n  \"phases\": [";
+        std::vector<Phase> ps = phases();
+        for (size_t i = 0; i < ps.size(); i++) {
+            os << (i ? ",\n" : "\n") << "    {\"name\": \"" << ps[i].name << "\", \"count\": " << ps[i].count
+                << ", \"seconds\": " << number(ps[i].seconds) << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    /* Chrome trace events: a complete event per phase, and counter tracks of
+       tokens, AST nodes and pools at each sample. Opens in chrome://tracing or Perfetto */
+    void write_trace(std::ostream& os)const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        const char* sep = "\n";
+        for (const Event& e : _events) {
+            os << sep << "{\"name\": \"" << e.name << "\", \"cat\": \"csl\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                << e.thread << ", \"ts\": " << number(e.start * 1e-3) << ", \"dur\": " << number(e.duration * 1e-3) << "}";
+            sep = ",\n";
+        }
+        for (const Sample& s : _samples) {
+            const Counters& c = s.counters;
+            os << sep << "{\"name\": \"ast nodes\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << number(s.time * 1e-3) << ", \"args\": {";
+            const char* arg_sep = "";
+            for (size_t i = 0; i < ASTPool::kind_count; i++) {
+                if (c.ast_nodes[i] > 0) {
+                    os << arg_sep << "\"" << ASTPool::kind_name(i) << "\": " << c.ast_nodes[i];
+                    arg_sep = ", ";
+                }
+            }
+            os << "}},\n{\"name\": \"pools\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << number(s.time * 1e-3)
+                << ", \"args\": {\"strpool_bytes\": " << c.strpool_bytes << ", \"symbols\": " << c.symbols
+                << ", \"constants\": " << c.constants << ", \"types\": " << c.types << "}}"
+                << ",\n{\"name\": \"lexer\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << number(s.time * 1e-3)
+                << ", \"args\": {\"tokens\": " << c.tokens << ", \"scans\": " << c.scans << "}}";
+        }
+        os << "\n]}\n";
+    }
+
+private:
+
+    struct Sample {
+        uint64_t time;
+        Counters counters;
+    };
+
+    uint64_t now()const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _origin).count();
+    }
+
+    void record(const char* name, uint64_t start, uint64_t duration) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::thread::id id = std::this_thread::get_id();
+        unsigned thread = 0;
+        while (thread < _threads.size() && _threads[thread] != id) {
+            thread++;
+        }
+        if (thread == _threads.size()) {
+            _threads.push_back(id);
+        }
+        Event e = { name, start, duration, thread };
+        _events.push_back(e);
+    }
+
+    static std::string number(double value) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.10g", value);
+        return buf;
+    }
+
+    std::chrono::steady_clock::time_point _origin;
+    mutable std::mutex _mutex;
+    std::vector<Event> _events;
+    std::vector<Sample> _samples;
+    std::vector<std::thread::id> _threads;
+};
+
+#endif
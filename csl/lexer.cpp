@@ -1,40 +1,18 @@
 
+#include <algorithm>
 #include <cassert>
-#include <regex>
+#include <cstring>
+#include <future>
 
 #include "token.h"
 #include "lexer.h"
+#include "reserved.h"
 #include "util/errors.h"
 #include "util/strutil.h"
+#include "util/threadpool.h"
 
-std::regex Lexer::re_id("[_a-zA-Z][_0-9a-zA-Z]*");
-std::regex Lexer::re_char("'(?:\\\\.|[^'\\\\])*'");
-std::regex Lexer::re_str("\"(?:\\\\.|[^\"\\\\])*\"");
-std::regex Lexer::re_int("\\d+");
-std::regex Lexer::re_float("\\d*(?:\\.|e[+\\-]?)\\d+");
-std::regex Lexer::re_op("\\+\\+|\\-\\-|\\!\\=|\\-\\>|[\\+\\-\\*\\/\\%\\=\\^\\<\\>]\\=?|[\\.\\,\\:\\;\\{\\}\\(\\)\\[\\]]");
-std::regex Lexer::re_ws("[ \\t\\n]+");
-
-std::regex re_single_char("'\\\\?.'");
-
-StrMap<Keyword> Lexer::keyword_loc {
-    {"if", Keyword::IF}, {"else", Keyword::ELSE}, {"while", Keyword::ELSE}, 
-    {"for", Keyword::FOR}, {"break", Keyword::BREAK}, {"continue", Keyword::CONTINUE}, 
-    {"return", Keyword::RETURN}, {"fn", Keyword::FN}, {"class", Keyword::CLASS}, 
-    {"import", Keyword::IMPORT}
-};
-
-StrMap<OpName> Lexer::op_loc {
-    {"+", OpName::ADD}, {"-", OpName::SUB}, {"*", OpName::MUL}, {"/", OpName::DIV}, {"%", OpName::MOD}, {"^", OpName::POW},
-    {"++", OpName::INC}, {"--", OpName::DEC}, {"==", OpName::EQ}, {"!=", OpName::NE}, {"<", OpName::LT}, {"<=", OpName::LE}, 
-    {">", OpName::GT}, {">=", OpName::GE}, {"and", OpName::AND}, {"or", OpName::OR}, {"xor", OpName::XOR}, {"not", OpName::NOT},
-    {"(", OpName::BRAC}, {")", OpName::RBRAC}, {"[", OpName::INDEX}, {"]", OpName::RINDEX}, {"=", OpName::ASN}, {"+=", OpName::ADDASN},
-    {"-=", OpName::SUBASN}, {"*=", OpName::MULASN}, {"/=", OpName::DIVASN}, {"%=", OpName::MODASN}, {"^=", OpName::POWASN}, {".", OpName::MBER},
-    {"->", OpName::ARROW}, {",", OpName::COMMA}, {":", OpName::COLON}, {";", OpName::SEMICOLON}, {"{", OpName::COMP}, {"}", OpName::RCOMP}
-};
-
-
-Lexer::Lexer() : _reader(nullptr), next_get_pos(0), next_look_pos(0) {
+Lexer::Lexer() : _reader(nullptr), next_get_pos(0), next_look_pos(0), _hold(npos), _shift(0), 
+    _literal_end(), _literal_gen(0) {
 
 }
 
@@ -42,6 +20,12 @@ void Lexer::clear() {
     _reader = nullptr;
     token_buf.clear();
     next_get_pos = next_look_pos = 0;
+    _hold = npos;
+    _shift = 0;
+    _stream_literals[0].clear();
+    _stream_literals[1].clear();
+    _literal_end[0] = _literal_end[1] = 0;
+    _literal_gen = 0;
 }
 
 Token Lexer::get_token() {
@@ -75,90 +59,298 @@ void Lexer::go_back() {
     next_look_pos--;
 }
 
+void Lexer::tokenize(std::vector<Token>& tokens) {
+    assert(token_buf.empty() && "Tokens are already buffered");
+
+    if (_reader->is_stream()) {
+        // keep the whole input, as tokens are not rebased
+        hold(_reader->pos());
+        do {
+            tokens.push_back(_fetch_token());
+        } while (!tokens.back().is_type(Token::EOF));
+        return;
+    }
+
+    const char* end = _reader->end_ptr();
+
+    size_t size0 = tokens.size();
+    tokens.reserve(tokens.size() + (end - _reader->cur_ptr()) / 4 + 1);
+    lex_range(_reader->begin_ptr(), _reader->cur_ptr(), end, end, tokens, _context->literalpool, &_context->strpool);
+    CSL_COUNT(_context->instrument, tokens, tokens.size() - size0);
+    CSL_COUNT(_context->instrument, scans, tokens.size() - size0);
+    tokens.push_back(Token(Token::EOF));
+    tokens.back().set_offset(end - _reader->begin_ptr());
+    _reader->forward(end - _reader->cur_ptr());
+}
+
+void Lexer::tokenize(std::vector<Token>& tokens, ThreadPool& pool, size_t min_chunk) {
+    assert(token_buf.empty() && "Tokens are already buffered");
+
+    const char* source = _reader->begin_ptr();
+    const char* begin = _reader->cur_ptr();
+    const char* end = _reader->end_ptr();
+
+    size_t chunk_count = std::min(pool.size() * 4, static_cast<size_t>(end - begin) / std::max<size_t>(min_chunk, 1));
+    if (chunk_count < 2 || _reader->is_stream()) {
+        tokenize(tokens);
+        return;
+    }
+
+    // Chunk i is [bounds[i], bounds[i + 1]). Inner bounds are moved to a newline (or other 
+    // whitespace), so they fall between tokens unless inside a string literal.
+    std::vector<const char*> bounds(chunk_count + 1);
+    bounds[0] = begin;
+    bounds[chunk_count] = end;
+    for (size_t i = 1; i < chunk_count; i++) {
+        const char* p = std::max(begin + (end - begin) * i / chunk_count, bounds[i - 1]);
+        const char* limit = begin + (end - begin) * (i + 1) / chunk_count;
+        const char* nl = limit > p ? static_cast<const char*>(memchr(p, '\n', limit - p)) : nullptr;
+        if (nl) {
+            p = nl;
+        }
+        else {
+            while (p < end && !Scanner::is_class(*p, Scanner::C_WS)) {
+                p++;
+            }
+        }
+        bounds[i] = p;
+    }
+
+    // Lex every chunk speculatively, as if its bound were a token boundary.
+    // Identifiers are interned after, as the string pool is not thread-safe
+    struct Chunk {
+        std::vector<Token> tokens;
+        ByteArena literals;
+        const char* resume;
+        bool failed;
+    };
+    std::vector<Chunk> chunks(chunk_count);
+    std::vector<std::future<void>> done;
+    done.reserve(chunk_count);
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        done.push_back(pool.submit([&, i]() {
+            Chunk& chunk = chunks[i];
+            chunk.tokens.reserve((bounds[i + 1] - bounds[i]) / 4 + 1);
+            try {
+                chunk.resume = lex_range(source, bounds[i], bounds[i + 1], end, chunk.tokens, chunk.literals, nullptr);
+                chunk.failed = false;
+            }
+            catch (const SyntaxError&) {
+                chunk.failed = true;    // maybe not a real error if bound is in a literal
+            }
+        }));
+    }
+    for (auto& f : done) {
+        f.get();
+    }
+
+    // A chunk is kept only if the previous chunk stopped exactly at its first token;
+    // otherwise it is relexed from there, which also raises real syntax errors in order.
+    size_t size0 = tokens.size();
+    const char* cur = begin + Scanner::skip_ws(begin, end);
+    for (size_t i = 0; i < chunk_count; i++) {
+        Chunk& chunk = chunks[i];
+        const char* first = bounds[i] + Scanner::skip_ws(bounds[i], end);
+        CSL_COUNT(_context->instrument, scans, chunk.tokens.size());
+
+        if (!chunk.failed && first == cur) {
+            for (Token& token : chunk.tokens) {
+                if (token.is_type(Token::ID)) {
+                    const char* text = source + token.get_offset();
+                    token.set_symbol(_context->strpool.intern_symbol(text, text + token.get_length()));
+                }
+            }
+            tokens.insert(tokens.end(), chunk.tokens.begin(), chunk.tokens.end());
+            _context->literalpool.splice(chunk.literals);
+            cur = chunk.resume;
+        }
+        else {
+            size_t relexed = tokens.size();
+            cur = lex_range(source, cur, bounds[i + 1], end, tokens, _context->literalpool, &_context->strpool);
+            CSL_COUNT(_context->instrument, scans, tokens.size() - relexed);
+        }
+    }
+    CSL_COUNT(_context->instrument, tokens, tokens.size() - size0);
+
+    tokens.push_back(Token(Token::EOF));
+    tokens.back().set_offset(end - source);
+    _reader->forward(end - _reader->cur_ptr());
+}
+
+const char* Lexer::lex_range(const char* source, const char* begin, const char* stop, const char* end,
+    std::vector<Token>& tokens, ByteArena& literals, ConstStringPool* symbols) {
+
+    const char* p = begin;
+    while (true) {
+        p += Scanner::skip_ws(p, end);
+        if (p >= stop || p >= end) {
+            return p;
+        }
+        Lexeme lexeme = Scanner::scan(p, end);
+        tokens.push_back(make_token(source, p, lexeme, literals, symbols));
+        p += lexeme.length;
+    }
+}
+
 void Lexer::fetch_token() {
     token_buf.push_back(_fetch_token());
 }
 
 Token Lexer::_fetch_token() {
 
-    if (_reader->eof()) {
-        return Token(Token::EOF);
+    while (true) {
+        _reader->forward(Scanner::skip_ws(_reader->cur_ptr(), _reader->end_ptr()));
+
+        if (_reader->eof()) {
+            if (refill()) {
+                continue;
+            }
+            Token token(Token::EOF);
+            token.set_offset(_reader->pos());
+            return token;
+        }
+
+        const char* begin = _reader->cur_ptr();
+        Lexeme lexeme = Scanner::scan(begin, _reader->end_ptr());
+        CSL_COUNT(_context->instrument, scans, 1);
+
+        // A lexeme (or its look-ahead) reaching the end of a stream window may continue after it
+        if (_reader->is_stream()) {
+            size_t left = _reader->end_ptr() - begin;
+            bool partial = lexeme.kind == Lexeme::NONE ?
+                Scanner::is_class(*begin, Scanner::C_QUOTE) || left < Scanner::max_lookahead :
+                left < lexeme.length + Scanner::max_lookahead;
+            if (partial && refill()) {
+                continue;
+            }
+        }
+
+        CSL_COUNT(_context->instrument, tokens, 1);
+        if (!_reader->is_stream()) {
+            Token token = make_token(_reader->begin_ptr(), begin, lexeme, _context->literalpool, &_context->strpool);
+            _reader->forward(lexeme.length);
+            return token;
+        }
+
+        Token token = make_token(_reader->begin_ptr(), begin, lexeme, _stream_literals[_literal_gen], &_context->strpool);
+        _literal_end[_literal_gen] = _reader->base() + _reader->pos() + 1;
+        _reader->forward(lexeme.length);
+        return token;
     }
+}
 
-    match(re_ws);
+bool Lexer::refill() {
 
-    if (_reader->eof()) {
-        return Token(Token::EOF);
+    size_t keep = std::min(_reader->pos(), _hold);
+    for (const auto& token : token_buf) {
+        keep = std::min(keep, token.get_offset());
     }
 
-    else if (match(re_char)) {
+    size_t base = _reader->base();
+    if (!_reader->refill(keep)) {
+        return false;
+    }
 
-        RawValue::Type vtype = std::regex_match(token_str.copy(), re_single_char) ? RawValue::STRING : RawValue::CHAR;
+    size_t shift = _reader->base() - base;
+    if (shift > 0) {
+        for (auto& token : token_buf) {
+            token.rebase(shift);
+        }
+        if (_hold != npos) {
+            _hold -= shift;
+        }
+        _shift += shift;
 
-        Token token(Token::VALUE);
-        token.set_value(vtype, make_ref(token_str.substr(1, token_str.length() - 2)));
+        // tokens of the older generation are all dropped with the source
+        int old_gen = 1 - _literal_gen;
+        if (_literal_end[old_gen] <= _reader->base()) {
+            _stream_literals[old_gen].clear();
+            _literal_gen = old_gen;
+        }
+    }
+    return true;
+}
+
+Token Lexer::make_token(const char* source, const char* begin, const Lexeme& lexeme, 
+    ByteArena& literals, ConstStringPool* symbols) {
+
+    if (lexeme.kind == Lexeme::NONE) {
+        throw SyntaxError("Unrecognized token");
+    }
+    else if (lexeme.length > Token::max_length) {
+        throw SyntaxError("Token is too long");
+    }
+
+    size_t offset = begin - source;
+
+    switch (lexeme.kind)
+    {
+    case Lexeme::CHAR: {
+        Token token(Token::VALUE, offset + 1, lexeme.length - 2);
+        char buf[2];
+        Scanner::decode_escapes(begin + 1, begin + lexeme.length - 1, buf);
+        token.set_char(buf[0]);
         return token;
     }
-    else if (match(re_str)) {
-        Token token(Token::VALUE);
-        token.set_value(RawValue::STRING, make_ref(token_str.substr(1, token_str.length() - 2)));
+    case Lexeme::STRING: {
+        Token token(Token::VALUE, offset + 1, lexeme.length - 2);
+        const char* text = begin + 1;
+        const char* text_end = begin + lexeme.length - 1;
+
+        if (memchr(text, '\\', text_end - text) == nullptr) {
+            token.set_string(nullptr);  // same as text in source
+        }
+        else {
+            // uint32 length, then decoded bytes
+            char* buf = literals.allocate(sizeof(uint32_t) + (text_end - text));
+            uint32_t len = static_cast<uint32_t>(Scanner::decode_escapes(text, text_end, buf + sizeof(uint32_t)));
+            memcpy(buf, &len, sizeof(len));
+            token.set_string(buf + sizeof(uint32_t));
+        }
         return token;
     }
-    else if (match(re_op)) {
-        return Token(Token::OP, static_cast<unsigned>(op_loc.find(token_str)->second));
+    case Lexeme::OP: {
+        Token token(Token::OP, static_cast<unsigned>(lexeme.op));
+        token.set_offset(offset);
+        return token;
     }
-    else if (match(re_float)) {
-        Token token(Token::VALUE);
-        token.set_value(RawValue::FLOAT, make_ref(token_str.copy()));
+    case Lexeme::FLOAT: {
+        Token token(Token::VALUE, offset, lexeme.length);
+        token.set_float(Scanner::parse_float(begin, begin + lexeme.length));
         return token;
     }
-    else if (match(re_int)) {
-        Token token(Token::VALUE);
-        token.set_value(RawValue::INT, make_ref(token_str.copy()));
+    case Lexeme::INT: {
+        Token token(Token::VALUE, offset, lexeme.length);
+        unsigned val;
+        if (!Scanner::parse_int(begin, begin + lexeme.length, val)) {
+            throw SyntaxError("Integer literal is too large");
+        }
+        token.set_int(val);
         return token;
     }
-    else if (match(re_id)) {
+    case Lexeme::ID:
+    default: {
 
-        if (token_str == "true" || token_str == "false") {
-            Token token(Token::VALUE);
-            token.set_value(RawValue::BOOL, make_ref(token_str.copy()));
-            return token;
-        }
+        const ReservedWord* word = find_reserved(begin, lexeme.length);
 
-        auto find_op_result = op_loc.find(token_str);
-        if (find_op_result != op_loc.end()) {
-            return Token(Token::OP, static_cast<unsigned>(find_op_result->second));
+        if (word == nullptr || word->kind == ReservedWord::TYPE) {
+            Token token(Token::ID, offset, lexeme.length);
+            if (symbols) {
+                token.set_symbol(symbols->intern_symbol(begin, begin + lexeme.length));
+            }
+            return token;
         }
-
-        auto find_result = keyword_loc.find(token_str);
-        if (find_result == keyword_loc.end()) {
-            return Token(Token::ID, make_ref(token_str.copy()));
+        else if (word->kind == ReservedWord::BOOL) {
+            Token token(Token::VALUE, offset, lexeme.length);
+            token.set_bool(word->id != 0);
+            return token;
         }
         else {
-            return Token(Token::KEYWORD, static_cast<unsigned>(find_result->second));
+            Token token(word->kind == ReservedWord::OP ? Token::OP : Token::KEYWORD, word->id);
+            token.set_offset(offset);
+            return token;
         }
     }
-
-    else {
-        throw SyntaxError("Unrecognized token");
-        return Token();
-    }
-
-}
-
-bool Lexer::match(const std::regex& re) {
-    std::smatch match_result;
-    if (std::regex_search(_reader->iter(), _reader->end(), match_result, re, std::regex_constants::match_continuous)) {
-        token_str = StringTmpRef(&*match_result[0].first, &*match_result[0].first + match_result[0].length());
-        _reader->forward(match_result[0].length());
-        return true;
-    }
-    else {
-        return false;
     }
 }
-
-StringRef Lexer::make_ref(const std::string & str)
-{
-    return _context->strpool.assign(str);
-}
@@ -5,16 +5,19 @@
 
 #include "util/ioutil.h"
 #include "util/memory.h"
+#include "util/errors.h"
 #include "util/strmap.h"
 #include "context.h"
 #include "token.h"
+#include "scanner.h"
 
 #include <string>
-#include <regex>
 #include <deque>
-#include <unordered_map>
+#include <vector>
 
 
+class ThreadPool;
+
 class Lexer {
 public:
 
@@ -28,6 +31,9 @@ public:
     void clear();
 
     void load(StrReader* reader, Context* strpool) {
+        if (static_cast<size_t>(reader->end_ptr() - reader->begin_ptr()) > Token::max_offset) {
+            throw CSLError("Source is too large");
+        }
         _reader = reader;
         _context = strpool;
     }
@@ -36,6 +42,13 @@ public:
 
     Token look_ahead();
 
+    /* Append all remaining tokens including EOF */
+    void tokenize(std::vector<Token>& tokens);
+
+    /* Same as tokenize(), lexing chunks of input on pool. Input shorter than 
+       2 * min_chunk is lexed sequentially */
+    void tokenize(std::vector<Token>& tokens, ThreadPool& pool, size_t min_chunk = 1 << 16);
+
     void go_back();
 
     size_t cur_pos()const {
@@ -46,32 +59,54 @@ public:
         return _reader;
     }
 
+    /* Stream input: source from offset on is still referred to by tokens out of 
+       lexer, and must not be dropped from the window */
+    void hold(size_t offset) {
+        _hold = offset;
+    }
+
+    /* Stream input: bytes dropped from the window since last call. Tokens out of
+       lexer must be rebased by it */
+    size_t take_shift() {
+        size_t shift = _shift;
+        _shift = 0;
+        return shift;
+    }
+
+    static const size_t npos = static_cast<size_t>(-1);
+
 private:
 
     void fetch_token();
 
     Token _fetch_token();
 
-    bool match(const std::regex&);
+    /* Load more stream input; Returns false at end of input */
+    bool refill();
 
-    StringRef make_ref(const std::string&);
+    /* Token of lexeme scanned at begin. Decoded string literals are stored in literals,
+       identifiers are interned into symbols unless it is nullptr */
+    static Token make_token(const char* source, const char* begin, const Lexeme& lexeme, 
+        ByteArena& literals, ConstStringPool* symbols);
 
-    static std::regex re_ws;
-    static std::regex re_op;
-    static std::regex re_int;
-    static std::regex re_float;
-    static std::regex re_id;
-    static std::regex re_str;
-    static std::regex re_char;
-    static StrMap<OpName> op_loc;
-    static StrMap<Keyword> keyword_loc;
+    /* Append tokens starting in [begin, stop). Returns the first non-whitespace
+       position at or after stop, where the next token starts */
+    static const char* lex_range(const char* source, const char* begin, const char* stop, const char* end,
+        std::vector<Token>& tokens, ByteArena& literals, ConstStringPool* symbols);
 
     StrReader* _reader;
     Context* _context;
     std::deque<Token> token_buf;
-    StringTmpRef token_str;
     size_t next_get_pos;
     size_t next_look_pos;
+    size_t _hold;
+    size_t _shift;
+
+    // Stream input: escaped strings go to two generations of arenas, so they are 
+    // dropped with their tokens instead of accumulating in Context::literalpool
+    ByteArena _stream_literals[2];
+    size_t _literal_end[2];     // offset in input after the last token of each generation
+    int _literal_gen;
 };
 
 
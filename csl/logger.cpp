@@ -3,6 +3,10 @@
 
 
 void output_error(std::ostream& os, const CSLError & error, const StrReader * reader) {
+    output_error(os, error, reader, reader->pos());
+}
+
+void output_error(std::ostream& os, const CSLError & error, const StrReader * reader, size_t offset) {
 
     if (error.get_id() == CSLError::NONE) {
         os << "Unknown Error: " << error.what() << std::endl;
@@ -12,14 +16,20 @@ void output_error(std::ostream& os, const CSLError & error, const StrReader * re
         os << "Syntax Error: " << error.what() << std::endl;
     }
 
-    output_context(os, reader);
+    output_context(os, reader, offset);
 }
 
 void output_context(std::ostream & os, const StrReader* reader) {
+    output_context(os, reader, reader->pos());
+}
+
+void output_context(std::ostream & os, const StrReader* reader, size_t offset) {
 
-    size_t linepos = reader->iter() - reader->cur_line_begin();
+    const LineIndex& lines = reader->lines();
+    size_t line = lines.line_of(offset);
+    size_t linepos = offset - lines.line_begin(line);
 
-    os << "At line " << reader->lineno() + 1 << ", pos " << linepos << std::endl;
-    os << std::string(reader->cur_line_begin(), reader->cur_line_end()) << std::endl;
+    os << "At line " << line + 1 << ", pos " << linepos << std::endl;
+    os << std::string(reader->begin_ptr() + lines.line_begin(line), reader->begin_ptr() + lines.line_end(line)) << std::endl;
     os << std::string(linepos, ' ') << '^' << std::endl;
 }
@@ -10,6 +10,11 @@
 
 void output_error(std::ostream&, const CSLError&, const StrReader*);
 
+/* Error at offset of source, e.g. of a token */
+void output_error(std::ostream&, const CSLError&, const StrReader*, size_t offset);
+
 void output_context(std::ostream&, const StrReader*);
 
-#endif
\ No newline at end of file
+void output_context(std::ostream&, const StrReader*, size_t offset);
+
+#endif
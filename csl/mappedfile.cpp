@@ -0,0 +1,104 @@
+#include "util/mappedfile.h"
+#include "util/errors.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+static const char empty_file[] = "";
+
+#if defined(_WIN32)
+
+void MappedFile::open(const std::string& filename) {
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, 
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw CSLError("Cannot open file: " + filename);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw CSLError("Cannot read file: " + filename);
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        _data = empty_file;
+        return;
+    }
+
+    // The view stays valid after both handles are closed
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    if (!view) {
+        throw CSLError("Cannot map file: " + filename);
+    }
+
+    _data = static_cast<const char*>(view);
+    _size = static_cast<size_t>(size.QuadPart);
+}
+
+void MappedFile::close() {
+    if (_data && _data != empty_file) {
+        UnmapViewOfFile(_data);
+    }
+    _data = nullptr;
+    _size = 0;
+}
+
+#else
+
+void MappedFile::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw CSLError("Cannot open file: " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw CSLError("Cannot read file: " + filename);
+    }
+    if (st.st_size == 0) {
+        ::close(fd);
+        _data = empty_file;
+        return;
+    }
+
+    // The mapping stays valid after fd is closed
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        throw CSLError("Cannot map file: " + filename);
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    _data = static_cast<const char*>(addr);
+    _size = static_cast<size_t>(st.st_size);
+}
+
+void MappedFile::close() {
+    if (_data && _data != empty_file) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+}
+
+#endif
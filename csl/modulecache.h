@@ -0,0 +1,127 @@
+#pragma once
+
+#ifndef CSL_MODULECACHE_H
+#define CSL_MODULECACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "context.h"
+
+
+/* A parsed file, with the context owning its tree */
+struct Module {
+    std::string path;
+    uint64_t hash;      // hash_bytes() of the source
+    size_t size;        // bytes of the source
+    Context context;
+    BlockStmtASTRef ast;
+};
+
+
+/* Parsed files by path and content hash, so importing an unchanged file again
+   takes a hash of its bytes and no lexing. Least recently used modules are
+   evicted beyond max_modules or max_bytes of source; an evicted module lives on
+   while an ImportAST refers to it. Thread-safe. */
+class ModuleCache {
+public:
+
+    struct Stats {
+        size_t hits;
+        size_t misses;      // with stale ones
+        size_t stale;       // found by path with other content
+        size_t evictions;
+    };
+
+    explicit ModuleCache(size_t max_modules = 256, size_t max_bytes = size_t(256) << 20) :
+        _max_modules(max_modules), _max_bytes(max_bytes), _bytes(0), _stats() {
+
+    }
+
+    ModuleCache(const ModuleCache&) = delete;
+    ModuleCache& operator=(const ModuleCache&) = delete;
+
+    /* Module of path with content hash, or nullptr */
+    std::shared_ptr<const Module> find(const std::string& path, uint64_t hash) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto iter = _index.find(path);
+        if (iter == _index.end()) {
+            _stats.misses++;
+            return nullptr;
+        }
+        if ((*iter->second)->hash != hash) {
+            _stats.misses++;
+            _stats.stale++;
+            erase(iter);
+            return nullptr;
+        }
+        _stats.hits++;
+        _lru.splice(_lru.begin(), _lru, iter->second);
+        return *iter->second;
+    }
+
+    /* Add module, replacing the one of its path */
+    void insert(const std::shared_ptr<const Module>& module) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto iter = _index.find(module->path);
+        if (iter != _index.end()) {
+            erase(iter);
+        }
+        _lru.push_front(module);
+        _index[module->path] = _lru.begin();
+        _bytes += module->size;
+
+        // the newest one stays, however large
+        while (_lru.size() > 1 && (_lru.size() > _max_modules || _bytes > _max_bytes)) {
+            erase(_index.find(_lru.back()->path));
+            _stats.evictions++;
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _lru.clear();
+        _index.clear();
+        _bytes = 0;
+    }
+
+    size_t size()const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _lru.size();
+    }
+
+    /* Bytes of source of cached modules */
+    size_t bytes()const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _bytes;
+    }
+
+    Stats stats()const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+private:
+
+    typedef std::list<std::shared_ptr<const Module>> List;
+
+    void erase(std::unordered_map<std::string, List::iterator>::iterator iter) {
+        _bytes -= (*iter->second)->size;
+        _lru.erase(iter->second);
+        _index.erase(iter);
+    }
+
+    size_t _max_modules;
+    size_t _max_bytes;
+    size_t _bytes;
+    Stats _stats;
+    List _lru;      // most recently used first
+    std::unordered_map<std::string, List::iterator> _index;
+    mutable std::mutex _mutex;
+};
+
+#endif
@@ -3,7 +3,6 @@
 #ifndef CSL_OPERATOR_H
 #define CSL_OPERATOR_H
 
-#include <unordered_map>
 #include <ostream>
 
 enum class Operator : unsigned {
@@ -49,54 +48,114 @@ enum class Operator : unsigned {
 };
 
 
+/* Properties of an operator, in operator_table by its value */
+struct OperatorInfo {
+    enum Flag : unsigned char {
+        VALID = 1,          // a named operator
+        BINARY = 2,         // has two operands
+        INFIX = 4,          // binary, parsed by precedence in simple expressions
+        ARITHMETIC = 8,     // + - * / % ^
+        LOGIC = 16,         // comparisons, and or xor not
+        ASSIGNMENT = 32,    // = and [+-*/%^]=
+        RIGHT = 64          // right associative
+    };
+
+    unsigned char flags;
+    unsigned char precedence;   // lower binds tighter; no_precedence for none
+};
+
+static const unsigned char no_precedence = 100;
+
+static const unsigned operator_count = static_cast<unsigned>(Operator::POWASN) + 1;
+
+#define CSL_OP_NONE         { 0, no_precedence }
+#define CSL_OP_ARITH(p)     { OperatorInfo::VALID | OperatorInfo::BINARY | OperatorInfo::INFIX | OperatorInfo::ARITHMETIC, p }
+#define CSL_OP_LOGIC(p)     { OperatorInfo::VALID | OperatorInfo::BINARY | OperatorInfo::INFIX | OperatorInfo::LOGIC, p }
+#define CSL_OP_UNARY(p)     { OperatorInfo::VALID, p }
+#define CSL_OP_MEMBER       { OperatorInfo::VALID | OperatorInfo::BINARY, no_precedence }
+#define CSL_OP_ASSIGN       { OperatorInfo::VALID | OperatorInfo::BINARY | OperatorInfo::ASSIGNMENT | OperatorInfo::RIGHT, 11 }
+
+constexpr OperatorInfo operator_table[operator_count] = {
+    CSL_OP_NONE,
+    /* ADD SUB MUL DIV MOD POW */
+    CSL_OP_ARITH(5), CSL_OP_ARITH(5), CSL_OP_ARITH(4), CSL_OP_ARITH(4), CSL_OP_ARITH(4), CSL_OP_ARITH(3),
+    /* PLUS MINUS INC DEC POSTINC POSTDEC */
+    CSL_OP_UNARY(2), CSL_OP_UNARY(2), CSL_OP_UNARY(2), CSL_OP_UNARY(2), CSL_OP_UNARY(1), CSL_OP_UNARY(1),
+    CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE,
+    /* MBER ARROW ADDR DEREF INDEX */
+    CSL_OP_MEMBER, CSL_OP_MEMBER, CSL_OP_UNARY(no_precedence), CSL_OP_UNARY(no_precedence), CSL_OP_UNARY(no_precedence),
+    CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE,
+    CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE,
+    /* EQ NE LT LE GT GE */
+    CSL_OP_LOGIC(7), CSL_OP_LOGIC(7), CSL_OP_LOGIC(6), CSL_OP_LOGIC(6), CSL_OP_LOGIC(6), CSL_OP_LOGIC(6),
+    /* AND OR XOR NOT */
+    CSL_OP_LOGIC(8), CSL_OP_LOGIC(10), CSL_OP_LOGIC(9), { OperatorInfo::VALID | OperatorInfo::LOGIC, no_precedence },
+    CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE, CSL_OP_NONE,
+    /* ASN ADDASN SUBASN MULASN DIVASN MODASN POWASN */
+    CSL_OP_ASSIGN, CSL_OP_ASSIGN, CSL_OP_ASSIGN, CSL_OP_ASSIGN, CSL_OP_ASSIGN, CSL_OP_ASSIGN, CSL_OP_ASSIGN
+};
+
+#undef CSL_OP_NONE
+#undef CSL_OP_ARITH
+#undef CSL_OP_LOGIC
+#undef CSL_OP_UNARY
+#undef CSL_OP_MEMBER
+#undef CSL_OP_ASSIGN
+
+static_assert(operator_table[static_cast<unsigned>(Operator::POW)].precedence == 3 &&
+    operator_table[static_cast<unsigned>(Operator::POSTDEC)].precedence == 1 &&
+    operator_table[static_cast<unsigned>(Operator::INDEX)].flags == OperatorInfo::VALID &&
+    operator_table[static_cast<unsigned>(Operator::EQ)].precedence == 7 &&
+    operator_table[static_cast<unsigned>(Operator::NOT)].precedence == no_precedence &&
+    operator_table[static_cast<unsigned>(Operator::ASN)].flags & OperatorInfo::ASSIGNMENT, "Operator table out of order");
+
+/* Entry of op; Values past the table, as of other OpNames, are of no operator */
+inline const OperatorInfo& get_operator_info(Operator op) {
+    unsigned i = static_cast<unsigned>(op);
+    return operator_table[i < operator_count ? i : 0];
+}
+
 inline bool is_valid(Operator op) {
-    return op <= Operator::POSTINC || 
-        op >= Operator::MBER && op <= Operator::INDEX || 
-        op >= Operator::EQ && op <= Operator::NOT || 
-        op >= Operator::ASN && op <= Operator::POWASN;
+    return (get_operator_info(op).flags & OperatorInfo::VALID) != 0;
 }
 
 // return if op belongs to '[+-*/%^]?=' (assignment)
 inline bool is_assignment(Operator op) {
-    return op >= Operator::ASN && op <= Operator::POWASN;
+    return (get_operator_info(op).flags & OperatorInfo::ASSIGNMENT) != 0;
 }
 
 // return if op belongs to + - * / ^ %
 inline bool is_arithmetic(Operator op) {
-    return op >= Operator::ADD && op < Operator::PLUS;
+    return (get_operator_info(op).flags & OperatorInfo::ARITHMETIC) != 0;
 }
 
 // return if op belongs to (and or xor not > < ...)
 inline bool is_logic(Operator op) {
-    return op >= Operator::EQ && op < Operator::ASN;
+    return (get_operator_info(op).flags & OperatorInfo::LOGIC) != 0;
 }
 
 // return if op belongs to (and or xor > < ...)
 inline bool is_binary_logic(Operator op) {
-    return op >= Operator::EQ && op < Operator::ASN && op != Operator::NOT;
+    return (get_operator_info(op).flags & (OperatorInfo::LOGIC | OperatorInfo::BINARY)) == (OperatorInfo::LOGIC | OperatorInfo::BINARY);
 }
 
 // if a binary operator
 inline bool is_binary(Operator op) {
-    return op <= Operator::POW || op == Operator::MBER || op == Operator::ARROW || op >= Operator::EQ && op != Operator::NOT;
+    return (get_operator_info(op).flags & OperatorInfo::BINARY) != 0;
 }
 
-// return precedence
-inline unsigned get_precedence(Operator op) {
+// if a binary operator of simple expressions, which have precedence
+inline bool is_infix(Operator op) {
+    return (get_operator_info(op).flags & OperatorInfo::INFIX) != 0;
+}
 
-    static std::unordered_map<Operator, unsigned> precedence{
-        { Operator::NONE, 100 },
-        { Operator::ADD, 5 },{ Operator::SUB, 5 },
-        { Operator::MUL, 4 },{ Operator::DIV, 4 },{ Operator::MOD, 4 },
-        { Operator::POW, 3 },
-        { Operator::PLUS, 2 },{ Operator::MINUS, 2 },{ Operator::INC, 2 },{ Operator::DEC, 2 },
-        { Operator::POSTINC, 1 },{ Operator::POSTDEC, 1 },
-        { Operator::EQ, 7 },{ Operator::NE, 7 },
-        { Operator::LT, 6 },{ Operator::LE, 6 },{ Operator::GT, 6 },{ Operator::GE, 6 },
-        { Operator::AND, 8 },{ Operator::XOR, 9 },{ Operator::OR, 10 }
-    };
+inline bool is_right_assoc(Operator op) {
+    return (get_operator_info(op).flags & OperatorInfo::RIGHT) != 0;
+}
 
-    return precedence.at(op);
+// return precedence; no_precedence if op has none
+inline unsigned get_precedence(Operator op) {
+    return get_operator_info(op).precedence;
 }
 
 inline void print_op(Operator op, std::ostream& os) {
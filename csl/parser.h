@@ -2,22 +2,47 @@
 #ifndef CSL_PARSER_H
 #define CSL_PARSER_H
 
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <memory>
 #include <string>
 #include <map>
 #include <unordered_set>
 
 #include "util/memory.h"
+#include "util/threadpool.h"
 #include "token.h"
 #include "lexer.h"
+#include "tokenstream.h"
 #include "ast.h"
+#include "astcache.h"
+#include "modulecache.h"
 #include "value.h"
 
 
+/* Result of parsing one of several independent sources */
+struct ParseUnit {
+    std::unique_ptr<Context> context;   // owns the tree and its names
+    BlockStmtASTRef ast;                // null if parsing failed
+    std::exception_ptr error;           // thrown by the parse, if any
+};
+
+
 // Parser using recursive descent algorithm
 class RDParser {
 public:
 
-    RDParser() {
+    /* How tokens are fetched from lexer */
+    enum LexMode {
+        BULK,       // tokenize the whole input before parsing
+        STREAM,     // tokenize on demand, e.g. for REPL
+        PARALLEL    // as BULK, lexing chunks on the thread pool; for large input
+    };
+
+    RDParser() : _typename_count(0), _symbol_generation(0), _class_limit(SIZE_MAX), _class_start(0),
+        _outer(nullptr), _outer_classes(0), _context(nullptr), _lex_mode(BULK), _pool(nullptr),
+        _lazy(false), _parallel(false) {
 
     }
 
@@ -26,41 +51,89 @@ public:
     }
 
     void clear() {
-        cur_token = Token(Token::NONE);
-        next_token = Token(Token::NONE);
-        next_look_token = Token(Token::NONE);
+        _tokens.clear();
         _lexer.clear();
+        _lazy_source = nullptr;
+        _pending.clear();
     }
     
     void load_context(Context* context) {
         this->_context = context;
+        _symbol_kinds.clear();
+    }
+
+    void set_lex_mode(LexMode mode) {
+        _lex_mode = mode;
+    }
+
+    /* Pool used by PARALLEL mode; Without a pool PARALLEL falls back to BULK */
+    void set_thread_pool(ThreadPool* pool) {
+        _pool = pool;
+    }
+
+    /* Leave function bodies in source, braces matched only, until FunctionAST::get_body().
+       A copy of the source is kept while such a body is left; Each body goes to a context
+       of its own in _context->parts. Syntax errors in a body are thrown by get_body().
+       Not in STREAM mode */
+    void set_lazy_bodies(bool lazy) {
+        _lazy = lazy;
     }
 
+    /* Parse function bodies after the rest of the source, on the thread pool. Consecutive
+       bodies of about body_chunk bytes go to a context of their own in _context->parts,
+       the same for any thread count, so the tree is too. Errors of bodies are thrown
+       after the ones of the rest, the first in source. Without a pool or in STREAM mode,
+       bodies are parsed in place */
+    void set_parallel_bodies(bool parallel) {
+        _parallel = parallel;
+    }
+
+    static const size_t body_chunk = 256 << 10;
+
+    /* Parse a file over its mapped pages, or read its tree from _context->ast_cache
+       if stored for its content. Imports in it are relative to its directory */
     ASTRef parse_file(const std::string& filename);
 
-    ExprASTRef parse_line_expr(const std::string& str);
+    /* Module of a file parsed in its own context, from _context->modules if the
+       content is unchanged. Relative paths are from the directory of the file
+       being parsed, if any */
+    std::shared_ptr<const Module> import_file(const std::string& filename);
+
+    /* Expression in _context->exprpool */
+    ExprASTHandle parse_line_expr(const std::string& str);
 
     BlockStmtASTRef parse_string(const std::string& str);
 
+    /* Parse input read in chunks from is; Source memory stays bounded */
+    BlockStmtASTRef parse_stream(std::istream& is);
+
+    /* Parse each source as parse_string() on pool, with a parser and Context per
+       source, so parses share no state. Units are in order of sources */
+    static std::vector<ParseUnit> parse_all(const std::vector<std::string>& sources, ThreadPool& pool);
+
     const Lexer& get_lexer()const {
         return _lexer;
     }
 
 private:
     
-    ExprASTRef parse_simple_expr();
+    ExprASTHandle parse_simple_expr();
+
+    /* Binary expression of operators binding tighter than limit (a precedence),
+       by precedence climbing on the C++ stack */
+    ExprASTHandle parse_binary_expr(unsigned limit);
 
-    ExprASTRef parse_unary_expr();
+    ExprASTHandle parse_unary_expr();
 
-    ExprASTRef parse_expr();	
+    ExprASTHandle parse_expr();
 
-    TypeASTRef parse_type_base(const StringRef&);
+    TypeASTRef parse_type_base(const Token&);
 
     TypeASTRef parse_type();
 
     std::vector<VarDeclASTRef> parse_var_decl();
 
-    ExprASTRef parse_initializer();
+    ExprASTHandle parse_initializer();
 
     StmtASTRef parse_stmt();
 
@@ -70,8 +143,49 @@ private:
 
     ClassASTRef parse_class_decl();
 
-    ConstantRef parse_value(const RawValue&);
+    ConstantHandle parse_value(const RawValue&);
+
+    /* Reserved type name or defined class */
+    bool is_typename(const Token&);
+
+    bool is_typename(const StringTmpRef&)const;
+
+    /* is_typename() of an interned name, memoized per symbol */
+    bool is_type_symbol(uint32_t symbol);
 
+    /* A class of _context seen by this parse */
+    bool is_visible_class(uint32_t symbol)const;
+
+    /* Skip a body, matching braces, and set begin to its source offset;
+       False if it defines a class, which must be parsed in place */
+    bool skip_body(size_t& begin);
+
+    /* Parse the bodies skipped for set_parallel_bodies() on _pool */
+    void parse_pending_bodies();
+
+    /* Interned name of an id token in string pool */
+    StringRef make_name(const Token&);
+
+    const char* source()const {
+        return _lexer.get_reader()->begin_ptr();
+    }
+
+
+    void load_tokens();
+
+    /* Tree of file content from _context->ast_cache, or null; Its imports are made by this parser */
+    BlockStmtASTRef load_cached(uint64_t hash, size_t size);
+
+    /* Store tree of file content in _context->ast_cache */
+    void store_cached(uint64_t hash, size_t size, const BlockStmtASTRef& ast);
+
+    const Token& cur_token()const {
+        return _tokens.prev();
+    }
+
+    const Token& next_token()const {
+        return _tokens.peek();
+    }
 
     void eat();
 
@@ -91,27 +205,72 @@ private:
 
     void match_required_symbol(OpName, char);
 
-    template<typename Ty>
-    MemoryRef<Ty> store_ast_unconst(Ty* ptr) {
-        return _context->astpool.collect<Ty>(ptr);
+    /* Construct an AST node in place in astpool */
+    template<typename Ty, typename... Args>
+    MemoryRef<Ty> make_ast_unconst(Args&&... args) {
+        return _context->astpool.construct<Ty>(std::forward<Args>(args)...);
+    }
+
+    /* Construct an AST node of Ty, referenced as Base */
+    template<typename Base, typename Ty = Base, typename... Args>
+    ConstMemoryRef<Base> make_ast(Args&&... args) {
+        static_assert(std::is_base_of<Base, Ty>::value, "Ty must derive from Base");
+        return make_ast_unconst<Ty>(std::forward<Args>(args)...).to_const().template cast<Base>();
+    }
+
+    /* Construct an expression node in place in exprpool */
+    template<typename Ty, typename... Args>
+    Handle<Ty> make_expr(Args&&... args) {
+        return _context->exprpool.construct<Ty>(std::forward<Args>(args)...);
     }
 
     template<typename Ty>
-    ConstMemoryRef<Ty> store_ast(Ty* ptr) {
-        return _context->astpool.collect<Ty>(ptr).to_const();
+    Ty* expr(const Handle<Ty>& h) {
+        return _context->exprpool.get(h);
     }
 
-    TypeRef store_type(Type* ptr) {
-        return _context->typepool.collect<Type>(ptr).to_const();
+    template<typename Ty, typename... Args>
+    TypeRef make_type(Args&&... args) {
+        return _context->typepool.construct<Ty>(std::forward<Args>(args)...).to_const().template cast<Type>();
     }
 
-    /* StringRef is only used for intermediate representation; For searching, std::string is used */
+    enum SymbolKind : unsigned char {
+        UNKNOWN = 0,
+        TYPENAME,
+        NOT_TYPENAME
+    };
+    std::vector<SymbolKind> _symbol_kinds;  // by symbol in _context->strpool
+    size_t _typename_count;                 // _context->class_count() when _symbol_kinds was filled
+    size_t _symbol_generation;              // generation of _context->strpool then
+
+    // classes of _context seen: the first _class_limit and the ones from _class_start
+    size_t _class_limit;
+    size_t _class_start;
+
+    // a parse a body is split from, in another context, and the classes of it seen
+    const Context* _outer;
+    size_t _outer_classes;
 
-    static std::map<std::string, ASTRef> ast_cache;     // global cache for import different files
-    static StrSet typename_cache;                       // defined classes
+    std::string _base_dir;                  // of the file being parsed, with trailing separator
+    std::vector<std::string> _import_stack; // files being imported, to catch circular imports
 
-    Token cur_token, next_token, next_look_token;
     Context* _context;
+    LexMode _lex_mode;
+    ThreadPool* _pool;
+    TokenStream _tokens;
+
+    class LazySource;
+    bool _lazy;
+    std::shared_ptr<LazySource> _lazy_source;   // of the current parse, once a body is left
+
+    /* A function body skipped to be parsed in parallel */
+    struct PendingBody {
+        FunctionAST* func;      // in _context->astpool
+        size_t begin, end;      // source offsets
+        size_t class_count;     // classes of _context seen
+    };
+    bool _parallel;
+    std::vector<PendingBody> _pending;
 
     Lexer _lexer;
 
@@ -1,76 +1,330 @@
 
 #include "parser.h"
 #include "operator.h"
+#include "reserved.h"
 
 #include "util/errors.h"
+#include "util/hash.h"
+#include "util/mappedfile.h"
 
+#include <cstdlib>
+#include <vector>
 
-std::map<std::string, ASTRef> RDParser::ast_cache;
-StrSet RDParser::typename_cache = { "void", "bool", "char", "int", "float" };
 
-ExprASTRef RDParser::parse_line_expr(const std::string& str) {
+// Directory part of path, with its trailing separator; "" if none
+static std::string dir_of(const std::string& path) {
+    size_t sep = path.find_last_of("/\\");
+    return sep == std::string::npos ? std::string() : path.substr(0, sep + 1);
+}
+
+static bool is_absolute(const std::string& path) {
+    return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+}
+
+// Path with ".", ".." and repeated separators folded, without touching the file system
+static std::string normalize_path(const std::string& path) {
+    std::vector<std::string> parts;
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t sep = path.find_first_of("/\\", pos);
+        if (sep == std::string::npos) sep = path.size();
+        std::string part = path.substr(pos, sep - pos);
+        if (part == "..") {
+            if (!parts.empty() && parts.back() != "..") parts.pop_back();
+            else if (!is_absolute(path)) parts.push_back(part);
+        }
+        else if (!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+        pos = sep + 1;
+    }
+    std::string ret = path.empty() || (path[0] != '/' && path[0] != '\\') ? "" : "/";
+    for (size_t i = 0; i < parts.size(); i++) {
+        ret += i ? "/" + parts[i] : parts[i];
+    }
+    return ret;
+}
+
+// One spelling per file: normalized, and resolved to the real file where it exists
+static std::string canonical_path(const std::string& filename) {
+    std::string path = normalize_path(filename);
+#ifdef _WIN32
+    char buf[_MAX_PATH];
+    if (_fullpath(buf, path.c_str(), sizeof(buf))) {
+        return buf;
+    }
+#else
+    char* real = realpath(path.c_str(), nullptr);
+    if (real) {
+        std::string ret(real);
+        free(real);
+        return ret;
+    }
+#endif
+    return path;
+}
+
+
+/* Source of a lazy parse, kept for the function bodies left in it. A body is
+   parsed into a context of its own in the parts of the context of the parse,
+   added under its body_mutex, seeing the classes of the parse as it would have
+   in place; The pools of the tree are only read meanwhile. Functions in the
+   body are parsed at once */
+class RDParser::LazySource : public BodySource {
+public:
+
+    LazySource(const char* begin, const char* end, Context* context, const std::string& base_dir,
+        const std::vector<std::string>& import_stack) :
+        _text(begin, end), _context(context), _base_dir(base_dir), _import_stack(import_stack) {
+
+    }
+
+    BlockStmtASTRef parse_body(size_t begin, size_t end, size_t class_count, const ExprPool*& exprs) {
+        std::lock_guard<std::mutex> lock(_context->body_mutex);
+        Instrument::Scope timer(_context->instrument, "lazy body");
+        _context->parts.emplace_back(new Context());
+        Context* part = _context->parts.back().get();
+        part->modules = _context->modules;
+        part->ast_cache = _context->ast_cache;
+
+        StrReader reader(_text.data() + begin, _text.data() + end);
+        RDParser parser;
+        parser.load_context(part);
+        parser._base_dir = _base_dir;
+        parser._import_stack = _import_stack;
+        parser._outer = _context;
+        parser._outer_classes = class_count;
+        parser._class_limit = 0;
+        parser._lexer.load(&reader, part);
+        parser.load_tokens();
+        try {
+            BlockStmtASTRef body = parser.parse_block_stmt();
+            exprs = &part->exprpool;
+            return body;
+        }
+        catch (...) {
+            // parsed again on the next call
+            _context->parts.pop_back();
+            throw;
+        }
+    }
+
+private:
+
+    std::string _text;
+    Context* _context;
+    std::string _base_dir;
+    std::vector<std::string> _import_stack;
+};
 
-    StrReader reader(str);
+ASTRef RDParser::parse_file(const std::string& filename) {
+
+    // Lexer runs over the mapped pages; AST does not refer to source text
+    MappedFile file(filename);
+    uint64_t hash = _context->ast_cache ? hash_bytes(file.data(), file.size()) : 0;
+
+    std::string outer_dir = _base_dir;
+    _base_dir = dir_of(filename);
+    _import_stack.push_back(canonical_path(filename));
+    try {
+        BlockStmtASTRef ret = load_cached(hash, file.size());
+        if (!ret.exists()) {
+            StrReader reader(file.data(), file.end());
+            this->clear();
+            _lexer.load(&reader, _context);
+            load_tokens();
+
+            Instrument::Scope timer(_context->instrument, "parse");
+            ret = parse_block_stmt(true);
+            parse_pending_bodies();
+            store_cached(hash, file.size(), ret);
+        }
+        _base_dir = outer_dir;
+        _import_stack.pop_back();
+        _context->sample_pools();
+        return ret.cast<ASTBase>();
+    }
+    catch (...) {
+        _base_dir = outer_dir;
+        _import_stack.pop_back();
+        throw;
+    }
+}
+
+std::shared_ptr<const Module> RDParser::import_file(const std::string& filename) {
+
+    Instrument::Scope timer(_context->instrument, "import");
+    std::string path = canonical_path(is_absolute(filename) ? filename : _base_dir + filename);
+    for (const auto& importing : _import_stack) {
+        if (importing == path) {
+            throw SyntaxError("Circular import: " + path);
+        }
+    }
+
+    MappedFile file(path);
+    uint64_t hash = hash_bytes(file.data(), file.size());
+    ModuleCache* cache = _context->modules;
+    if (cache) {
+        std::shared_ptr<const Module> cached = cache->find(path, hash);
+        if (cached) {
+            return cached;
+        }
+    }
+
+    std::shared_ptr<Module> module = std::make_shared<Module>();
+    module->path = path;
+    module->hash = hash;
+    module->size = file.size();
+    module->context.modules = cache;
+    module->context.ast_cache = _context->ast_cache;
+
+    RDParser parser;
+    parser.load_context(&module->context);
+    parser.set_lex_mode(_lex_mode == STREAM ? BULK : _lex_mode);
+    parser.set_thread_pool(_pool);
+    parser.set_lazy_bodies(_lazy);
+    parser.set_parallel_bodies(_parallel);
+    parser._base_dir = dir_of(path);
+    parser._import_stack = _import_stack;
+    parser._import_stack.push_back(path);
+
+    module->ast = parser.load_cached(hash, file.size());
+    if (!module->ast.exists()) {
+        StrReader reader(file.data(), file.end());
+        parser._lexer.load(&reader, &module->context);
+        parser.load_tokens();
+        module->ast = parser.parse_block_stmt(true);
+        parser.parse_pending_bodies();
+        parser.store_cached(hash, file.size(), module->ast);
+    }
+
+    if (cache) {
+        cache->insert(module);
+    }
+    return module;
+}
+
+BlockStmtASTRef RDParser::load_cached(uint64_t hash, size_t size) {
+    if (!_context->ast_cache) {
+        return BlockStmtASTRef();
+    }
+    return _context->ast_cache->load(hash, size, *_context, [this](const std::string& path) {
+        return import_file(path);
+    });
+}
+
+void RDParser::store_cached(uint64_t hash, size_t size, const BlockStmtASTRef& ast) {
+    if (_context->ast_cache) {
+        Instrument::Scope timer(_context->instrument, "cache store");
+        _context->ast_cache->store(hash, size, ast, _context->exprpool);
+    }
+}
+
+ExprASTHandle RDParser::parse_line_expr(const std::string& str) {
+
+    StrReader reader(str.data(), str.data() + str.length());
     this->clear();
     _lexer.load(&reader, _context);
-    eat();
-    return parse_expr();
+    load_tokens();
+    Instrument::Scope timer(_context->instrument, "parse");
+    ExprASTHandle ret = parse_expr();
+    _context->sample_pools();
+    return ret;
 }
 
 BlockStmtASTRef RDParser::parse_string(const std::string & str) {
-    StrReader reader(str);
+    StrReader reader(str.data(), str.data() + str.length());
+    this->clear();
+    _lexer.load(&reader, _context);
+    load_tokens();
+    Instrument::Scope timer(_context->instrument, "parse");
+    BlockStmtASTRef ret = parse_block_stmt(true);
+    parse_pending_bodies();
+    _context->sample_pools();
+    return ret;
+}
+
+
+BlockStmtASTRef RDParser::parse_stream(std::istream& is) {
+    StreamReader reader(is);
     this->clear();
     _lexer.load(&reader, _context);
-    eat();
-    return parse_block_stmt(true);
+    _tokens.attach(_lexer);     // bulk modes would keep the whole input
+    Instrument::Scope timer(_context->instrument, "parse");    // lexing included
+    BlockStmtASTRef ret = parse_block_stmt(true);
+    _context->sample_pools();
+    return ret;
 }
 
+std::vector<ParseUnit> RDParser::parse_all(const std::vector<std::string>& sources, ThreadPool& pool) {
+
+    std::vector<ParseUnit> units(sources.size());
+    std::vector<std::future<void>> done;
+    done.reserve(sources.size());
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        done.push_back(pool.submit([&, i]() {
+            ParseUnit& unit = units[i];
+            unit.context.reset(new Context());
+            try {
+                RDParser parser;
+                parser.load_context(unit.context.get());
+                unit.ast = parser.parse_string(sources[i]);
+            }
+            catch (...) {
+                unit.error = std::current_exception();
+            }
+        }));
+    }
+    for (auto& f : done) {
+        f.get();
+    }
+    return units;
+}
 
-ExprASTRef RDParser::parse_unary_expr() {
+ExprASTHandle RDParser::parse_unary_expr() {
 
-    MemoryRef<OpAST> cur_ast_prefix, ast_prefix_ref;
+    Handle<OpAST> cur_ast_prefix, ast_prefix_ref;
 
     while (1) {
-        OpAST* new_ast;
+        Handle<OpAST> new_ast_ref;
         if (match_op(OpName::INC) || match_op(OpName::DEC) || match_op(OpName::ADDR)) {
-            new_ast = new OpAST(static_cast<Operator>(cur_token.get_operator()));
+            new_ast_ref = make_expr<OpAST>(static_cast<Operator>(cur_token().get_operator()));
         }
         else if (match_op(OpName::ADD)) {
-            new_ast = new OpAST(Operator::PLUS);
+            new_ast_ref = make_expr<OpAST>(Operator::PLUS);
         }
         else if (match_op(OpName::SUB)) {
-            new_ast = new OpAST(Operator::MINUS);
+            new_ast_ref = make_expr<OpAST>(Operator::MINUS);
         }
         else if (match_op(OpName::NOT)) {
-            new_ast = new OpAST(Operator::NOT);
+            new_ast_ref = make_expr<OpAST>(Operator::NOT);
         }
         else if (match_op(OpName::MUL)) {
-            new_ast = new OpAST(Operator::DEREF);
+            new_ast_ref = make_expr<OpAST>(Operator::DEREF);
         }
         else {
             break;
         }
 
-        MemoryRef<OpAST> new_ast_ref = store_ast_unconst(new_ast);
-
-        if (!ast_prefix_ref) {
+        if (!ast_prefix_ref.exists()) {
             cur_ast_prefix = ast_prefix_ref = new_ast_ref;
         }
         else {
-            cur_ast_prefix->add_child(new_ast_ref.to_const().cast<ExprAST>());
+            expr(cur_ast_prefix)->add_child(new_ast_ref);
             cur_ast_prefix = new_ast_ref;
         }
     }
 
-    ExprASTRef ast_id_ref;
+    ExprASTHandle ast_id_ref;
 
     if (match(Token::ID)) {
-        StringRef name = cur_token.get_name();
-        ast_id_ref = store_ast<ExprAST>(new IdAST(name));
+        StringRef name = make_name(cur_token());
+        ast_id_ref = make_expr<IdAST>(name);
     }
     else if (match(Token::VALUE)) {
-        ConstantRef c = parse_value(cur_token.get_value());
-        ast_id_ref = store_ast<ExprAST>(new ValueAST(c));
+        ConstantHandle c = parse_value(cur_token().get_value(source()));
+        ast_id_ref = make_expr<ValueAST>(c);
     }
     else if (match_op(OpName::BRAC)) {
         ast_id_ref = parse_expr();
@@ -80,29 +334,31 @@ ExprASTRef RDParser::parse_unary_expr() {
         throw SyntaxError("Token with id/value required");
     }
 
-    ExprASTRef ast_postfix_ref = ast_id_ref;
+    ExprASTHandle ast_postfix_ref = ast_id_ref;
 
     while (1) {
         if (match_op(OpName::INDEX)) {
-            MemoryRef<OpAST> op = store_ast_unconst(new OpAST(Operator::INDEX));
-            op->add_child(ast_postfix_ref);
-            op->add_child(parse_expr());
-            ast_postfix_ref = op.cast<ExprAST>();
+            Handle<OpAST> op = make_expr<OpAST>(Operator::INDEX);
+            expr(op)->add_child(ast_postfix_ref);
+            ExprASTHandle index = parse_expr();
+            expr(op)->add_child(index);
+            ast_postfix_ref = op;
             match_required_symbol(OpName::RINDEX, ']');
         }
         else if (match_op(OpName::BRAC)) {
-            CallAST* call_ast = new CallAST();
+            Handle<CallAST> call_ast = make_expr<CallAST>();
 
-            if (ast_postfix_ref->is_id()) {
+            if (expr(ast_postfix_ref)->is_id()) {
                 throw SyntaxError("Requires an identifier");
             }
             else {
-                call_ast->set_callee(ast_postfix_ref.cast<IdAST>());
+                expr(call_ast)->set_callee(ast_postfix_ref.cast<IdAST>());
             }
 
             if (!match_op(OpName::RBRAC)) {
                 while (1) {
-                    call_ast->add_arg(parse_expr());
+                    ExprASTHandle arg = parse_expr();
+                    expr(call_ast)->add_arg(arg);
                     if (!match_op(OpName::COMMA)) {
                         break;
                     }
@@ -112,25 +368,23 @@ ExprASTRef RDParser::parse_unary_expr() {
                 }
             }
 
-            ast_postfix_ref = store_ast<ExprAST>(call_ast);
+            ast_postfix_ref = call_ast;
         }
         else if (match_op(OpName::MBER) || match_op(OpName::ARROW)) {
-            OpAST* op = new OpAST(static_cast<Operator>(cur_token.get_operator()));
+            Handle<OpAST> op = make_expr<OpAST>(static_cast<Operator>(cur_token().get_operator()));
             if (match(Token::ID)) {
-                op->add_child(store_ast<ExprAST>(new IdAST(cur_token.get_name())));
+                expr(op)->add_child(make_expr<IdAST>(make_name(cur_token())));
             }
             else {
                 throw SyntaxError("Member name required");
             }
-            ast_postfix_ref = store_ast<ExprAST>(op);
+            ast_postfix_ref = op;
         }
         else if (match_op(OpName::INC)) {
-            OpAST* op = new OpAST(Operator::POSTINC, ast_postfix_ref);
-            ast_postfix_ref = store_ast<ExprAST>(op);
+            ast_postfix_ref = make_expr<OpAST>(Operator::POSTINC, ast_postfix_ref);
         }
         else if (match_op(OpName::DEC)) {
-            OpAST* op = new OpAST(Operator::POSTDEC, ast_postfix_ref);
-            ast_postfix_ref = store_ast<ExprAST>(op);
+            ast_postfix_ref = make_expr<OpAST>(Operator::POSTDEC, ast_postfix_ref);
         }
         else {
             break;
@@ -138,8 +392,8 @@ ExprASTRef RDParser::parse_unary_expr() {
     }
 
     if (ast_prefix_ref.exists()) {
-        cur_ast_prefix->add_child(ast_postfix_ref);
-        return ast_prefix_ref.cast<ExprAST>().to_const();
+        expr(cur_ast_prefix)->add_child(ast_postfix_ref);
+        return ast_prefix_ref;
     }
     else {
         return ast_postfix_ref;
@@ -147,79 +401,56 @@ ExprASTRef RDParser::parse_unary_expr() {
 }
 
 
-ExprASTRef RDParser::parse_simple_expr() {
-
-    std::vector<Operator> op_stack = { Operator::NONE };
-    std::vector<ExprASTRef> value_stack;
-
-    while (1) {
-        value_stack.push_back(parse_unary_expr());
-        if (!try_match(Token::OP)) {
-            break;
-        }
-
-        OpName opname = next_token.get_operator();
-        if (opname == OpName::RBRAC || opname == OpName::RINDEX) break;
-        
-        Operator op = static_cast<Operator>(opname);
-        if (!is_valid(op))break;
-
-        if (is_assignment(op)) break;
+ExprASTHandle RDParser::parse_simple_expr() {
+    return parse_binary_expr(no_precedence);
+}
 
-        match(Token::OP);
 
-        if (!is_arithmetic(op) && !is_logic(op)) throw SyntaxError("Arithmetic operator");
+ExprASTHandle RDParser::parse_binary_expr(unsigned limit) {
 
-        unsigned pred = get_precedence(op);
+    ExprASTHandle lhs = parse_unary_expr();
 
-        if (pred < get_precedence(op_stack.back())) {
-            op_stack.push_back(op);
+    while (try_match(Token::OP)) {
+        // ) ] , ; and assignments end a simple expression
+        Operator op = static_cast<Operator>(next_token().get_operator());
+        if (!is_valid(op) || is_assignment(op)) {
+            break;
         }
-        else {
-            while (pred >= get_precedence(op_stack.back())) {
-                auto rval = value_stack.back();
-                value_stack.pop_back();
-                auto lval = value_stack.back();
-                value_stack.pop_back();
-
-                value_stack.push_back(store_ast<ExprAST>(new OpAST(op_stack.back(), lval, rval)));
-                op_stack.pop_back();
-            }
-            op_stack.push_back(op);
+        if (!is_infix(op)) {
+            eat();
+            throw SyntaxError("Arithmetic operator");
         }
-    }
-
-    while (op_stack.size() > 1) {
 
-        auto rval = value_stack.back();
-        value_stack.pop_back();
-        auto lval = value_stack.back();
-        value_stack.pop_back();
+        unsigned pred = get_precedence(op);
+        if (pred >= limit) {
+            break;
+        }
+        eat();
 
-        value_stack.push_back(store_ast<ExprAST>(new OpAST(op_stack.back(), lval, rval)));
-        op_stack.pop_back();
+        // the right operand takes only operators binding tighter, so equal ones group to the left
+        ExprASTHandle rhs = parse_binary_expr(is_right_assoc(op) ? pred + 1 : pred);
+        lhs = make_expr<OpAST>(op, lhs, rhs);
     }
 
-    auto ret = value_stack.back();
-    value_stack.pop_back();
-    return ret;
+    return lhs;
 }
 
 
-ExprASTRef RDParser::parse_expr() {
+ExprASTHandle RDParser::parse_expr() {
 
     if (match_op(OpName::SEMICOLON)) {
-        return ExprASTRef();
+        return ExprASTHandle();
     }
 
-    ExprASTRef ast_lhs = parse_simple_expr();
-    ExprASTRef ast_ret;
+    ExprASTHandle ast_lhs = parse_simple_expr();
+    ExprASTHandle ast_ret;
 
-    if (try_match(Token::OP) && is_valid(static_cast<Operator>(next_token.get_operator()))) {
-        Operator op = static_cast<Operator>(next_token.get_operator());
+    if (try_match(Token::OP) && is_valid(static_cast<Operator>(next_token().get_operator()))) {
+        Operator op = static_cast<Operator>(next_token().get_operator());
         if (is_assignment(op)) {
             eat();
-            ast_ret = store_ast<ExprAST>(new OpAST(op, ast_lhs, parse_expr()));
+            ExprASTHandle rhs = parse_expr();
+            ast_ret = make_expr<OpAST>(op, ast_lhs, rhs);
         }
         else {
             ast_ret = ast_lhs;
@@ -233,20 +464,15 @@ ExprASTRef RDParser::parse_expr() {
 
 }
 
-TypeASTRef RDParser::parse_type_base(const StringRef& name) {
+TypeASTRef RDParser::parse_type_base(const Token& token) {
     
-    const std::map<std::string, Type::TypeID> typeloc = {
-        {"void", Type::VOID}, {"bool", Type::BOOL}, {"char", Type::CHAR},
-        {"int", Type::INT}, {"float", Type::FLOAT}
-    };
-
-    auto find_result = typeloc.find(name.to_string());  /// TODO: Using StringRef directly
-    if (find_result == typeloc.end()) {
-        return store_ast<TypeAST>(new TypeAST(name));
+    StringTmpRef name = token.get_name(source());
+    const ReservedWord* word = find_reserved(name.get(), name.length());
+    if (word == nullptr || word->kind != ReservedWord::TYPE) {
+        return make_ast<TypeAST>(make_name(token));
     }
     else {
-        TypeRef type = store_type(new PrimitiveType(find_result->second));
-        return store_ast<TypeAST>(new TypeAST(type));
+        return make_ast<TypeAST>(_context->get_primitive_type(static_cast<Type::TypeID>(word->id)));
     }
 }
 
@@ -254,10 +480,10 @@ TypeASTRef RDParser::parse_type() {
     TypeASTRef vartype;
 
     if (match(Token::ID)) {
-        if (!typename_cache.has_key(cur_token.get_name().to_cstr())) {
-            throw SyntaxError("Type undefined: " + cur_token.get_name());
+        if (!is_typename(cur_token())) {
+            throw SyntaxError("Type undefined: " + cur_token().get_name(source()).copy());
         }
-        vartype = parse_type_base(cur_token.get_name());
+        vartype = parse_type_base(cur_token());
     }
     else {
         throw SyntaxError("Type name required");
@@ -266,16 +492,16 @@ TypeASTRef RDParser::parse_type() {
     while (1) {
         // pointer
         if (match_op(OpName::MUL)) {
-            vartype = store_ast<TypeAST>(new TypeAST(vartype));
+            vartype = make_ast<TypeAST>(vartype);
 
         }
         else if (match_op(OpName::INDEX)) {
-            ExprASTRef idx_ast;
+            ExprASTHandle idx_ast;
             if (!match_op(OpName::RINDEX)) {
                 idx_ast = parse_expr();
                 match_required_symbol(OpName::RINDEX, ']');
             }
-            vartype = store_ast<TypeAST>(new ArrayTypeAST(vartype, idx_ast));
+            vartype = make_ast<TypeAST, ArrayTypeAST>(vartype, idx_ast);
         }
         else {
             break;
@@ -290,10 +516,10 @@ std::vector<VarDeclASTRef> RDParser::parse_var_decl() {
     TypeASTRef vartype;
 
     if (match(Token::ID)) {
-        if (!typename_cache.has_key(cur_token.get_name().to_cstr())) {
-            throw SyntaxError("Type undefined: " + cur_token.get_name());
+        if (!is_typename(cur_token())) {
+            throw SyntaxError("Type undefined: " + cur_token().get_name(source()).copy());
         }
-        vartype = parse_type_base(cur_token.get_name());
+        vartype = parse_type_base(cur_token());
     }
     else {
         throw SyntaxError("Type name required");
@@ -301,16 +527,16 @@ std::vector<VarDeclASTRef> RDParser::parse_var_decl() {
 
     while (1) {
         if (match_op(OpName::MUL)) {
-            vartype = store_ast<TypeAST>(new TypeAST(vartype));
+            vartype = make_ast<TypeAST>(vartype);
 
         }
         else if (match_op(OpName::INDEX)) {
-            ExprASTRef idx_ast;
+            ExprASTHandle idx_ast;
             if (!match_op(OpName::RINDEX)) {
                 idx_ast = parse_expr();
                 match_required_symbol(OpName::RINDEX, ']');
             }
-            vartype = store_ast<TypeAST>(new ArrayTypeAST(vartype, idx_ast));
+            vartype = make_ast<TypeAST, ArrayTypeAST>(vartype, idx_ast);
         }
         else {
             break;
@@ -326,17 +552,17 @@ std::vector<VarDeclASTRef> RDParser::parse_var_decl() {
 
 
         if (match(Token::ID)) {
-            cur_varname = cur_token.get_name();
+            cur_varname = make_name(cur_token());
         }
         else {
             throw SyntaxError("Identifier required for declaration");
         }
 
-        ExprASTRef initializer;
+        ExprASTHandle initializer;
         if (match_op(OpName::ASN)) {
             initializer = parse_initializer();
         }
-        decl_ast_list.push_back(store_ast<VarDeclAST>(new VarDeclAST(vartype, cur_varname, initializer)));
+        decl_ast_list.push_back(make_ast<VarDeclAST>(vartype, cur_varname, initializer));
 
         if (match_op(OpName::COMMA)) {
             continue;
@@ -351,18 +577,19 @@ std::vector<VarDeclASTRef> RDParser::parse_var_decl() {
 
 }
 
-ExprASTRef RDParser::parse_initializer()
+ExprASTHandle RDParser::parse_initializer()
 {
     if (match_op(OpName::COMP)) {
-        ExprAST* initializer = new ListAST();
+        Handle<ListAST> initializer = make_expr<ListAST>();
         while (1) {
-            initializer->add_child(parse_initializer());
+            ExprASTHandle member = parse_initializer();
+            expr(initializer)->add_child(member);
             if (!match_op(OpName::COMMA)) {
                 break;
             }
         }
         match_required_symbol(OpName::RCOMP, '}');
-        return store_ast<ExprAST>(initializer);
+        return initializer;
     }
     else {
         return parse_expr();
@@ -377,7 +604,7 @@ StmtASTRef RDParser::parse_stmt(){
 
     else if (match_keyword(Keyword::IF)) {
         
-        ExprASTRef expr_cond;
+        ExprASTHandle expr_cond;
         StmtASTRef ast1, ast2;
 
         match_required_symbol(OpName::BRAC, '(');
@@ -389,24 +616,24 @@ StmtASTRef RDParser::parse_stmt(){
         if (match_keyword(Keyword::ELSE)) {
             ast2 = parse_stmt();
         }
-        return store_ast<StmtAST>(new IfAST(expr_cond, ast1, ast2));
+        return make_ast<StmtAST, IfAST>(expr_cond, ast1, ast2);
     }
 
     else if (match_keyword(Keyword::WHILE)) {
 
-        ExprASTRef expr_cond;
+        ExprASTHandle expr_cond;
         StmtASTRef ast1;
 
         match_required_symbol(OpName::BRAC, '(');
         expr_cond = parse_expr();
         match_required_symbol(OpName::RBRAC, ')');
 
-        return store_ast<StmtAST>(new WhileAST(expr_cond, parse_stmt()));
+        return make_ast<StmtAST, WhileAST>(expr_cond, parse_stmt());
     }
 
     else if (match_keyword(Keyword::FOR)) {
 
-        ExprASTRef expr_init, expr_cond, expr_loop;
+        ExprASTHandle expr_init, expr_cond, expr_loop;
 
         match_required_symbol(OpName::BRAC, '(');
         expr_init = parse_expr();
@@ -416,20 +643,29 @@ StmtASTRef RDParser::parse_stmt(){
         expr_loop = parse_expr();
         match_required_symbol(OpName::RBRAC, ')');
 
-        return store_ast<StmtAST>(new ForAST(expr_init, expr_cond, expr_loop, parse_stmt()));
+        return make_ast<StmtAST, ForAST>(expr_init, expr_cond, expr_loop, parse_stmt());
     }
 
     else if (match_keyword(Keyword::BREAK)) {
-        return store_ast<StmtAST>(new BreakAST());
+        return make_ast<StmtAST, BreakAST>();
     }
     else if (match_keyword(Keyword::CONTINUE)) {
-        return store_ast<StmtAST>(new ContinueAST());
+        return make_ast<StmtAST, ContinueAST>();
     }
     else if (match_keyword(Keyword::RETURN)) {
-        return store_ast<StmtAST>(new ReturnAST(parse_expr()));
+        return make_ast<StmtAST, ReturnAST>(parse_expr());
+    }
+    else if (match_keyword(Keyword::IMPORT)) {
+        if (!match(Token::VALUE) || cur_token().get_value_type() != RawValue::STRING) {
+            throw SyntaxError("Requires a file name");
+        }
+        StringTmpRef path = cur_token().get_value(source()).strdata;
+        return make_ast<StmtAST, ImportAST>(_context->strpool.assign(path.get(), path.get() + path.length()), 
+            import_file(path.copy()));
     }
     else {
-        return parse_expr().cast<StmtAST>();
+        ExprASTHandle ast = parse_expr();
+        return ast.exists() ? make_ast<StmtAST, ExprStmtAST>(ast) : StmtASTRef();
     }
 
 }
@@ -439,7 +675,7 @@ BlockStmtASTRef RDParser::parse_block_stmt(bool implicit_bracket) {
         match_required_symbol(OpName::COMP, '{');
     }
 
-    MemoryRef<BlockStmtAST> ast = store_ast_unconst(new BlockStmtAST());
+    MemoryRef<BlockStmtAST> ast = make_ast_unconst<BlockStmtAST>();
 
     while (1) {
         if (!implicit_bracket && match_op(OpName::RCOMP)) {
@@ -456,8 +692,14 @@ BlockStmtASTRef RDParser::parse_block_stmt(bool implicit_bracket) {
                 throw SyntaxError("Reach end of file");
             }
         }
+        else if (try_match_keyword(Keyword::FN)) {
+            ast->append(parse_function_decl().cast<DeclAST>());
+        }
+        else if (try_match_keyword(Keyword::CLASS)) {
+            ast->append(parse_class_decl().cast<DeclAST>());
+        }
         else if (try_match(Token::ID)) {
-            if (typename_cache.has_key(next_token.get_name().to_cstr())) {
+            if (is_typename(next_token())) {
                 for (const auto& i : parse_var_decl()) {
                     ast->append(i);
                 }
@@ -488,24 +730,24 @@ FunctionASTRef RDParser::parse_function_decl() {
 
     StringRef fname;
     if (match(Token::ID)) {
-        fname = next_token.get_name();
+        fname = make_name(cur_token());
     }
     else {
         throw SyntaxError("Expect an identifier");
     }
 
     match_required_symbol(OpName::BRAC, '(');
-    FunctionAST* func = new FunctionAST(fname);
+    MemoryRef<FunctionAST> func = make_ast_unconst<FunctionAST>(fname);
 
     while (1) {
         if (match(Token::ID)) { // id:(type)
-            StringRef arg_name = cur_token.get_name();
+            StringRef arg_name = make_name(cur_token());
             TypeASTRef arg_type;
             if (match_op(OpName::COLON)) {
                 arg_type = parse_type();
             }
             else {
-                arg_type = store_ast<TypeAST>(new TypeAST(store_type(new Type(Type::VOID))));
+                arg_type = make_ast<TypeAST>(make_type<Type>(Type::VOID));
             }
             func->add_argument(arg_type, arg_name);
             if (match_op(OpName::RBRAC)) {
@@ -514,14 +756,7 @@ FunctionASTRef RDParser::parse_function_decl() {
             match_required_symbol(OpName::COMMA, ',');
         }
         else if (match_op(OpName::COLON)) { // :(type)
-            TypeASTRef arg_type;
-            if (match_op(OpName::COLON)) {
-                arg_type = parse_type();
-            }
-            else {
-                arg_type = store_ast<TypeAST>(new TypeAST(store_type(new Type(Type::VOID))));
-            }
-            func->add_argument(arg_type);
+            func->add_argument(parse_type());
             if (match_op(OpName::RBRAC)) {
                 break;
             }
@@ -534,28 +769,136 @@ FunctionASTRef RDParser::parse_function_decl() {
             throw SyntaxError("Expected an id");
         }
     }
-    match_required_symbol(OpName::RBRAC, ')');
 
     if (match_op(OpName::ARROW)) {
         TypeASTRef ret_type = parse_type();
         func->set_return_type(ret_type);
     }
     else {
-        func->set_return_type(store_ast<TypeAST>(new TypeAST(
-            store_type(new Type(Type::VOID)))));
+        func->set_return_type(make_ast<TypeAST>(make_type<Type>(Type::VOID)));
     }
 
-    if (try_match_op(OpName::COMP)) {
+    size_t mark = _tokens.mark();
+    size_t begin = 0;
+    bool skipped = try_match_op(OpName::COMP) && (_lazy || (_parallel && _pool)) && !_tokens.is_streaming();
+    if (skipped && !skip_body(begin)) {
+        // a class in it is defined in source order, as if parsed in place
+        _tokens.rewind(mark);
+        skipped = false;
+    }
+
+    if (skipped && _lazy) {
+        // parsed from source on first access
+        if (!_lazy_source) {
+            _lazy_source = std::make_shared<LazySource>(source(), _lexer.get_reader()->end_ptr(), _context,
+                _base_dir, _import_stack);
+        }
+        func->set_lazy_body(_lazy_source, begin, cur_token().get_offset() + 1, _context->class_count());
+    }
+    else if (skipped) {
+        PendingBody body = { func.get(), begin, cur_token().get_offset() + 1, _context->class_count() };
+        _pending.push_back(body);
+    }
+    else if (try_match_op(OpName::COMP)) {
         func->set_body_ast(parse_block_stmt());
     }
     else {
         match_required_symbol(OpName::SEMICOLON, ';');
     }
     
-    return store_ast<FunctionAST>(func);
+    return func.to_const();
 }
 
 
+bool RDParser::skip_body(size_t& begin) {
+    begin = next_token().get_offset();
+    match_required_symbol(OpName::COMP, '{');
+    bool skippable = true;
+    for (size_t depth = 1; depth > 0; ) {
+        if (match_op(OpName::COMP)) {
+            depth++;
+        }
+        else if (match_op(OpName::RCOMP)) {
+            depth--;
+        }
+        else if (match_keyword(Keyword::CLASS)) {
+            skippable = false;
+        }
+        else if (match(Token::EOF)) {
+            throw SyntaxError("Reach end of file");
+        }
+        else {
+            eat();
+        }
+    }
+    return skippable;
+}
+
+void RDParser::parse_pending_bodies() {
+    if (_pending.empty()) {
+        return;
+    }
+    Instrument::Scope timer(_context->instrument, "parallel bodies");
+    std::vector<PendingBody> pending;
+    pending.swap(_pending);
+
+    // chunks of consecutive bodies, by their size only
+    std::vector<size_t> bounds(1, 0);
+    size_t bytes = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        bytes += pending[i].end - pending[i].begin;
+        if (bytes >= body_chunk || i + 1 == pending.size()) {
+            bounds.push_back(i + 1);
+            bytes = 0;
+        }
+    }
+    size_t chunk_count = bounds.size() - 1;
+    size_t first_part = _context->parts.size();
+    for (size_t i = 0; i < chunk_count; i++) {
+        _context->parts.emplace_back(new Context());
+        _context->parts.back()->modules = _context->modules;
+        _context->parts.back()->ast_cache = _context->ast_cache;
+    }
+
+    // _context is only read meanwhile
+    std::vector<std::exception_ptr> errors(chunk_count);
+    const char* text = source();
+    _pool->parallel_for(chunk_count, [&](size_t chunk) {
+        Context* part = _context->parts[first_part + chunk].get();
+        RDParser parser;
+        parser.load_context(part);
+        parser._base_dir = _base_dir;
+        parser._import_stack = _import_stack;
+        parser._outer = _context;
+        parser._class_limit = 0;
+        try {
+            for (size_t i = bounds[chunk]; i < bounds[chunk + 1]; i++) {
+                const PendingBody& body = pending[i];
+                // classes of other bodies are not seen; names are memoized for the classes seen
+                if (part->class_count() != parser._class_start || body.class_count != parser._outer_classes) {
+                    parser._class_start = part->class_count();
+                    parser._outer_classes = body.class_count;
+                    parser._symbol_kinds.clear();
+                }
+
+                StrReader reader(text + body.begin, text + body.end);
+                parser._lexer.load(&reader, part);
+                parser.load_tokens();
+                body.func->set_body_ast(parser.parse_block_stmt(), &part->exprpool);
+            }
+        }
+        catch (...) {
+            errors[chunk] = std::current_exception();
+        }
+    });
+
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
 ClassASTRef RDParser::parse_class_decl() {
     
     if (!match_keyword(Keyword::CLASS)) {
@@ -565,8 +908,8 @@ ClassASTRef RDParser::parse_class_decl() {
     if (!match(Token::ID)) {
         throw SyntaxError("Requires an identifier");
     }
-    StringRef name = cur_token.get_name();
-    MemoryRef<ClassAST> new_class = store_ast_unconst(new ClassAST(name));
+    StringRef name = make_name(cur_token());
+    MemoryRef<ClassAST> new_class = make_ast_unconst<ClassAST>(name);
 
     if (match_op(OpName::COMP)) {
 
@@ -578,7 +921,7 @@ ClassASTRef RDParser::parse_class_decl() {
         throw SyntaxError("Invalid class definition");
     }
 
-    if (typename_cache.has_key(name.to_cstr())) {
+    if (is_type_symbol(name.symbol())) {
         throw SyntaxError("Class has already defined: " + name);
     }
 
@@ -586,6 +929,9 @@ ClassASTRef RDParser::parse_class_decl() {
         if (match_op(OpName::RCOMP)) {
             break;
         }
+        else if (match_op(OpName::SEMICOLON)) {
+            continue;
+        }
         else if (try_match(Token::ID)) {
             for (const auto& i : parse_var_decl()) {
                 new_class->add_member(i);
@@ -599,58 +945,121 @@ ClassASTRef RDParser::parse_class_decl() {
         }
     }
 
-    // add into symbol table
-    typename_cache.insert(name.to_string());
+    // a type name of later statements and parses in this context
+    _context->define_class(name.symbol());
     return new_class;
 }
 
 
-ConstantRef RDParser::parse_value(const RawValue& rawval) {
+bool RDParser::is_typename(const Token& token) {
+    if (token.has_symbol()) {
+        return is_type_symbol(token.get_symbol());
+    }
+    return is_typename(token.get_name(source()));
+}
 
-    Constant* ret;
+bool RDParser::is_typename(const StringTmpRef& name)const {
+    const ReservedWord* word = find_reserved(name.get(), name.length());
+    if (word != nullptr) {
+        return word->kind == ReservedWord::TYPE;
+    }
+    uint32_t symbol = _context->strpool.find_symbol(name.get(), name.get() + name.length());
+    if (symbol != ConstStringPool::no_symbol && is_visible_class(symbol)) {
+        return true;
+    }
+    if (_outer) {
+        uint32_t outer = _outer->strpool.find_symbol(name.get(), name.get() + name.length());
+        return outer != ConstStringPool::no_symbol && _outer->class_order(outer) < _outer_classes;
+    }
+    return false;
+}
 
-    if (rawval.type != RawValue::STRING) {
-        const char* vstr = rawval.strval.to_cstr();
-        char* end;
+bool RDParser::is_visible_class(uint32_t symbol)const {
+    size_t order = _context->class_order(symbol);
+    return order < _context->class_count() && (order < _class_limit || order >= _class_start);
+}
 
-        if (rawval.type == RawValue::BOOL) {
-            char val = rawval.strval == "true" ? 0 : 1;
-            ret = new Constant(store_type(new PrimitiveType(Type::BOOL)), (char*)&val, sizeof(val));
-        }
+bool RDParser::is_type_symbol(uint32_t symbol) {
+    // classes defined since are not memoized yet, and symbols may be reused after rewind
+    if (_typename_count != _context->class_count() || _symbol_generation != _context->strpool.generation()) {
+        _symbol_kinds.clear();
+        _typename_count = _context->class_count();
+        _symbol_generation = _context->strpool.generation();
+    }
+    if (symbol >= _symbol_kinds.size()) {
+        _symbol_kinds.resize(_context->strpool.symbol_count(), UNKNOWN);
+    }
+    SymbolKind& kind = _symbol_kinds[symbol];
+    if (kind == UNKNOWN) {
+        StringRef name = _context->strpool.get_symbol(symbol);
+        kind = is_typename(StringTmpRef(name.to_cstr(), name.to_cstr() + name.length())) ? TYPENAME : NOT_TYPENAME;
+    }
+    return kind == TYPENAME;
+}
 
-        else if (rawval.type == RawValue::CHAR) {
-            char val = vstr[0];
-            ret = new Constant(store_type(new PrimitiveType(Type::INT)), (char*)&val, sizeof(val));
-        }
+StringRef RDParser::make_name(const Token& token) {
+    if (token.has_symbol()) {
+        return _context->strpool.get_symbol(token.get_symbol());
+    }
+    StringTmpRef text = token.get_text(source());
+    return _context->strpool.intern(text.get(), text.get() + text.length());
+}
 
-        else if (rawval.type == RawValue::INT) {
-            unsigned val = strtol(vstr, &end, 10);
-            ret = new Constant(store_type(new PrimitiveType(Type::INT)), (char*)&val, sizeof(val));
-        }
+ConstantHandle RDParser::parse_value(const RawValue& rawval) {
+
+    TypeRef type;
+    const char* data;
+    size_t size;
+
+    // Values are decoded by lexer
+    switch (rawval.type)
+    {
+    case RawValue::BOOL:
+        type = _context->get_primitive_type(Type::BOOL);
+        data = (const char*)&rawval.boolval, size = sizeof(bool);
+        break;
+    case RawValue::CHAR:
+        type = _context->get_primitive_type(Type::CHAR);
+        data = &rawval.charval, size = sizeof(char);
+        break;
+    case RawValue::INT:
+        type = _context->get_primitive_type(Type::INT);
+        data = (const char*)&rawval.intval, size = sizeof(unsigned);
+        break;
+    case RawValue::FLOAT:
+        type = _context->get_primitive_type(Type::FLOAT);
+        data = (const char*)&rawval.floatval, size = sizeof(double);
+        break;
+    case RawValue::STRING:
+        type = _context->get_string_type();
+        data = rawval.strdata.get(), size = rawval.strdata.length();
+        break;
+    default:    //won't actually happen
+        return ConstantHandle();
+    }
+
+    return _context->exprpool.construct_constant(type, data, size);
+}
 
-        else if (rawval.type == RawValue::FLOAT) {
-            double val = strtod(vstr, &end);
-            ret = new Constant(store_type(new PrimitiveType(Type::FLOAT)), (char*)&val, sizeof(val));
-        }
-        else { //won't actually happen
-            ret = nullptr;
-        }
+void RDParser::load_tokens() {
+    Instrument::Scope timer(_context->instrument, "lex");
+    if (_lex_mode == STREAM) {
+        _tokens.attach(_lexer);
+    }
+    else if (_lex_mode == PARALLEL && _pool) {
+        _tokens.fill(_lexer, *_pool);
     }
     else {
-        ret = new Constant(store_type(new PointerType(store_type(new PrimitiveType(Type::CHAR)))),
-            rawval.strval.to_cstr(), rawval.strval.length());
+        _tokens.fill(_lexer);
     }
-
-    return _context->constantpool.collect(ret).to_const();
 }
 
 void RDParser::eat() {
-    cur_token = next_token;
-    next_token = _lexer.get_token();
+    _tokens.advance();
 }
 
 bool RDParser::match(Token::TokenType type) {
-    if (next_token.is_type(type)) {
+    if (next_token().is_type(type)) {
         eat();
         return true;
     }
@@ -661,7 +1070,7 @@ bool RDParser::match(Token::TokenType type) {
 
 bool RDParser::match(Token::TokenType type, bool(*unary_cond)(const Token &))
 {
-    if (next_token.is_type(type) && unary_cond(next_token)) {
+    if (next_token().is_type(type) && unary_cond(next_token())) {
         eat();
         return true;
     }
@@ -671,11 +1080,11 @@ bool RDParser::match(Token::TokenType type, bool(*unary_cond)(const Token &))
 }
 
 bool RDParser::try_match(Token::TokenType type)const {
-    return next_token.is_type(type);
+    return next_token().is_type(type);
 }
 
 bool RDParser::match_op(OpName opname) {
-    if (next_token.is_type(Token::OP) && next_token.get_operator() == opname) {
+    if (next_token().is_type(Token::OP) && next_token().get_operator() == opname) {
         eat();
         return true;
     }
@@ -686,7 +1095,7 @@ bool RDParser::match_op(OpName opname) {
 
 
 bool RDParser::match_keyword(Keyword keyword) {
-    if (next_token.is_type(Token::KEYWORD) && next_token.get_keyword() == keyword) {
+    if (next_token().is_type(Token::KEYWORD) && next_token().get_keyword() == keyword) {
         eat();
         return true;
     }
@@ -696,7 +1105,7 @@ bool RDParser::match_keyword(Keyword keyword) {
 }
 
 bool RDParser::try_match_keyword(Keyword keyword) {
-    if (next_token.is_type(Token::KEYWORD) && next_token.get_keyword() == keyword) {
+    if (next_token().is_type(Token::KEYWORD) && next_token().get_keyword() == keyword) {
         return true;
     }
     else {
@@ -715,7 +1124,7 @@ void RDParser::match_required_symbol(OpName opname, char symbol)
 
 bool RDParser::try_match_op(OpName opname)
 {
-    if (next_token.is_type(Token::OP) && next_token.get_operator() == opname) {
+    if (next_token().is_type(Token::OP) && next_token().get_operator() == opname) {
         return true;
     }
     else {
@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef CSL_RESERVED_H
+#define CSL_RESERVED_H
+
+#include <cstddef>
+
+#include "token.h"
+#include "type.h"
+
+
+/* A reserved word: keyword, word operator, boolean literal or primitive type name */
+struct ReservedWord {
+    enum Kind {
+        NONE = 0,
+        KEYWORD,    // id is Keyword
+        OP,         // id is OpName
+        BOOL,       // id is 0/1
+        TYPE        // id is Type::TypeID; still lexed as an identifier
+    };
+
+    const char* name;
+    size_t length;
+    Kind kind;
+    unsigned id;
+};
+
+
+namespace reserved {
+
+    constexpr size_t str_length(const char* s) {
+        size_t len = 0;
+        while (s[len]) {
+            len++;
+        }
+        return len;
+    }
+
+    constexpr bool str_equal(const char* a, const char* b, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (a[i] != b[i]) return false;
+        }
+        return true;
+    }
+
+    constexpr ReservedWord word(const char* name, ReservedWord::Kind kind, unsigned id) {
+        return { name, str_length(name), kind, id };
+    }
+
+    constexpr ReservedWord word_list[] = {
+        word("if", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::IF)),
+        word("else", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::ELSE)),
+        word("while", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::WHILE)),
+        word("for", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::FOR)),
+        word("break", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::BREAK)),
+        word("continue", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::CONTINUE)),
+        word("return", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::RETURN)),
+        word("fn", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::FN)),
+        word("class", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::CLASS)),
+        word("import", ReservedWord::KEYWORD, static_cast<unsigned>(Keyword::IMPORT)),
+        word("and", ReservedWord::OP, static_cast<unsigned>(OpName::AND)),
+        word("or", ReservedWord::OP, static_cast<unsigned>(OpName::OR)),
+        word("xor", ReservedWord::OP, static_cast<unsigned>(OpName::XOR)),
+        word("not", ReservedWord::OP, static_cast<unsigned>(OpName::NOT)),
+        word("true", ReservedWord::BOOL, 1),
+        word("false", ReservedWord::BOOL, 0),
+        word("void", ReservedWord::TYPE, Type::VOID),
+        word("bool", ReservedWord::TYPE, Type::BOOL),
+        word("char", ReservedWord::TYPE, Type::CHAR),
+        word("int", ReservedWord::TYPE, Type::INT),
+        word("float", ReservedWord::TYPE, Type::FLOAT)
+    };
+
+    constexpr size_t word_count = sizeof(word_list) / sizeof(ReservedWord);
+    constexpr size_t table_size = 64;
+    constexpr size_t max_length = 8;
+
+    /* Perfect for word_list; checked by static_assert below */
+    constexpr size_t hash(const char* s, size_t len) {
+        return (static_cast<unsigned char>(s[0]) + static_cast<unsigned char>(s[len - 1]) + 11 * len) & (table_size - 1);
+    }
+
+    /* Open slots hold 0, otherwise index + 1 into word_list */
+    struct Table {
+        unsigned char slot[table_size];
+        size_t collisions;
+
+        constexpr Table() : slot(), collisions(0) {
+            for (size_t i = 0; i < word_count; i++) {
+                size_t h = hash(word_list[i].name, word_list[i].length);
+                if (slot[h] != 0) {
+                    collisions++;
+                }
+                slot[h] = static_cast<unsigned char>(i + 1);
+            }
+        }
+    };
+
+    constexpr Table table;
+
+    static_assert(table.collisions == 0, "Reserved word hash is not perfect");
+}
+
+
+/* Returns the reserved word [str, str + len), or nullptr for a plain identifier */
+constexpr const ReservedWord* find_reserved(const char* str, size_t len) {
+    if (len < 2 || len > reserved::max_length) {
+        return nullptr;
+    }
+    unsigned char slot = reserved::table.slot[reserved::hash(str, len)];
+    if (slot == 0) {
+        return nullptr;
+    }
+    const ReservedWord& w = reserved::word_list[slot - 1];
+    return w.length == len && reserved::str_equal(w.name, str, len) ? &w : nullptr;
+}
+
+static_assert(find_reserved("while", 5)->id == static_cast<unsigned>(Keyword::WHILE), "Reserved word lookup");
+static_assert(find_reserved("whale", 5) == nullptr, "Reserved word lookup");
+
+#endif
@@ -0,0 +1,297 @@
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "scanner.h"
+
+
+const Scanner::CharTable Scanner::char_class;
+std::atomic<const ScanKernels*> Scanner::kernels(&ScanKernels::scalar);
+
+// Upgrade after CPU detection; scalar kernels are usable before that
+static const bool kernels_detected = (Scanner::set_kernel_level(ScanKernels::detect()), true);
+
+
+size_t Scanner::skip_ws(const char* begin, const char* end) {
+    return current_kernels().skip_ws(begin, end) - begin;
+}
+
+Lexeme Scanner::scan(const char* begin, const char* end) {
+
+    Lexeme lexeme = { Lexeme::NONE, 0, OpName::ADD };
+
+    if (begin >= end) {
+        return lexeme;
+    }
+
+    switch (char_class.cls[static_cast<unsigned char>(*begin)])
+    {
+    case C_QUOTE: {
+        size_t len = scan_quoted(begin, end);
+        if (len == 0) {
+            break;
+        }
+        lexeme.length = len;
+        if (*begin == '"') {
+            lexeme.kind = Lexeme::STRING;
+        }
+        else {
+            // '\\?.' is a char; '.' never matches a line terminator
+            bool single = (len == 3 && begin[1] != '\n' && begin[1] != '\r') ||
+                (len == 4 && begin[1] == '\\');
+            lexeme.kind = single ? Lexeme::CHAR : Lexeme::STRING;
+        }
+        break;
+    }
+    case C_OP: {
+        size_t len = scan_op(begin, end, lexeme.op);
+        if (len > 0) {
+            lexeme.kind = Lexeme::OP;
+            lexeme.length = len;
+        }
+        break;
+    }
+    case C_DIGIT: {
+        bool is_float;
+        lexeme.length = scan_number(begin, end, is_float);
+        lexeme.kind = is_float ? Lexeme::FLOAT : Lexeme::INT;
+        break;
+    }
+    case C_ALPHA: {
+        // "e5", "e-5" are floats without integer part
+        if (*begin == 'e') {
+            bool is_float;
+            size_t len = scan_number(begin, end, is_float);
+            if (is_float) {
+                lexeme.kind = Lexeme::FLOAT;
+                lexeme.length = len;
+                break;
+            }
+        }
+        lexeme.kind = Lexeme::ID;
+        lexeme.length = current_kernels().skip_ident(begin + 1, end) - begin;
+        break;
+    }
+    default:
+        break;
+    }
+
+    return lexeme;
+}
+
+// '(\\.|[^'\\])*' or "(\\.|[^"\\])*"; Returns 0 if not terminated
+size_t Scanner::scan_quoted(const char* begin, const char* end) {
+    char quote = *begin;
+    const char* p = begin + 1;
+
+    while (p < end) {
+        p = current_kernels().find_quote(p, end, quote);
+        if (p >= end) {
+            break;
+        }
+        else if (*p == quote) {
+            return p + 1 - begin;
+        }
+        else if (p + 1 >= end || p[1] == '\n' || p[1] == '\r') {    // '\\'
+            return 0;
+        }
+        p += 2;
+    }
+    return 0;
+}
+
+// \d*(\.|e[+\-]?)\d+ for float, otherwise \d+
+size_t Scanner::scan_number(const char* begin, const char* end, bool& is_float) {
+    const char* p = begin;
+    while (p < end && is_class(*p, C_DIGIT)) {
+        ++p;
+    }
+    size_t int_len = p - begin;
+
+    const char* q = p;
+    if (q < end && *q == '.') {
+        ++q;
+    }
+    else if (q < end && *q == 'e') {
+        ++q;
+        if (q + 1 < end && (*q == '+' || *q == '-') && is_class(q[1], C_DIGIT)) {
+            ++q;
+        }
+    }
+
+    if (q > p && q < end && is_class(*q, C_DIGIT)) {
+        while (q < end && is_class(*q, C_DIGIT)) {
+            ++q;
+        }
+        is_float = true;
+        return q - begin;
+    }
+    else {
+        is_float = false;
+        return int_len;
+    }
+}
+
+size_t Scanner::scan_op(const char* begin, const char* end, OpName& op) {
+
+    char next = begin + 1 < end ? begin[1] : '\0';
+
+#define SCAN_OP_ASN(c, name) case c: \
+        if (next == '=') { op = OpName::name##ASN; return 2; } \
+        op = OpName::name; return 1;
+
+    switch (*begin)
+    {
+    case '+':
+        if (next == '+') { op = OpName::INC; return 2; }
+        if (next == '=') { op = OpName::ADDASN; return 2; }
+        op = OpName::ADD; return 1;
+    case '-':
+        if (next == '-') { op = OpName::DEC; return 2; }
+        if (next == '>') { op = OpName::ARROW; return 2; }
+        if (next == '=') { op = OpName::SUBASN; return 2; }
+        op = OpName::SUB; return 1;
+    SCAN_OP_ASN('*', MUL)
+    SCAN_OP_ASN('/', DIV)
+    SCAN_OP_ASN('%', MOD)
+    SCAN_OP_ASN('^', POW)
+    case '!':
+        if (next == '=') { op = OpName::NE; return 2; }
+        return 0;
+    case '=':
+        if (next == '=') { op = OpName::EQ; return 2; }
+        op = OpName::ASN; return 1;
+    case '<':
+        if (next == '=') { op = OpName::LE; return 2; }
+        op = OpName::LT; return 1;
+    case '>':
+        if (next == '=') { op = OpName::GE; return 2; }
+        op = OpName::GT; return 1;
+    case '.': op = OpName::MBER; return 1;
+    case ',': op = OpName::COMMA; return 1;
+    case ':': op = OpName::COLON; return 1;
+    case ';': op = OpName::SEMICOLON; return 1;
+    case '{': op = OpName::COMP; return 1;
+    case '}': op = OpName::RCOMP; return 1;
+    case '(': op = OpName::BRAC; return 1;
+    case ')': op = OpName::RBRAC; return 1;
+    case '[': op = OpName::INDEX; return 1;
+    case ']': op = OpName::RINDEX; return 1;
+    default:
+        return 0;
+    }
+
+#undef SCAN_OP_ASN
+}
+
+bool Scanner::parse_int(const char* begin, const char* end, unsigned& value) {
+    uint64_t val = 0;
+    for (const char* p = begin; p < end; p++) {
+        val = val * 10 + (*p - '0');
+        if (val > UINT32_MAX) {
+            return false;
+        }
+    }
+    value = static_cast<unsigned>(val);
+    return true;
+}
+
+double Scanner::parse_float(const char* begin, const char* end) {
+
+    // Exact for up to 19 significant digits and small exponents; both operands
+    // of the final multiply/divide are exact, so it is rounded once.
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool fraction = false;
+    const char* p = begin;
+
+    for (; p < end && *p != 'e'; p++) {
+        if (*p == '.') {
+            fraction = true;
+            continue;
+        }
+        if (mantissa != 0 || *p != '0') {
+            if (++digits > 19) {
+                break;
+            }
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+        if (fraction) {
+            exp10--;
+        }
+    }
+
+    if (digits <= 19 && p < end) {   // 'e'
+        bool neg = ++p < end && *p == '-';
+        if (p < end && (*p == '+' || *p == '-')) {
+            ++p;
+        }
+        int e = 0;
+        for (; p < end && e < 10000; p++) {
+            e = e * 10 + (*p - '0');
+        }
+        exp10 += neg ? -e : e;
+    }
+
+    if (digits <= 19 && p >= end) {
+        if (mantissa == 0) {
+            return 0.0;
+        }
+        if (mantissa <= (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+            double m = static_cast<double>(mantissa);
+            return exp10 < 0 ? m / pow10[-exp10] : m * pow10[exp10];
+        }
+    }
+
+    // Slow path; lexeme is not null-terminated
+    char buf[64];
+    size_t len = end - begin;
+    if (len < sizeof(buf)) {
+        memcpy(buf, begin, len);
+        buf[len] = '\0';
+        return strtod(buf, nullptr);
+    }
+    return strtod(std::string(begin, end).c_str(), nullptr);
+}
+
+size_t Scanner::decode_escapes(const char* begin, const char* end, char* out) {
+
+    char* q = out;
+    for (const char* p = begin; p < end; p++) {
+        if (*p != '\\' || p + 1 >= end) {
+            *q++ = *p;
+            continue;
+        }
+        switch (*++p)
+        {
+        case 'n': *q++ = '\n'; break;
+        case 't': *q++ = '\t'; break;
+        case 'r': *q++ = '\r'; break;
+        case '0': *q++ = '\0'; break;
+        case 'a': *q++ = '\a'; break;
+        case 'b': *q++ = '\b'; break;
+        case 'f': *q++ = '\f'; break;
+        case 'v': *q++ = '\v'; break;
+        case 'x': {
+            // \x with one or two hex digits
+            int val = 0, n = 0;
+            for (; n < 2 && p + 1 < end && isxdigit(static_cast<unsigned char>(p[1])); n++, p++) {
+                char c = p[1];
+                val = val * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+            }
+            *q++ = n > 0 ? static_cast<char>(val) : 'x';
+            break;
+        }
+        default: *q++ = *p; break;      // \\ \' \" and unknown escapes
+        }
+    }
+    return q - out;
+}
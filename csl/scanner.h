@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef CSL_SCANNER_H
+#define CSL_SCANNER_H
+
+#include <atomic>
+#include <cstddef>
+
+#include "token.h"
+
+
+/* A single lexeme found by the Scanner */
+struct Lexeme {
+    enum Kind {
+        NONE = 0,   // Unrecognized
+        CHAR,       // '...' holding a single (escaped) character
+        STRING,     // "..." or '...' holding other content
+        OP,         // Operator and other symbols
+        FLOAT,
+        INT,
+        ID          // Identifier; keywords are resolved by lexer
+    };
+
+    Kind kind;
+    size_t length;      // bytes consumed, including quotes
+    OpName op;          // only for kind == OP
+};
+
+
+/* Kernels for long runs, each returns the first byte that stops the run (or end) */
+struct ScanKernels {
+
+    enum Level {
+        SCALAR = 0,
+        SSE2,
+        AVX2
+    };
+
+    Level level;
+    const char* (*skip_ws)(const char* begin, const char* end);         // [ \t\n]*
+    const char* (*skip_ident)(const char* begin, const char* end);      // [_0-9a-zA-Z]*
+    const char* (*find_quote)(const char* begin, const char* end, char quote);   // quote or '\\'
+
+    /* Best level supported by this CPU */
+    static Level detect();
+
+    static const char* skip_ws_scalar(const char* begin, const char* end);
+    static const char* skip_ident_scalar(const char* begin, const char* end);
+    static const char* find_quote_scalar(const char* begin, const char* end, char quote);
+
+    /* Kernels of level; falls back to a lower level if not supported */
+    static const ScanKernels& get(Level level);
+
+    static const ScanKernels scalar;
+};
+
+
+/* Table-driven scanner. Classifies a lexeme from its first byte and
+   scans it in one forward pass over [begin, end). */
+class Scanner {
+public:
+
+    /* Character classes */
+    enum CharClass : unsigned char {
+        C_NONE = 0,
+        C_WS = 0x01,        // [ \t\n]
+        C_DIGIT = 0x02,     // [0-9]
+        C_ALPHA = 0x04,     // [_a-zA-Z]
+        C_OP = 0x08,        // first byte of an operator
+        C_QUOTE = 0x10      // ' or "
+    };
+
+    /* 256-entry class table, built at compile time */
+    struct CharTable {
+        unsigned char cls[256];
+
+        constexpr CharTable() : cls() {
+            for (int c = 0; c < 256; c++) {
+                cls[c] = (c == ' ' || c == '\t' || c == '\n') ? C_WS :
+                    (c >= '0' && c <= '9') ? C_DIGIT :
+                    (c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) ? C_ALPHA :
+                    (c == '\'' || c == '"') ? C_QUOTE :
+                    (c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '^' || 
+                     c == '=' || c == '!' || c == '<' || c == '>' || c == '.' || c == ',' || 
+                     c == ':' || c == ';' || c == '{' || c == '}' || c == '(' || c == ')' || 
+                     c == '[' || c == ']') ? C_OP : C_NONE;
+            }
+        }
+    };
+
+    static bool is_class(char c, unsigned char cls) {
+        return (char_class.cls[static_cast<unsigned char>(c)] & cls) != 0;
+    }
+
+    /* Bytes after a lexeme that may decide its kind or length ("1.5", "1e+5") */
+    static const size_t max_lookahead = 3;
+
+    /* Returns number of whitespace bytes at begin */
+    static size_t skip_ws(const char* begin, const char* end);
+
+    /* Scan the lexeme starting at begin. Returns kind NONE if unrecognized */
+    static Lexeme scan(const char* begin, const char* end);
+
+    /* Decimal integer of [begin, end); Returns false on overflow */
+    static bool parse_int(const char* begin, const char* end, unsigned& value);
+
+    /* Float lexeme of [begin, end), rounded as strtod */
+    static double parse_float(const char* begin, const char* end);
+
+    /* Decode escape sequences of quoted text [begin, end) into out, which holds 
+       at least end - begin bytes. Returns bytes written */
+    static size_t decode_escapes(const char* begin, const char* end, char* out);
+
+    /* Select kernels (detected at startup); Scans running on other threads
+       switch at their next kernel call */
+    static void set_kernel_level(ScanKernels::Level level) {
+        kernels.store(&ScanKernels::get(level), std::memory_order_relaxed);
+    }
+
+    static ScanKernels::Level get_kernel_level() {
+        return kernels.load(std::memory_order_relaxed)->level;
+    }
+
+private:
+
+    static size_t scan_quoted(const char* begin, const char* end);
+
+    static size_t scan_number(const char* begin, const char* end, bool& is_float);
+
+    static size_t scan_op(const char* begin, const char* end, OpName& op);
+
+    static const CharTable char_class;
+    static const ScanKernels& current_kernels() {
+        return *kernels.load(std::memory_order_relaxed);
+    }
+
+    static std::atomic<const ScanKernels*> kernels;
+};
+
+#endif
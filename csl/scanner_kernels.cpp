@@ -0,0 +1,219 @@
+#include "scanner.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CSL_SCAN_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CSL_TARGET_AVX2
+#else
+#define CSL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+/* Scalar kernels */
+
+const char* ScanKernels::skip_ws_scalar(const char* begin, const char* end) {
+    while (begin < end && Scanner::is_class(*begin, Scanner::C_WS)) {
+        ++begin;
+    }
+    return begin;
+}
+
+const char* ScanKernels::skip_ident_scalar(const char* begin, const char* end) {
+    while (begin < end && Scanner::is_class(*begin, Scanner::C_ALPHA | Scanner::C_DIGIT)) {
+        ++begin;
+    }
+    return begin;
+}
+
+const char* ScanKernels::find_quote_scalar(const char* begin, const char* end, char quote) {
+    while (begin < end && *begin != quote && *begin != '\\') {
+        ++begin;
+    }
+    return begin;
+}
+
+
+#ifdef CSL_SCAN_X86
+
+static unsigned first_bit(unsigned mask) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/* SSE2 kernels; 16 bytes per step, tail goes to scalar */
+
+static __m128i ws_mask_sse2(__m128i v) {
+    return _mm_or_si128(_mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+
+// lo <= v <= hi for ASCII bounds; bytes >= 0x80 are negative and never match
+static __m128i in_range_sse2(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+static __m128i ident_mask_sse2(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));   // fold case
+    return _mm_or_si128(_mm_or_si128(
+        in_range_sse2(lower, 'a', 'z'),
+        in_range_sse2(v, '0', '9')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+static const char* skip_ws_sse2(const char* begin, const char* end) {
+    for (; begin + 16 <= end; begin += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        unsigned mask = ~_mm_movemask_epi8(ws_mask_sse2(v)) & 0xFFFF;
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+    }
+    return ScanKernels::skip_ws_scalar(begin, end);
+}
+
+static const char* skip_ident_sse2(const char* begin, const char* end) {
+    for (; begin + 16 <= end; begin += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        unsigned mask = ~_mm_movemask_epi8(ident_mask_sse2(v)) & 0xFFFF;
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+    }
+    return ScanKernels::skip_ident_scalar(begin, end);
+}
+
+static const char* find_quote_sse2(const char* begin, const char* end, char quote) {
+    const __m128i q = _mm_set1_epi8(quote);
+    const __m128i bs = _mm_set1_epi8('\\');
+    for (; begin + 16 <= end; begin += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, bs)));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+    }
+    return ScanKernels::find_quote_scalar(begin, end, quote);
+}
+
+/* AVX2 kernels; 32 bytes per step, tail goes to SSE2 */
+
+CSL_TARGET_AVX2 static __m256i in_range_avx2(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+CSL_TARGET_AVX2 static const char* skip_ws_avx2(const char* begin, const char* end) {
+    for (; begin + 32 <= end; begin += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(ws));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+    }
+    return skip_ws_sse2(begin, end);
+}
+
+CSL_TARGET_AVX2 static const char* skip_ident_avx2(const char* begin, const char* end) {
+    for (; begin + 32 <= end; begin += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i id = _mm256_or_si256(_mm256_or_si256(
+            in_range_avx2(lower, 'a', 'z'),
+            in_range_avx2(v, '0', '9')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(id));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+    }
+    return skip_ident_sse2(begin, end);
+}
+
+CSL_TARGET_AVX2 static const char* find_quote_avx2(const char* begin, const char* end, char quote) {
+    const __m256i q = _mm256_set1_epi8(quote);
+    const __m256i bs = _mm256_set1_epi8('\\');
+    for (; begin + 32 <= end; begin += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, q), _mm256_cmpeq_epi8(v, bs))));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+    }
+    return find_quote_sse2(begin, end, quote);
+}
+
+#endif // CSL_SCAN_X86
+
+
+ScanKernels::Level ScanKernels::detect() {
+#if !defined(CSL_SCAN_X86)
+    return SCALAR;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool avx_os = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+        (_xgetbv(0) & 0x6) == 0x6;     // OS saves xmm/ymm state
+
+    if (avx_os && max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return AVX2;
+        }
+    }
+    return sse2 ? SSE2 : SCALAR;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return AVX2;
+    }
+    return __builtin_cpu_supports("sse2") ? SSE2 : SCALAR;
+#endif
+}
+
+const ScanKernels ScanKernels::scalar = { SCALAR, skip_ws_scalar, skip_ident_scalar, find_quote_scalar };
+
+const ScanKernels& ScanKernels::get(Level level) {
+#ifdef CSL_SCAN_X86
+    static const ScanKernels sse2 = { SSE2, skip_ws_sse2, skip_ident_sse2, find_quote_sse2 };
+    static const ScanKernels avx2 = { AVX2, skip_ws_avx2, skip_ident_avx2, find_quote_avx2 };
+#endif
+
+    if (level > SCALAR) {
+        static const Level best = detect();
+        if (level > best) {
+            level = best;
+        }
+    }
+
+    switch (level)
+    {
+#ifdef CSL_SCAN_X86
+    case AVX2:
+        return avx2;
+    case SSE2:
+        return sse2;
+#endif
+    default:
+        return scalar;
+    }
+}
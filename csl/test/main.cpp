@@ -1,12 +1,54 @@
-#pragma once
-
+#include "test_lexer.h"
 #include "test_parser.h"
+#include "test_ioutil.h"
+#include "test_mempool.h"
+#include "test_strmap.h"
 
 int main() {
+
+    LexerTest lexer_test;
+    lexer_test.test_token();
+    lexer_test.test_lexer();
+    lexer_test.test_scanner();
+    lexer_test.test_reserved();
+    lexer_test.test_kernels();
+    lexer_test.test_literals();
+    lexer_test.test_token_stream();
+    lexer_test.test_stream_reader();
+    lexer_test.test_parallel_lexer();
     
     ParserTest test;
     test.test_parse_expr();
+    test.test_precedence();
     test.test_parse_decl();
+    test.test_lex_mode();
+    test.test_parse_stream();
+    test.test_parse_file();
+    test.test_import();
+    test.test_ast_cache();
+    test.test_lazy_bodies();
+    test.test_parallel_bodies();
+    test.test_ast_pool();
+    test.test_context_rewind();
+    test.test_instrument();
+    test.test_class_scope();
+    test.test_parse_all();
+
+    IOUtilTest ioutil_test;
+    ioutil_test.test_line_index();
+
+    StrMapTest strmap_test;
+    strmap_test.test_strtmpref();
+    strmap_test.test_strmap();
+    strmap_test.test_strset();
+
+    MempoolTest mempool_test;
+    mempool_test.test_pool();
+    mempool_test.test_arena();
+    mempool_test.test_strpool();
+    mempool_test.test_intern();
+    mempool_test.test_checkpoint();
+    mempool_test.test_handle();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include <cassert>
+#include <sstream>
+#include "../util/ioutil.h"
+#include "../logger.h"
+
+class IOUtilTest {
+public:
+
+    void test_line_index() {
+
+        std::string text = "first\n\nthird line is longer than sixteen bytes\nx\n" + std::string(40, 'y') + "\nlast";
+        StrReader reader(text);
+
+        const LineIndex& lines = reader.lines();
+        assert(lines.line_count() == 6);
+        assert(lines.line_of(0) == 0 && lines.line_of(5) == 0 && lines.line_of(6) == 1);
+        assert(lines.line_of(text.size()) == 5);
+        assert(lines.line_begin(2) == 7 && text[lines.line_end(2)] == '\n');
+        assert(lines.line_end(5) == text.size());
+
+        // against a linear scan
+        size_t line = 0, col = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            assert(lines.line_of(i) == line && lines.column_of(i) == col);
+            if (text[i] == '\n') {
+                line++;
+                col = 0;
+            }
+            else {
+                col++;
+            }
+        }
+
+        reader.forward(text.find("line"));
+        assert(reader.lineno() == 2 && reader.colno() == 6);
+        assert(std::string(reader.cur_line_begin(), reader.cur_line_end()) == "third line is longer than sixteen bytes");
+
+        std::ostringstream os;
+        output_error(os, SyntaxError("Unknown"), &reader, text.find("x\n"));
+        assert(os.str() == "Syntax Error: Unknown\nAt line 4, pos 0\nx\n^\n");
+    }
+};
@@ -1,28 +1,30 @@
 #include "../lexer.h"
+#include "../reserved.h"
+#include "../tokenstream.h"
+#include "../util/threadpool.h"
+#include <sstream>
+#include <vector>
 
 class LexerTest {
 public:
 
     void test_token() {
 
-        ConstStringPool pool;
+        std::string source = "Hello! 123";
         std::string a = "Hello!";
         std::string val = "123";
 
         Keyword kwd = Keyword::BREAK;
         OpName op = OpName::ADD;
 
-        auto strref = pool.assign(a);
-        auto valstrref = pool.assign(val);
-
-        Token token_id(Token::ID, strref);
-        Token token_val(Token::VALUE);
-        token_val.set_value(RawValue::INT, valstrref);
+        Token token_id(Token::ID, 0, a.length());
+        Token token_val(Token::VALUE, 7, val.length());
+        token_val.set_value(RawValue::INT);
         Token token_kwd(Token::KEYWORD, static_cast<unsigned>(kwd));
         Token token_op(Token::OP, static_cast<unsigned>(op));
 
-        assert(token_id.get_name() == a);
-        assert(token_val.get_value().strval == val);
+        assert(token_id.get_name(source.data()) == a);
+        assert(token_val.get_value(source.data()).strval == val);
         assert(token_kwd.get_keyword() == kwd);
         assert(token_op.get_operator() == op);
     }
@@ -40,15 +42,225 @@ public:
             token_list.push_back(lexer.get_token());
         }
 
-        assert(token_list[0].get_name() == "x_2");
-        auto rv = token_list[1].get_value();
+        const char* src = reader.begin_ptr();
+        assert(token_list[0].get_name(src) == "x_2");
+        auto rv = token_list[1].get_value(src);
         assert(rv.type == RawValue::FLOAT && rv.strval == "2e-7");
         assert(token_list[2].get_operator() == OpName::ADD);
         assert(token_list[3].get_operator() == OpName::SUBASN);
         assert(token_list[4].get_operator() == OpName::INC);
-        assert(token_list[5].get_value().type == RawValue::CHAR && token_list[5].get_value().strval == "\t");
-        assert(token_list[6].get_value().type == RawValue::STRING && token_list[6].get_value().strval == "1+x\\\"");
+        assert(token_list[5].get_value(src).type == RawValue::CHAR && token_list[5].get_value(src).strval == "\t");
+        assert(token_list[6].get_value(src).type == RawValue::STRING && token_list[6].get_value(src).strval == "1+x\\\"");
         assert(token_list[7].get_type() == Token::EOF);
     }
 
-};
\ No newline at end of file
+    void test_scanner() {
+
+        auto scan = [](const char* s) { return Scanner::scan(s, s + strlen(s)); };
+
+        assert(scan("e5+x").kind == Lexeme::FLOAT && scan("e5+x").length == 2);
+        assert(scan("e+x").kind == Lexeme::ID && scan("e+x").length == 1);
+        assert(scan("12.5e3").kind == Lexeme::FLOAT && scan("12.5e3").length == 4);
+        assert(scan("12.x").kind == Lexeme::INT && scan("12.x").length == 2);
+        assert(scan("->").op == OpName::ARROW && scan("-=").op == OpName::SUBASN);
+        assert(scan("==").op == OpName::EQ && scan("!=").length == 2);
+        assert(scan("!a").kind == Lexeme::NONE);
+        assert(scan("'\\n'").kind == Lexeme::CHAR);
+        assert(scan("'ab'").kind == Lexeme::STRING);
+        assert(scan("\"abc").kind == Lexeme::NONE);
+        assert(Scanner::skip_ws(" \t\nx", " \t\nx" + 4) == 3);
+    }
+
+    void test_reserved() {
+
+        assert(find_reserved("while", 5)->kind == ReservedWord::KEYWORD);
+        assert(find_reserved("xor", 3)->id == static_cast<unsigned>(OpName::XOR));
+        assert(find_reserved("float", 5)->id == Type::FLOAT);
+        assert(find_reserved("floats", 6) == nullptr && find_reserved("i", 1) == nullptr);
+
+        Context context;
+        StrReader reader("while whilex or int true");
+        Lexer lexer;
+        lexer.load(&reader, &context);
+
+        assert(lexer.get_token().get_keyword() == Keyword::WHILE);
+        Token id = lexer.get_token();
+        assert(id.get_name(reader.begin_ptr()) == "whilex");
+        assert(context.strpool.get_symbol(id.get_symbol()) == "whilex");
+        assert(lexer.get_token().get_operator() == OpName::OR);
+        assert(lexer.get_token().get_name(reader.begin_ptr()) == "int");
+        assert(lexer.get_token().get_value(reader.begin_ptr()).type == RawValue::BOOL);
+    }
+
+    void test_kernels() {
+
+        std::string src = std::string(40, ' ') + "\t\nabc_DEF_0123456789_abcdefghijklmnopqrstuvwxyz+" +
+            std::string(50, 'x') + "\\\"" + std::string(70, 'y') + "\"";
+        const char* begin = src.data();
+        const char* end = begin + src.size();
+
+        ScanKernels scalar = ScanKernels::get(ScanKernels::SCALAR);
+        for (int level = ScanKernels::SSE2; level <= ScanKernels::AVX2; level++) {
+            ScanKernels k = ScanKernels::get(static_cast<ScanKernels::Level>(level));
+            for (const char* p = begin; p <= end; p++) {
+                assert(k.skip_ws(p, end) == scalar.skip_ws(p, end));
+                assert(k.skip_ident(p, end) == scalar.skip_ident(p, end));
+                assert(k.find_quote(p, end, '"') == scalar.find_quote(p, end, '"'));
+            }
+        }
+    }
+
+    void test_literals() {
+
+        Context context;
+        StrReader reader("4294967295 0.125 1e-3 '\\n' '\\'' \"a\\tb\\x41\\\"\" \"plain\" false 4294967296");
+        Lexer lexer;
+        lexer.load(&reader, &context);
+        const char* src = reader.begin_ptr();
+
+        assert(lexer.get_token().get_value(src).intval == 4294967295u);
+        assert(lexer.get_token().get_value(src).floatval == 0.125);
+        assert(lexer.get_token().get_value(src).floatval == 1e-3);
+        assert(lexer.get_token().get_value(src).charval == '\n');
+        assert(lexer.get_token().get_value(src).charval == '\'');
+
+        RawValue escaped = lexer.get_token().get_value(src);
+        assert(escaped.strval == "a\\tb\\x41\\\"" && escaped.strdata == "a\tbA\"");
+        RawValue plain = lexer.get_token().get_value(src);
+        assert(plain.strdata.get() == plain.strval.get() && plain.strdata == "plain");
+
+        assert(lexer.get_token().get_value(src).boolval == false);
+
+        bool thrown = false;
+        try {
+            lexer.get_token();
+        }
+        catch (const SyntaxError&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    void test_token_stream() {
+
+        Context context;
+        std::string src = "a = b + 1; c";
+
+        StrReader bulk_reader(src), stream_reader(src);
+        Lexer bulk_lexer, stream_lexer;
+        bulk_lexer.load(&bulk_reader, &context);
+        stream_lexer.load(&stream_reader, &context);
+
+        TokenStream bulk, stream;
+        bulk.fill(bulk_lexer);
+        stream.attach(stream_lexer);
+
+        assert(bulk.size() == 8);
+        assert(stream.look_ahead(3).get_operator() == OpName::ADD);
+        assert(bulk.look_ahead(10).is_type(Token::EOF));
+
+        size_t mark = bulk.mark();
+        bulk.advance();
+        bulk.advance();
+        assert(bulk.prev().get_operator() == OpName::ASN);
+        bulk.rewind(mark);
+        assert(bulk.peek().get_name(bulk_reader.begin_ptr()) == "a");
+
+        for (int i = 0; i < 8; i++) {
+            assert(bulk.peek().get_type() == stream.peek().get_type());
+            bulk.advance();
+            stream.advance();
+        }
+        assert(bulk.prev().is_type(Token::EOF) && stream.peek().is_type(Token::EOF));
+    }
+
+    void test_stream_reader() {
+
+        std::string src;
+        for (int i = 0; i < 500; i++) {
+            src += "x_" + std::to_string(i) + "=1.5e+3+ 12 \"long string literal \\\" crossing windows\" 'c'!=e5;\n";
+        }
+
+        Context context;
+        StrReader reader(src);
+        std::istringstream is(src);
+        StreamReader stream_reader(is, 5);
+        Lexer lexer, stream_lexer;
+        lexer.load(&reader, &context);
+        stream_lexer.load(&stream_reader, &context);
+
+        TokenStream bulk, stream;
+        bulk.fill(lexer);
+        stream.attach(stream_lexer);
+
+        size_t mark = 0;
+        for (size_t i = 0; i < bulk.size(); i++) {
+            const Token& t = bulk.peek();
+            const Token& u = stream.peek();
+            assert(t.get_type() == u.get_type());
+            assert(t.get_text(reader.begin_ptr()) == u.get_text(stream_reader.begin_ptr()));
+            if (t.is_type(Token::VALUE)) {
+                RawValue a = t.get_value(reader.begin_ptr()), b = u.get_value(stream_reader.begin_ptr());
+                assert(a.type == b.type && a.strdata == b.strdata && a.intval == b.intval);
+            }
+            if (i == 300) {
+                mark = stream.mark();
+            }
+            bulk.advance();
+            stream.advance();
+        }
+        assert(stream.peek().is_type(Token::EOF));
+
+        // history is bounded, and so is the window
+        assert(stream.mark() - mark > TokenStream::history);
+        assert(stream_reader.end_ptr() - stream_reader.begin_ptr() < 4096);
+        assert(stream_reader.base() > src.size() - 4096);
+    }
+
+    void test_parallel_lexer() {
+
+        // literals with whitespace and newlines make many chunk bounds unsafe
+        std::string src;
+        for (int i = 0; i < 200; i++) {
+            src += "x_" + std::to_string(i) + " = {1, 2.5e-3, 'c'};\n s = \"a b\n\n c \\\" d\" + 'x y z';\n";
+        }
+
+        Context context;
+        ThreadPool pool(3);
+
+        auto lex = [&](const std::string& s, bool parallel, size_t min_chunk) {
+            StrReader reader(s);
+            Lexer lexer;
+            lexer.load(&reader, &context);
+            std::vector<Token> tokens;
+            parallel ? lexer.tokenize(tokens, pool, min_chunk) : lexer.tokenize(tokens);
+            return tokens;
+        };
+
+        std::vector<Token> seq = lex(src, false, 0);
+        for (size_t min_chunk : { 1, 7, 64, 1000, 100000 }) {
+            std::vector<Token> par = lex(src, true, min_chunk);
+            assert(par.size() == seq.size());
+            for (size_t i = 0; i < seq.size(); i++) {
+                assert(par[i].get_type() == seq[i].get_type());
+                assert(par[i].get_offset() == seq[i].get_offset() && par[i].get_length() == seq[i].get_length());
+                if (seq[i].is_type(Token::ID)) {
+                    assert(par[i].get_symbol() == seq[i].get_symbol());
+                }
+                if (seq[i].is_type(Token::VALUE) && seq[i].get_value_type() == RawValue::STRING) {
+                    assert(par[i].get_value(src.data()).strdata == seq[i].get_value(src.data()).strdata);
+                }
+            }
+        }
+
+        bool thrown = false;
+        try {
+            lex(src + " ? " + src, true, 16);
+        }
+        catch (const SyntaxError&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+};
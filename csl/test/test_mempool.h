@@ -1,6 +1,10 @@
 
 #include "../util/memory.h"
+#include "../util/handle.h"
+#include "../ast.h"
+#include <array>
 #include <cassert>
+#include <vector>
 
 class MempoolTest {
 public:
@@ -27,6 +31,40 @@ public:
         assert(ptrd.use_count() == 3);
     }
 
+    void test_arena() {
+
+        struct Tracked {
+            int* destroyed;
+            double value;
+
+            explicit Tracked(int* destroyed) : destroyed(destroyed), value(0.5) {
+
+            }
+
+            ~Tracked() {
+                (*destroyed)++;
+            }
+        };
+
+        int destroyed = 0;
+        {
+            MemoryPool pool(256);
+            std::vector<MemoryRef<Tracked>> refs;
+            for (int i = 0; i < 100; i++) {
+                refs.push_back(pool.construct<Tracked>(&destroyed));
+                pool.construct<char>('a');     // unaligns the next allocation
+                assert(reinterpret_cast<uintptr_t>(refs.back().get()) % alignof(Tracked) == 0);
+            }
+            auto big = pool.construct<std::array<char, 1000>>();     // larger than a chunk
+            big->fill('x');
+
+            assert(refs[0]->value == 0.5 && refs[0].use_count() == 1);
+            assert(pool.size() == 201 && pool.capacity() > 1000);
+            assert(destroyed == 0);
+        }
+        assert(destroyed == 100);
+    }
+
     void test_strpool() {
         ConstStringPool pool;
 
@@ -43,4 +81,109 @@ public:
         assert(ptrb.use_count() == 2);
         assert(ptrb.to_string() == a);
     }
+
+    void test_intern() {
+        ConstStringPool pool;
+
+        std::string text = "count count_2 count";
+        const char* p = text.data();
+
+        uint32_t a = pool.intern_symbol(p, p + 5);
+        uint32_t b = pool.intern_symbol(p + 6, p + 13);
+        uint32_t c = pool.intern_symbol(p + 14, p + 19);
+        assert(a == 0 && b == 1 && c == a && pool.symbol_count() == 2);
+        assert(pool.find_symbol(p + 6, p + 13) == b && pool.find_symbol(p, p + 3) == ConstStringPool::no_symbol);
+
+        StringRef name = pool.get_symbol(a);
+        assert(name == "count" && name.length() == 5 && name.symbol() == a);
+        assert(name == pool.intern("count") && !(name == pool.get_symbol(b)));
+        assert(name == pool.assign("count") && pool.assign("count").symbol() == ConstStringPool::no_symbol);
+
+        // symbols stay dense and stable through rehash
+        for (uint32_t i = 0; i < 1000; i++) {
+            assert(pool.intern("x" + std::to_string(i)).symbol() == 2 + i);
+        }
+        assert(pool.intern("x500").symbol() == 502 && pool.get_symbol(a) == "count");
+    }
+
+    void test_checkpoint() {
+
+        struct Tracked {
+            int* destroyed;
+
+            explicit Tracked(int* destroyed) : destroyed(destroyed) {
+
+            }
+
+            ~Tracked() {
+                (*destroyed)++;
+            }
+        };
+
+        int destroyed = 0;
+        MemoryPool pool(256);
+        auto kept = pool.construct<Tracked>(&destroyed);
+        MemoryPool::Checkpoint cp = pool.checkpoint();
+
+        const char* first = nullptr;
+        size_t capacity = 0;
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 100; i++) {
+                auto ref = pool.construct<Tracked>(&destroyed);
+                first = i == 0 && round == 0 ? reinterpret_cast<const char*>(ref.get()) : first;
+            }
+            assert(pool.size() == 101);
+            capacity = round == 0 ? pool.capacity() : capacity;
+            assert(pool.capacity() == capacity);     // chunks are reused
+
+            pool.rewind(cp);
+            assert(pool.size() == 1 && destroyed == 100 * (round + 1));
+        }
+        assert(reinterpret_cast<const char*>(pool.construct<Tracked>(&destroyed).get()) == first);
+        assert(kept.exists());
+
+        ConstStringPool strpool;
+        uint32_t a = strpool.intern_symbol("a", "a" + 1);
+        ConstStringPool::Checkpoint scp = strpool.checkpoint();
+        size_t generation = strpool.generation();
+        for (int i = 0; i < 200; i++) {
+            strpool.intern("y" + std::to_string(i));
+        }
+        strpool.rewind(scp);
+        assert(strpool.symbol_count() == 1 && strpool.generation() != generation);
+        assert(strpool.find_symbol("y0", "y0" + 2) == ConstStringPool::no_symbol);
+        assert(strpool.intern("y1").symbol() == 1 && strpool.get_symbol(a) == "a");
+    }
+
+    void test_handle() {
+        assert(sizeof(ExprASTHandle) == 4 && sizeof(HandlePool<ExprAST>::Checkpoint) == sizeof(HandlePool<Type>::Checkpoint));
+        assert(std::is_trivially_copyable<ConstantHandle>::value);
+
+        HandlePool<Type> types;
+        TypeHandle t_int = types.construct<PrimitiveType>(Type::INT);
+        TypeHandle t_ptr = types.construct<PointerType>(TypeRef());
+        assert(types.get(t_int)->get_id() == Type::INT && types[t_ptr].get_id() == Type::Pointer);
+        assert(!TypeHandle().exists() && t_int != t_ptr);
+
+        MemoryPool typepool;
+        TypeRef int_type = typepool.construct<PrimitiveType>(Type::INT).to_const().cast<Type>();
+        int value = 42;
+        HandlePool<Constant> constants;
+        ConstantHandle c = constants.construct(int_type, reinterpret_cast<const char*>(&value), sizeof(value));
+        assert(constants[c].get_int() == 42);
+
+        ConstStringPool strpool;
+        HandlePool<ExprAST> exprs;
+        HandlePool<ExprAST>::Checkpoint cp = exprs.checkpoint();
+        Handle<IdAST> x = exprs.construct<IdAST>(strpool.intern("x"));
+        ExprASTHandle y = exprs.construct<IdAST>(strpool.intern("y"));
+        assert(exprs.get(x)->get_name() == "x" && static_cast<const IdAST&>(exprs[y]).get_name() == "y");
+        assert(exprs.size() == 2 && x.index() + 1 == y.index());
+
+        // released by rewind until the index is reused
+        exprs.rewind(cp);
+        assert(exprs.size() == 0 && exprs.released(x) && exprs.released(y) && !exprs.released(ExprASTHandle()));
+        ExprASTHandle z = exprs.construct<IdAST>(strpool.intern("z"));
+        assert(z.index() == x.index() && !exprs.released(z) && exprs.released(y));
+    }
 };
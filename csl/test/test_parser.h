@@ -1,6 +1,11 @@
 
 #include "../parser.h"
+#include "../util/mappedfile.h"
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 class ParserTest {
 public:
@@ -12,9 +17,44 @@ public:
 
         parser.load_context(&context);
 
-        parser.parse_line_expr("1 + 2")->print(std::cout);     // test basic
-        parser.parse_line_expr("x=y=++a+++=4==5")->print(std::cout);      // unary & assignment
-        parser.parse_line_expr("1+3^x*(3 and 4 or 5)")->print(std::cout); // test priority
+        context.exprpool[parser.parse_line_expr("1 + 2")].print(std::cout, context.exprpool);     // test basic
+        context.exprpool[parser.parse_line_expr("x=y=++a+++=4==5")].print(std::cout, context.exprpool);      // unary & assignment
+        context.exprpool[parser.parse_line_expr("1+3^x*(3 and 4 or 5)")].print(std::cout, context.exprpool); // test priority
+    }
+
+    void test_precedence() {
+
+        RDParser parser;
+        Context context;
+        parser.load_context(&context);
+
+        auto tree = [&](const char* expr) {
+            std::ostringstream out;
+            context.exprpool[parser.parse_line_expr(expr)].print(out, context.exprpool);
+            return out.str();
+        };
+        assert(tree("a - b - c") == tree("(a - b) - c"));
+        assert(tree("a + b * c ^ d % e") == tree("a + ((b * (c ^ d)) % e)"));
+        assert(tree("a or b xor c and d == e < f + g") == tree("a or (b xor (c and (d == (e < (f + g)))))"));
+        assert(tree("a * b + c * d - e / f") == tree("((a * b) + (c * d)) - (e / f)"));
+        assert(tree("a = b += c - d") == tree("a = (b += (c - d))"));
+
+        for (const char* expr : { "a ! b", "a & b" }) {
+            bool thrown = false;
+            try {
+                parser.parse_line_expr(expr);
+            }
+            catch (const SyntaxError&) {
+                thrown = true;
+            }
+            assert(thrown);
+        }
+
+        assert(get_precedence(Operator::MUL) < get_precedence(Operator::ADD));
+        assert(is_infix(Operator::OR) && !is_infix(Operator::NOT) && !is_infix(Operator::ASN));
+        assert(is_assignment(Operator::POWASN) && is_right_assoc(Operator::ASN) && !is_right_assoc(Operator::POW));
+        assert(is_valid(Operator::POSTDEC) && !is_valid(Operator::NONE) && !is_valid(static_cast<Operator>(OpName::RBRAC)));
+        assert(!is_valid(static_cast<Operator>(OpName::SEMICOLON)) && get_precedence(static_cast<Operator>(OpName::COMMA)) == no_precedence);
     }
 
     void test_parse_decl() {
@@ -23,10 +63,595 @@ public:
 
         parser.load_context(&context);
 
-        parser.parse_string("int a;")->print(std::cout);
-        parser.parse_string("int* a, b=1+2, c=a;")->print(std::cout);
-        parser.parse_string("int[10] c;")->print(std::cout);
-        parser.parse_string("void[6+a] d")->print(std::cout);
-        parser.parse_string("int[10] d = {1,2,{2,3}}")->print(std::cout);
+        parser.parse_string("int a;")->print(std::cout, context.exprpool);
+        parser.parse_string("int* a, b=1+2, c=a;")->print(std::cout, context.exprpool);
+        parser.parse_string("int[10] c;")->print(std::cout, context.exprpool);
+        parser.parse_string("void[6+a] d")->print(std::cout, context.exprpool);
+        parser.parse_string("int[10] d = {1,2,{2,3}}")->print(std::cout, context.exprpool);
+    }
+
+    void test_lex_mode() {
+        RDParser parser;
+        Context context;
+
+        parser.load_context(&context);
+
+        const char* src = "int[10] d = {1,2,{2,3}}; x = y + 3 * (z - 1);";
+        std::ostringstream bulk, stream;
+
+        parser.set_lex_mode(RDParser::BULK);
+        parser.parse_string(src)->print(bulk, context.exprpool);
+        parser.set_lex_mode(RDParser::STREAM);
+        parser.parse_string(src)->print(stream, context.exprpool);
+
+        assert(bulk.str() == stream.str());
+
+        ThreadPool pool(2);
+        std::ostringstream parallel;
+        parser.set_thread_pool(&pool);
+        parser.set_lex_mode(RDParser::PARALLEL);
+        parser.parse_string(src)->print(parallel, context.exprpool);
+
+        assert(bulk.str() == parallel.str());
+    }
+
+    void test_parse_stream() {
+        RDParser parser;
+        Context context;
+
+        parser.load_context(&context);
+
+        std::string src;
+        for (int i = 0; i < 100; i++) {
+            src += "int[10] d = {1,2,{2,3}}; x = y + 3 * (z - 1);\n";
+        }
+        std::istringstream is(src);
+
+        std::ostringstream from_stream, from_string;
+        parser.parse_stream(is)->print(from_stream, context.exprpool);
+        parser.parse_string(src)->print(from_string, context.exprpool);
+        assert(from_stream.str() == from_string.str());
+    }
+
+    void test_parse_file() {
+        RDParser parser;
+        Context context;
+
+        parser.load_context(&context);
+
+        const char* src = "int[10] d = {1,2,{2,3}};\nx = y + 3 * (z - 1);\n";
+        const char* filename = "test_parse_file.csl";
+        std::ofstream(filename, std::ios::binary) << src;
+
+        std::ostringstream from_file, from_string;
+        parser.parse_file(filename)->print(from_file, context.exprpool);
+        parser.parse_string(src)->print(from_string, context.exprpool);
+        assert(from_file.str() == from_string.str());
+
+        std::ofstream(filename, std::ios::binary).close();
+        MappedFile empty(filename);
+        assert(empty.is_open() && empty.size() == 0);
+        empty.close();
+        remove(filename);
+
+        bool thrown = false;
+        try {
+            parser.parse_file(filename);
+        }
+        catch (const CSLError&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    void test_import() {
+        const char* a = "test_import_a.csl";
+        const char* b = "test_import_b.csl";
+        const char* c = "test_import_c.csl";
+        const std::string src_a = "import \"test_import_b.csl\";\nint x = 1;\n", src_b = "int y = 2;\n";
+        std::ofstream(a, std::ios::binary) << src_a;
+        std::ofstream(b, std::ios::binary) << src_b;
+        std::ofstream(c, std::ios::binary) << "import \"test_import_c.csl\";\n";
+
+        ModuleCache cache;
+        RDParser parser;
+        Context context;
+        context.modules = &cache;
+        parser.load_context(&context);
+
+        std::ostringstream out;
+        parser.parse_string("import \"test_import_a.csl\";\nimport \"test_import_b.csl\";\n")->print(out, context.exprpool);
+        assert(out.str().find("[Import] test_import_a.csl") != std::string::npos);
+        ModuleCache::Stats stats = cache.stats();
+        assert(stats.misses == 2 && stats.hits == 1 && cache.size() == 2 && cache.bytes() == src_a.size() + src_b.size());
+
+        // unchanged: the same module, without parsing
+        std::shared_ptr<const Module> module_a = parser.import_file(a);
+        assert(module_a == parser.import_file(a) && cache.stats().hits == 3 && cache.stats().misses == 2);
+        std::ostringstream printed;
+        module_a->ast->print(printed, module_a->context.exprpool);
+        assert(printed.str().find("[Import] test_import_b.csl") != std::string::npos);
+
+        // changed: parsed again
+        std::shared_ptr<const Module> module_b = parser.import_file(b);
+        std::ofstream(b, std::ios::binary) << "int y = 3;\n";
+        assert(parser.import_file(b) != module_b && cache.stats().stale == 1);
+
+        // least recently used is evicted, and lives on while imported
+        ModuleCache small(1);
+        Context other;
+        other.modules = &small;
+        parser.load_context(&other);
+        parser.import_file(a);
+        assert(small.size() == 1 && small.stats().evictions == 1 && small.stats().misses == 2);
+
+        bool thrown = false;
+        try {
+            parser.import_file(c);
+        }
+        catch (const SyntaxError&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        // other spellings of a path are the same file, and the same module
+        const char* self = "test_import_self.csl";
+        std::ofstream(self, std::ios::binary) << "import \"./test_import_self.csl\";\n";
+        thrown = false;
+        try {
+            parser.parse_file(self);
+        }
+        catch (const SyntaxError&) {
+            thrown = true;
+        }
+        assert(thrown);
+        std::shared_ptr<const Module> module = parser.import_file(a);
+        assert(parser.import_file("./" + std::string(a)) == module && parser.import_file(".//x/../" + std::string(a)) == module);
+
+        remove(a);
+        remove(b);
+        remove(c);
+        remove(self);
+    }
+
+    void test_ast_cache() {
+        const char* a = "test_ast_cache_a.csl";
+        const char* b = "test_ast_cache_b.csl";
+        const std::string src_a = "import \"test_ast_cache_b.csl\";\nint x, y = 2;\nfloat* p;\nchar[4] s = \"abc\";\n"
+            "int[2] q = {1, 2};\nif (x < y) { x = x + 1; } else y = f(x, 2.5, 'c');\n"
+            "while (true) { continue; }\nfor (x = 0; x < 10; x++) s.t = -x;\nreturn x;\n"
+            "class C { int m; fn get() -> int { return m; } }\nfn h(: int, n: C*) -> int { C v; return n; }\n";
+        const std::string src_b = "bool t = true;\n";
+        std::ofstream(a, std::ios::binary) << src_a;
+        std::ofstream(b, std::ios::binary) << src_b;
+        ASTCache cache("test_ast_cache");
+
+        // parsed and stored, with the import
+        Context parsed;
+        parsed.ast_cache = &cache;
+        RDParser parser;
+        parser.load_context(&parsed);
+        ASTRef tree = parser.parse_file(a);
+        ASTCache::Stats stats = cache.stats();
+        assert(stats.misses == 2 && stats.hits == 0 && stats.stores == 2);
+
+        // read back in a new context: the same tree, serialized the same
+        Context loaded;
+        loaded.ast_cache = &cache;
+        parser.load_context(&loaded);
+        ASTRef tree2 = parser.parse_file(a);
+        stats = cache.stats();
+        assert(stats.hits == 2 && stats.stores == 2);
+        std::ostringstream out, out2;
+        tree->print(out, parsed.exprpool);
+        tree2->print(out2, loaded.exprpool);
+        assert(out.str() == out2.str() && out.str().find("[Import] test_ast_cache_b.csl") != std::string::npos);
+        uint64_t hash = hash_bytes(src_a.data(), src_a.size());
+        std::string bytes = ASTCache::serialize(hash, src_a.size(), tree.cast<BlockStmtAST>(), parsed.exprpool);
+        assert(bytes == ASTCache::serialize(hash, src_a.size(), tree2.cast<BlockStmtAST>(), loaded.exprpool));
+
+        // truncated: not read; failing import: nothing left in context
+        Context other;
+        bool thrown = false;
+        try {
+            ASTCache::deserialize(bytes.data(), bytes.size() - 1, hash, src_a.size(), other, nullptr);
+        }
+        catch (const ASTCache::Invalid&) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            cache.load(hash, src_a.size(), other, [](const std::string&) -> std::shared_ptr<const Module> {
+                throw CSLError("no import");
+            });
+        }
+        catch (const CSLError&) {
+            thrown = true;
+        }
+        assert(thrown && other.astpool.size() == 0 && other.strpool.symbol_count() == 0);
+        std::ofstream(cache.path_of(hash, src_a.size()), std::ios::binary) << bytes.substr(0, bytes.size() / 2);
+        other.ast_cache = &cache;
+        parser.load_context(&other);
+        std::ostringstream out3;
+        parser.parse_file(a)->print(out3, other.exprpool);
+        stats = cache.stats();
+        assert(out3.str() == out.str() && stats.invalid == 1 && stats.stores == 3);
+
+        // changed: another file
+        std::ofstream(b, std::ios::binary) << "bool t = false;\n";
+        parser.load_context(&loaded);
+        parser.parse_file(a);
+        assert(cache.stats().stores == 4);
+
+        remove(cache.path_of(hash, src_a.size()).c_str());
+        remove(cache.path_of(hash_bytes(src_b.data(), src_b.size()), src_b.size()).c_str());
+        remove(cache.path_of(hash_bytes("bool t = false;\n", 16), 16).c_str());
+        remove("test_ast_cache");
+        remove(a);
+        remove(b);
+    }
+
+    void test_lazy_bodies() {
+        // A and B are types only after their definitions, in bodies too
+        const std::string src = "fn f(a: int) -> int { A * b; { B * c; } return a; }\n"
+            "class A { int m; fn get() -> int { B * d; return m; } }\nclass B;\n"
+            "fn g(: A*) { A * e; fn inner() { A * h; } }\nfn decl(x: int);\n";
+
+        auto print = [](const BlockStmtASTRef& ast, const ExprPool& exprs) {
+            std::ostringstream out;
+            ast->print(out, exprs);
+            return out.str();
+        };
+        RDParser parser;
+        Context eager;
+        parser.load_context(&eager);
+        std::string expected = print(parser.parse_string(src), eager.exprpool);
+        assert(expected.find("DEFINE e") != std::string::npos && expected.find("DEFINE b") == std::string::npos);
+
+        Context lazy;
+        parser.load_context(&lazy);
+        parser.set_lazy_bodies(true);
+        BlockStmtASTRef tree = parser.parse_string(src);
+        assert(tree->get_defs().size() == 5 && lazy.astpool.size() < eager.astpool.size());
+        FunctionASTRef f = tree->get_defs()[0].cast<FunctionAST>();
+        FunctionASTRef decl = tree->get_defs()[4].cast<FunctionAST>();
+        assert(f->has_body() && !f->is_body_parsed() && !decl->has_body());
+
+        // bodies parsed on threads at once, each once; no refs copied, as counts are not atomic
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&]() {
+                for (const auto& d : tree->get_defs()) {
+                    if (d->get_ast_type() == ASTBase::FUNCTION) {
+                        static_cast<const FunctionAST*>(d.get())->get_body();
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        assert(f->is_body_parsed());
+        assert(print(tree, lazy.exprpool) == expected);
+
+        // each body in a part of its own, so the pools of the tree are only read meanwhile
+        size_t nodes = lazy.astpool.size();
+        for (const auto& part : lazy.parts) {
+            nodes += part->astpool.size();
+        }
+        assert(lazy.parts.size() == 3 && nodes == eager.astpool.size());
+
+        // bodies parsed on one thread while another prints the tree
+        std::string many = "class A { int m; }\n";
+        for (int i = 0; i < 200; i++) {
+            std::string n = std::to_string(i);
+            many += "int x" + n + " = " + n + ";\nfn h" + n + "(a: int) -> int { A * p; float v = a * " + n + "; return v; }\n";
+        }
+        Context many_eager, many_lazy;
+        parser.set_lazy_bodies(false);
+        parser.load_context(&many_eager);
+        expected = print(parser.parse_string(many), many_eager.exprpool);
+        assert(expected.find("DEFINE p") != std::string::npos);
+        parser.set_lazy_bodies(true);
+        parser.load_context(&many_lazy);
+        BlockStmtASTRef many_tree = parser.parse_string(many);
+        std::string printed;
+        std::thread bodies([&]() {
+            const auto& defs = many_tree->get_defs();
+            for (size_t i = defs.size(); i-- > 0; ) {
+                if (defs[i]->get_ast_type() == ASTBase::FUNCTION) {
+                    static_cast<const FunctionAST*>(defs[i].get())->get_body();
+                }
+            }
+        });
+        printed = print(many_tree, many_lazy.exprpool);
+        bodies.join();
+        assert(printed == expected && many_lazy.parts.size() == 200);
+
+        // a class in a body is a type after it, so that body is parsed in place
+        const std::string inner = "fn f() { class A { int v; } }\nA x;\nfn g() { A y; }\n";
+        Context inner_eager, inner_lazy;
+        parser.set_lazy_bodies(false);
+        parser.load_context(&inner_eager);
+        expected = print(parser.parse_string(inner), inner_eager.exprpool);
+        assert(expected.find("DEFINE x") != std::string::npos);
+        parser.set_lazy_bodies(true);
+        parser.load_context(&inner_lazy);
+        BlockStmtASTRef inner_tree = parser.parse_string(inner);
+        assert(inner_tree->get_defs()[0].cast<FunctionAST>()->is_body_parsed());
+        assert(!inner_tree->get_defs()[1].cast<FunctionAST>()->is_body_parsed());
+        assert(print(inner_tree, inner_lazy.exprpool) == expected);
+
+        // errors of a body when it is parsed; unmatched braces at once
+        BlockStmtASTRef bad = parser.parse_string("fn f() { int = ; }\nint x;\n");
+        bool thrown = false;
+        try {
+            bad->get_defs()[0].cast<FunctionAST>()->get_body();
+        }
+        catch (const SyntaxError&) {
+            thrown = true;
+        }
+        assert(thrown && many_lazy.parts.size() == 200);
+        thrown = false;
+        try {
+            parser.parse_string("fn f() { { }\n");
+        }
+        catch (const SyntaxError&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    void test_parallel_bodies() {
+        // bodies of more than one chunk, seeing classes as they would in place; the ones
+        // defining a class are parsed in place, and the class is a type after them
+        std::string src = "fn f(a: int) -> int { A * b; return a; }\nclass A { int m; fn get() -> int { return m; } }\n"
+            "fn k() { class K { int v; } }\nK x;\n";
+        for (int i = 0; src.size() < 3 * RDParser::body_chunk; i++) {
+            std::string n = std::to_string(i);
+            std::string b = i % 64 == 7 ? "    class B" + n + " { int k; }\n" : "";
+            src += "fn g" + n + "(x: A*, y: int) -> int {\n    A * c" + n + ";\n    int z = \"s" + n + "\";\n"
+                + b + "    B7 * d" + n + ";\n    while (y > " + n + ") { if (y) { y = y - x.m * 2; } }\n"
+                "    fn inner() { x = y; }\n    return y + g" + n + "(x, y);\n}\n";
+        }
+        src += "int r = f(1);\n";
+
+        // printed and serialized, the latter read back into one context, as names of
+        // bodies parsed in parallel are in pools of their own
+        auto print = [](const BlockStmtASTRef& ast, const ExprPool& exprs) {
+            std::ostringstream out;
+            ast->print(out, exprs);
+            std::string bytes = ASTCache::serialize(0, 0, ast, exprs);
+            Context context;
+            out << ASTCache::serialize(0, 0, ASTCache::deserialize(bytes.data(), bytes.size(), 0, 0, context, nullptr),
+                context.exprpool);
+            return out.str();
+        };
+        RDParser parser;
+        Context eager;
+        parser.load_context(&eager);
+        parser.set_parallel_bodies(false);
+        std::string expected = print(parser.parse_string(src), eager.exprpool);
+        assert(expected.find("DEFINE c7") != std::string::npos && expected.find("DEFINE x") != std::string::npos);
+        assert(expected.find("DEFINE d6\n") == std::string::npos && expected.find("DEFINE d7\n") != std::string::npos);
+        assert(expected.find("DEFINE d8") != std::string::npos && expected.find("DEFINE b") == std::string::npos);
+
+        // the same tree, contexts and serialized bytes for any thread count
+        std::string bytes;
+        for (size_t threads : { 1, 2, 4 }) {
+            ThreadPool pool(threads);
+            Context context;
+            parser.load_context(&context);
+            parser.set_thread_pool(&pool);
+            parser.set_parallel_bodies(true);
+            BlockStmtASTRef tree = parser.parse_string(src);
+            assert(print(tree, context.exprpool) == expected && context.parts.size() == 3);
+            std::string serialized = ASTCache::serialize(0, src.size(), tree, context.exprpool);
+            assert(bytes.empty() || serialized == bytes);
+            bytes = serialized;
+        }
+
+        // the first error in source
+        std::string bad = src + "fn h() { int = ; }\n";
+        bad.insert(bad.find("\nfn g", bad.size() / 2) + 1, "fn e() { 1 + ; }\n");
+        std::string eager_error, parallel_error;
+        Context failed, failed_parallel;
+        parser.load_context(&failed);
+        try {
+            parser.set_parallel_bodies(false);
+            parser.parse_string(bad);
+        }
+        catch (const SyntaxError& e) {
+            eager_error = e.what();
+        }
+        ThreadPool pool(4);
+        parser.load_context(&failed_parallel);
+        parser.set_thread_pool(&pool);
+        parser.set_parallel_bodies(true);
+        try {
+            parser.parse_string(bad);
+        }
+        catch (const SyntaxError& e) {
+            parallel_error = e.what();
+        }
+        assert(eager_error == "Token with id/value required" && parallel_error == eager_error);
+
+        // items balanced over the pool, also from a task of it
+        std::vector<std::atomic<int> > runs(1000);
+        pool.parallel_for(runs.size(), [&](size_t i) { runs[i]++; });
+        pool.submit([&]() { pool.parallel_for(runs.size(), [&](size_t i) { runs[i]++; }); }).get();
+        for (const auto& r : runs) {
+            assert(r == 2);
+        }
+    }
+
+    void test_ast_pool() {
+        RDParser parser;
+        Context context;
+
+        parser.load_context(&context);
+        parser.parse_string("int a = 1 + b; int[4] c; while (a) { a = a - 1; }");
+
+        // expressions are in the ExprPool, the statements holding them in the ASTPool
+        const ExprPool& exprs = context.exprpool;
+        assert(exprs.count(ASTBase::OP) == 3);
+        assert(exprs.count(ASTBase::ID) == 4);
+        assert(exprs.count(ASTBase::VALUE) == 3);
+        assert(exprs.size() == 10 && exprs.constant_count() == 3);
+
+        const ASTPool& pool = context.astpool;
+        assert(pool.stats(ASTBase::TYPE).nodes == 3);   // TypeAST and ArrayTypeAST
+        assert(pool.stats(ASTBase::DECL).nodes == 2);
+        assert(pool.stats(ASTBase::BLOCK).nodes == 2);
+        assert(pool.stats(ASTBase::WHILE).nodes == 1);
+        assert(pool.stats(ASTBase::EXPR).nodes == 1);
+        assert(pool.stats(ASTBase::CALL).pages == 0 && pool.stats(ASTBase::OP).pages == 0);
+        assert(pool.size() == 9);
+
+        // nodes of a kind are adjacent
+        MemoryRef<IdAST> x = context.astpool.construct<IdAST>(context.strpool.intern("x"));
+        MemoryRef<IdAST> y = context.astpool.construct<IdAST>(context.strpool.intern("y"));
+        ASTPool::Stats ids = pool.stats(ASTBase::ID);
+        assert(ids.pages == 1 && ids.slots >= ids.nodes && ids.bytes % ids.slots == 0);
+        assert(static_cast<size_t>(reinterpret_cast<const char*>(y.get()) - reinterpret_cast<const char*>(x.get())) ==
+            ids.bytes / ids.slots);
+    }
+
+    void test_context_rewind() {
+        RDParser parser;
+        Context context;
+
+        parser.load_context(&context);
+        parser.parse_line_expr("x + 1");
+        Context::Checkpoint cp = context.checkpoint();
+        size_t symbols = context.strpool.symbol_count();
+
+        std::string printed[3];
+        size_t capacity = 0;
+        for (int i = 0; i < 30; i++) {
+            std::ostringstream out;
+            context.exprpool[parser.parse_line_expr("f(a, \"long string literal\") * (x + 2.5) - name_" + std::to_string(i % 3))].print(out, context.exprpool);
+            assert(i < 3 || out.str() == printed[i % 3]);     // same tree from reused memory
+            printed[i % 3] = out.str();
+            capacity = i == 0 ? context.exprpool.capacity() : capacity;
+
+            context.rewind(cp);
+            assert(context.exprpool.capacity() == capacity && context.strpool.symbol_count() == symbols);
+        }
+    }
+
+    void test_instrument() {
+#if CSL_INSTRUMENT
+        const std::string src = "int x = a + 1;\nif (x) { y = 2; }\n";   // 17 tokens
+
+        for (auto mode : { RDParser::BULK, RDParser::STREAM }) {
+            RDParser parser;
+            Context context;
+            Instrument instrument;
+            context.instrument = &instrument;
+            parser.load_context(&context);
+            parser.set_lex_mode(mode);
+            parser.parse_string(src);
+
+            const Instrument::Counters& c = instrument.counters;
+            assert(c.tokens == 17 && c.scans == 17);
+            assert(c.ast_nodes[0] == context.exprpool.count(ASTBase::OP) && c.ast_nodes[0] == 2);
+            assert(c.symbols == context.strpool.symbol_count() && c.symbols >= 3 && c.strpool_bytes == context.strpool.bytes() && c.strpool_bytes > 0);
+            assert(c.constants == context.exprpool.constant_count() && c.types == context.typepool.size());
+
+            std::vector<Instrument::Phase> phases = instrument.phases();
+            assert(phases.size() == 2 && std::string(phases[0].name) == "lex" && std::string(phases[1].name) == "parse");
+            assert(phases[0].count == 1 && phases[1].count == 1);
+            assert(instrument.seconds("parse") >= 0 && instrument.seconds("resolve") == 0);
+
+            std::ostringstream json, trace;
+            instrument.write_json(json);
+            instrument.write_trace(trace);
+            assert(json.str().find("\"tokens\": 17") != std::string::npos);
+            assert(trace.str().find("\"name\": \"parse\", \"cat\": \"csl\", \"ph\": \"X\"") != std::string::npos);
+            assert(trace.str().find("\"ph\": \"C\"") != std::string::npos);
+        }
+
+        // parallel lexing counts the same tokens, and the phases of all parses
+        ThreadPool pool(4);
+        std::string large;
+        for (int i = 0; i < 20000; i++) {
+            large += src;
+        }
+        RDParser parser;
+        Context context;
+        Instrument instrument;
+        context.instrument = &instrument;
+        parser.load_context(&context);
+        parser.set_lex_mode(RDParser::PARALLEL);
+        parser.set_thread_pool(&pool);
+        parser.parse_string(large);
+        parser.parse_line_expr("x + 1");
+        assert(instrument.counters.tokens == 17 * 20000 + 3 && instrument.counters.scans >= instrument.counters.tokens);
+        assert(instrument.phases()[0].count == 2 && instrument.events().size() == 4);
+
+        instrument.clear();
+        assert(instrument.counters.tokens == 0 && instrument.events().empty());
+#endif
+    }
+
+    void test_class_scope() {
+        // a class name is a type only in the context that defined it
+        RDParser parser;
+        Context context, other;
+        context.define_class(context.strpool.intern("Foo").symbol());
+
+        auto is_decl = [&](Context& c) {
+            std::ostringstream out;
+            parser.load_context(&c);
+            parser.parse_string("Foo * p;")->print(out, c.exprpool);
+            return out.str().find("DEFINE p") != std::string::npos;
+        };
+        assert(is_decl(context));
+        assert(!is_decl(other));
+
+        // classes defined after a checkpoint are dropped by rewind
+        Context::Checkpoint cp = other.checkpoint();
+        other.define_class(other.strpool.intern("Foo").symbol());
+        assert(is_decl(other));
+        other.rewind(cp);
+        assert(other.class_count() == 0 && !is_decl(other));
+    }
+
+    void test_parse_all() {
+        std::vector<std::string> sources;
+        for (int i = 0; i < 16; i++) {
+            sources.push_back("int x" + std::to_string(i) + " = " + std::to_string(i) + ";\nx = x * 2;\n");
+        }
+        sources[5] = "int = ;";
+
+        ThreadPool pool(4);
+        std::vector<ParseUnit> units = RDParser::parse_all(sources, pool);
+        assert(units.size() == sources.size());
+
+        for (size_t i = 0; i < units.size(); i++) {
+            if (i == 5) {
+                assert(!units[i].ast.exists() && units[i].error);
+                try {
+                    std::rethrow_exception(units[i].error);
+                    assert(false);
+                }
+                catch (const SyntaxError&) {
+                }
+                continue;
+            }
+            assert(units[i].ast.exists() && !units[i].error);
+
+            // same tree as a sequential parse, in a context of its own
+            RDParser parser;
+            Context context;
+            parser.load_context(&context);
+            std::ostringstream expected, actual;
+            parser.parse_string(sources[i])->print(expected, context.exprpool);
+            units[i].ast->print(actual, units[i].context->exprpool);
+            assert(actual.str() == expected.str());
+            assert(units[i].context->astpool.size() == context.astpool.size());
+        }
     }
-};
\ No newline at end of file
+};
@@ -1,5 +1,7 @@
 
 #include <cassert>
+#include <string>
+#include <vector>
 #include "../util/strmap.h"
 
 class StrMapTest {
@@ -35,4 +37,33 @@ public:
 
         assert(map.find(b)->second == 2);
     }
-};
\ No newline at end of file
+
+    void test_strset() {
+
+        StrSet set{ "int", "float" };
+        std::string key = "float_";
+
+        assert(set.has_key("int") && set.has_key(StringTmpRef(key.data(), key.data() + 5)));
+        assert(!set.has_key(key) && !set.has_key(""));
+        assert(!set.insert("int").second && set.size() == 2);
+
+        // through many rehashes, keys are copied and all found
+        std::vector<std::string> keys;
+        for (int i = 0; i < 5000; i++) {
+            keys.push_back("name_" + std::to_string(i * 7919));
+            assert(set.insert(StringTmpRef(keys.back())).second);
+        }
+        assert(set.size() == 5002);
+        for (const auto& k : keys) {
+            assert(set.find(k)->get() != k.data() && *set.find(k) == k);
+        }
+        assert(set.find("name_1") == set.end());
+
+        size_t count = 0;
+        for (const auto& k : set) {
+            assert(set.has_key(k));
+            count++;
+        }
+        assert(count == set.size());
+    }
+};
@@ -4,10 +4,13 @@
 #define CSL_TOKEN_H
 
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <ostream>
+#include <type_traits>
 
-#include "util/memory.h"
+#include "util/strmap.h"
 
 #ifdef EOF
 #undef EOF
@@ -75,7 +78,7 @@ enum class OpName : unsigned {
 	RCOMP = 0x44
 };
 
-/* Stores an uncasted value (in string form) */
+/* A literal value decoded by lexer */
 struct RawValue {
 	enum Type {
 		BOOL=0x02,
@@ -86,49 +89,48 @@ struct RawValue {
 	};
 
 	Type type;
-    StringRef strval;
+    StringTmpRef strval;    // text in source; quotes are excluded
+    union {
+        bool boolval;
+        char charval;
+        unsigned intval;
+        double floatval;
+    };
+    StringTmpRef strdata;   // STRING with escapes decoded
 };
 
-/* TOKEN used in lexer */
+/* TOKEN used in lexer. Does not own text: id/value tokens hold a span of the source buffer,
+   value tokens also carry the decoded value.
+   Trivially copyable and 16 bytes, so token arrays stay compact and copies are plain moves. */
 class Token {
 public:
 
     /* Basic type of Token*/
 	enum TokenType {
 		NONE = 0,   // Uninitialized, for error
-        VALUE,      // Direct value (int/string), stored in string form
+        VALUE,      // Direct value (int/string), decoded by lexer
         ID,         // ID
         OP,         // Operator and other symbols
         KEYWORD,    // Keywords defined in enum Keyword
         EOF         // End of file
 	};
 
-	Token() : _type(NONE) {
+	Token() : _type(NONE), _subtype(0), _uintdata(0), _offset(0), _value() {
 	}
-	explicit Token(TokenType type) : _type(type) {
+	explicit Token(TokenType type) : _type(type), _subtype(0), _uintdata(0), _offset(0), _value() {
 	}
 
-    /* Only for type == ID */
-	explicit Token(TokenType type, const StringRef& str) : _type(type) {
-		set_name(str);
+	explicit Token(TokenType type, unsigned data) : _type(type), _subtype(0), _uintdata(data), _offset(0), _value() {
 	}
 
-    explicit Token(TokenType type, const RawValue& value) {
-        set_value(value.type, value.strval);
+    /* Only for type == ID/VALUE; [offset, offset + length) of source */
+    explicit Token(TokenType type, size_t offset, size_t length) : 
+        _type(type), _subtype(0), _uintdata(static_cast<uint32_t>(length)),
+        _offset(static_cast<uint32_t>(offset)), _value() {
     }
 
-	explicit Token(TokenType type, unsigned data) : _type(type), _uintdata(data) {
-	}
-
-	Token(const Token& token) : _type(token._type), _uintdata(token._uintdata) {
-		if (_type == ID || _type == VALUE) {
-			_strdata = token._strdata;
-		}
-	}
-
-
     TokenType get_type() const {
-		return _type;
+		return static_cast<TokenType>(_type);
 	}
 	void set_type(TokenType type) {
 		_type = type;
@@ -155,47 +157,131 @@ public:
 		_uintdata = static_cast<unsigned>(opname);
 	}
 
-	OpName get_operator() {
+	OpName get_operator() const {
 		assert(_type == OP && "Cannot set operator");
 		
 		return static_cast<OpName>(_uintdata);
 	}
 
-	StringRef get_name()const {
-		assert(_type == ID && "Cannot get name from non-id");
-		return _strdata;
-	}
+    size_t get_offset()const {
+        return _offset;
+    }
+
+    void set_offset(size_t offset) {
+        _offset = static_cast<uint32_t>(offset);
+    }
+
+    /* Source window moved forward by shift bytes (StreamReader) */
+    void rebase(size_t shift) {
+        assert(_offset >= shift && "Token text was dropped");
+        _offset -= static_cast<uint32_t>(shift);
+    }
+
+    size_t get_length()const {
+        return _type == ID || _type == VALUE ? _uintdata : 0;
+    }
+
+    /* Symbol of an ID-token in Context::strpool, set by lexer */
+    void set_symbol(uint32_t symbol) {
+        assert(_type == ID && "Cannot set symbol to non-id");
+        _subtype = 1;
+        _value.intval = symbol;
+    }
+
+    bool has_symbol()const {
+        return _type == ID && _subtype != 0;
+    }
+
+    uint32_t get_symbol()const {
+        assert(has_symbol() && "Token has no symbol");
+        return _value.intval;
+    }
+
+    // text of an ID/VALUE-token in source
+    StringTmpRef get_text(const char* source)const {
+        return StringTmpRef(source + _offset, source + _offset + get_length());
+    }
 
-    // set name to an ID-token
-	void set_name(const StringRef& name) {
-		assert(_type == ID && "Cannot set name to non-id");
-		_strdata = name;
+	StringTmpRef get_name(const char* source)const {
+		assert(_type == ID && "Cannot get name from non-id");
+		return get_text(source);
 	}
 
 	// get value from a VALUE-token
-	RawValue get_value() {
+	RawValue get_value(const char* source) const {
 		assert(_type == VALUE && "Cannot get value from non-value");
-		return { static_cast<RawValue::Type>(_uintdata), _strdata};
+
+        RawValue val;
+        val.type = get_value_type();
+        val.strval = get_text(source);
+        switch (val.type)
+        {
+        case RawValue::BOOL: val.boolval = _value.boolval; break;
+        case RawValue::CHAR: val.charval = _value.charval; break;
+        case RawValue::INT: val.intval = _value.intval; break;
+        case RawValue::FLOAT: val.floatval = _value.floatval; break;
+        default: val.intval = 0; break;
+        }
+        if (val.type == RawValue::STRING && _value.escaped) {
+            uint32_t len;
+            memcpy(&len, _value.escaped - sizeof(len), sizeof(len));
+            val.strdata = StringTmpRef(_value.escaped, _value.escaped + len);
+        }
+        else {
+            val.strdata = val.strval;
+        }
+		return val;
 	}
 
-	// set value to a VALUE-token
-	void set_value(RawValue::Type type, const StringRef& data) {
+    RawValue::Type get_value_type() const {
+        assert(_type == VALUE && "Cannot get value from non-value");
+        return static_cast<RawValue::Type>(_subtype);
+    }
+
+	// set value type to a VALUE-token
+	void set_value(RawValue::Type type) {
 		assert(_type == VALUE && "Cannot set value to non-value");
-		_uintdata = static_cast<unsigned>(type);
-		_strdata = data;
+		_subtype = static_cast<unsigned>(type);
 	}
 
-    void print(std::ostream& os)const {
+    void set_bool(bool val) {
+        set_value(RawValue::BOOL);
+        _value.boolval = val;
+    }
+
+    void set_char(char val) {
+        set_value(RawValue::CHAR);
+        _value.charval = val;
+    }
+
+    void set_int(unsigned val) {
+        set_value(RawValue::INT);
+        _value.intval = val;
+    }
+
+    void set_float(double val) {
+        set_value(RawValue::FLOAT);
+        _value.floatval = val;
+    }
+
+    /* escaped is nullptr if the text has no escapes, otherwise decoded bytes
+       preceded by their uint32 length (in Context::literalpool) */
+    void set_string(const char* escaped) {
+        set_value(RawValue::STRING);
+        _value.escaped = escaped;
+    }
+
+    void print(std::ostream& os, const char* source)const {
         switch (_type)
         {
         case Token::NONE:
             os << "[]";
             break;
         case Token::VALUE:
-            os << "[value " << _strdata.to_cstr() << "]";
+            os << "[value " << get_text(source).copy() << "]";
             break;
         case Token::ID:
-            os << "[id " << _strdata.to_cstr() << "]";
+            os << "[id " << get_text(source).copy() << "]";
             break;
         case Token::OP:
             os << "[operator " << _uintdata << "]";
@@ -211,12 +297,30 @@ public:
         }
     }
 
+    /* Largest source a token can address */
+    static const size_t max_offset = UINT32_MAX;
+
+    /* Longest id/value text */
+    static const size_t max_length = (1u << 24) - 1;
+
 private:
 
-    TokenType _type;
-	unsigned _uintdata;		// stores op/keyword
-	StringRef _strdata;		// stores id/value
+    uint32_t _type : 4;         // TokenType
+    uint32_t _subtype : 4;      // RawValue::Type of VALUE; 1 if ID has a symbol
+    uint32_t _uintdata : 24;    // stores op/keyword, or length of id/value text
+    uint32_t _offset;           // token in source
+    union {
+        uint64_t bits;
+        bool boolval;
+        char charval;
+        uint32_t intval;
+        double floatval;
+        const char* escaped;
+    } _value;                   // decoded value of VALUE
 };
 
+static_assert(sizeof(Token) <= 16, "Token should be compact");
+static_assert(std::is_trivially_copyable<Token>::value, "Token should be trivially copyable");
+
 #endif
 #endif
\ No newline at end of file
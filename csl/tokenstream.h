@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef CSL_TOKENSTREAM_H
+#define CSL_TOKENSTREAM_H
+
+#include <cassert>
+#include <vector>
+
+#include "token.h"
+#include "lexer.h"
+
+
+/* Contiguous array of tokens with a cursor.
+   Bulk mode tokenizes the whole input up front (optionally on a thread pool); streaming mode pulls 
+   from the lexer on demand (for REPL and piped input). Both modes allow arbitrary look-ahead; 
+   streaming mode only keeps the last `history` consumed tokens for backtracking, so memory 
+   stays bounded. */
+class TokenStream {
+public:
+
+    /* Consumed tokens kept in streaming mode */
+    static const size_t history = 64;
+
+    TokenStream() : _pos(0), _dropped(0), _lexer(nullptr) {
+
+    }
+
+    void clear() {
+        _tokens.clear();
+        _pos = 0;
+        _dropped = 0;
+        _lexer = nullptr;
+    }
+
+    /* Tokenize the rest of lexer input (bulk mode) */
+    void fill(Lexer& lexer) {
+        clear();
+        lexer.tokenize(_tokens);
+    }
+
+    /* Bulk mode, lexing chunks of input in parallel */
+    void fill(Lexer& lexer, ThreadPool& pool) {
+        clear();
+        lexer.tokenize(_tokens, pool);
+    }
+
+    /* Pull tokens from lexer when required (streaming mode) */
+    void attach(Lexer& lexer) {
+        clear();
+        _lexer = &lexer;
+        pull();
+        _lexer->hold(_tokens.front().get_offset());
+    }
+
+    /* Token under cursor; Always available */
+    const Token& peek()const {
+        return _tokens[_pos];
+    }
+
+    /* k-th token after cursor; EOF beyond the end of input */
+    const Token& look_ahead(size_t k) {
+        while (_pos + k >= _tokens.size() && !_tokens.back().is_type(Token::EOF)) {
+            pull();
+        }
+        return _pos + k < _tokens.size() ? _tokens[_pos + k] : _tokens.back();
+    }
+
+    /* The last token consumed */
+    const Token& prev()const {
+        assert(_pos > 0 && "No token consumed");
+        return _tokens[_pos - 1];
+    }
+
+    void advance() {
+        if (_pos + 1 >= _tokens.size()) {
+            if (!_tokens.back().is_type(Token::EOF)) {
+                pull();
+            }
+            else if (_pos == 0 || !_tokens[_pos - 1].is_type(Token::EOF)) {
+                _tokens.push_back(_tokens.back());  // consumed EOF stays readable by prev()
+            }
+            else {
+                return;
+            }
+        }
+        _pos++;
+
+        if (_lexer && _pos >= 4 * history) {
+            compact();
+        }
+    }
+
+    /* Backtracking */
+    size_t mark()const {
+        return _dropped + _pos;
+    }
+
+    void rewind(size_t mark) {
+        assert(mark <= _dropped + _pos && "Cannot rewind forward");
+        assert(mark >= _dropped && "Token is out of history");
+        _pos = mark - _dropped;
+    }
+
+    size_t size()const {
+        return _dropped + _tokens.size();
+    }
+
+    bool is_streaming()const {
+        return _lexer != nullptr;
+    }
+
+private:
+
+    void pull() {
+        Token token = _lexer->get_token();
+        size_t shift = _lexer->take_shift();
+        if (shift > 0) {
+            for (auto& t : _tokens) {
+                t.rebase(shift);
+            }
+        }
+        _tokens.push_back(token);
+    }
+
+    /* Drop consumed tokens out of history, and let lexer drop their source */
+    void compact() {
+        size_t drop = _pos - history;
+        _tokens.erase(_tokens.begin(), _tokens.begin() + drop);
+        _pos -= drop;
+        _dropped += drop;
+        _lexer->hold(_tokens.front().get_offset());
+    }
+
+    std::vector<Token> _tokens;
+    size_t _pos;
+    size_t _dropped;    // tokens dropped before _tokens[0]
+    Lexer* _lexer;
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include <string>
 
 #include "util/memory.h"
+#include "util/handle.h"
 
 
 // Base of all types
@@ -73,6 +74,7 @@ protected:
 };
 
 typedef ConstMemoryRef<Type> TypeRef;
+typedef Handle<Type> TypeHandle;       // in a HandlePool<Type>
 
 // basic types (void, bool, char, int, float)
 class PrimitiveType : public Type {
@@ -122,6 +124,10 @@ public:
         os << '*';
     }
 
+    TypeRef get_pointee()const {
+        return pointee;
+    }
+
     ~PointerType() {
     }
 
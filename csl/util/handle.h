@@ -0,0 +1,262 @@
+#pragma once
+
+#ifndef CSL_HANDLE_H
+#define CSL_HANDLE_H
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "errors.h"
+#include "memory.h"
+
+/* Check of every handle dereference against the released flag of its slot; On in
+   debug builds. Handles and pools have the same layout either way, so builds of
+   both settings link */
+#ifndef CSL_HANDLE_CHECKS
+#ifdef NDEBUG
+#define CSL_HANDLE_CHECKS 0
+#else
+#define CSL_HANDLE_CHECKS 1
+#endif
+#endif
+
+
+template<typename Ty> class HandlePool;
+
+/* Reference to an object in a HandlePool: its 32-bit slot index, in every build.
+   Trivially copyable and without refcount; It is dereferenced through its pool.
+   With CSL_HANDLE_CHECKS the pool checks that the object was not released, until
+   its slot is reused by a new object. */
+template<typename Ty>
+class Handle {
+public:
+
+    Handle() : _index(0) {
+
+    }
+
+    /* Handle of derived class to handle of base */
+    template<typename Sub, typename = typename std::enable_if<std::is_base_of<Ty, Sub>::value>::type>
+    Handle(const Handle<Sub>& other) : _index(other._index) {
+
+    }
+
+    /* Handle of the class the object is known to be of */
+    template<typename Sub>
+    Handle<Sub> cast()const {
+        static_assert(std::is_base_of<Ty, Sub>::value || std::is_base_of<Sub, Ty>::value, "Unrelated classes");
+        Handle<Sub> h;
+        h._index = _index;
+        return h;
+    }
+
+    bool exists()const {
+        return _index != 0;
+    }
+
+    uint32_t index()const {
+        return _index;
+    }
+
+    bool operator==(const Handle& other)const {
+        return _index == other._index;
+    }
+
+    bool operator!=(const Handle& other)const {
+        return _index != other._index;
+    }
+
+private:
+
+    template<typename> friend class Handle;
+    template<typename> friend class HandlePool;
+
+    uint32_t _index;    // 0 is null
+};
+
+
+/* Objects of Ty (or classes derived from it) referenced by Handle<Ty>.
+   Objects are constructed in an arena and live until the pool is rewound
+   past them, cleared or destroyed. Slots are in segments of doubling size
+   that never move, so objects may be looked up on other threads while new
+   ones are constructed. At most max_size objects; construct() throws CSLError
+   beyond. */
+template<typename Ty>
+class HandlePool {
+public:
+
+    static const size_t max_size = UINT32_MAX - 64;    // so that indices fit segment_of()
+
+    explicit HandlePool(size_t chunk_size = 1 << 16) : _arena(chunk_size), _count(1) {
+
+    }
+
+    HandlePool(const HandlePool&) = delete;
+    HandlePool& operator=(const HandlePool&) = delete;
+
+    ~HandlePool() {
+        release(1);
+    }
+
+    /* Construct a new object of Sub in place */
+    template<typename Sub = Ty, typename... Args>
+    Handle<Sub> construct(Args&&... args) {
+        static_assert(std::is_base_of<Ty, Sub>::value, "Sub must derive from Ty");
+        if (_count > max_size) {
+            throw CSLError("Too many handles");
+        }
+
+        uint32_t index = static_cast<uint32_t>(_count);
+        size_t segment = segment_of(index);
+        if (!_segments[segment]) {
+            _segments[segment].reset(new Slot[first_segment << segment]());
+        }
+        Slot& s = slot(index);
+        void* p = _arena.allocate(sizeof(Sub), alignof(Sub));
+        s.object = new (p) Sub(std::forward<Args>(args)...);
+        s.released = false;
+        s.destroy = nullptr;
+        if (!std::is_trivially_destructible<Sub>::value) {
+            s.destroy = [](Ty* p) { static_cast<Sub*>(p)->~Sub(); };
+        }
+        _count++;
+
+        Handle<Sub> h;
+        h._index = index;
+        return h;
+    }
+
+    template<typename Sub>
+    Sub* get(const Handle<Sub>& h) {
+        return static_cast<Sub*>(lookup(h));
+    }
+
+    template<typename Sub>
+    const Sub* get(const Handle<Sub>& h)const {
+        return static_cast<const Sub*>(lookup(h));
+    }
+
+    template<typename Sub>
+    Sub& operator[](const Handle<Sub>& h) {
+        return *get(h);
+    }
+
+    template<typename Sub>
+    const Sub& operator[](const Handle<Sub>& h)const {
+        return *get(h);
+    }
+
+    /* True if the object of h was destroyed by rewind() or clear(), and its slot
+       not reused since */
+    template<typename Sub>
+    bool released(const Handle<Sub>& h)const {
+        return h.exists() && h.index() <= max_size && _segments[segment_of(h.index())] && slot(h.index()).released;
+    }
+
+    /* Number of objects */
+    size_t size()const {
+        return _count - 1;
+    }
+
+    /* Bytes reserved from system */
+    size_t capacity()const {
+        size_t slots = 0;
+        for (size_t i = 0; i < segment_count && _segments[i]; i++) {
+            slots += first_segment << i;
+        }
+        return _arena.capacity() + slots * sizeof(Slot);
+    }
+
+    struct Checkpoint {
+        ByteArena::Checkpoint arena;
+        size_t count;
+    };
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp = { _arena.checkpoint(), _count };
+        return cp;
+    }
+
+    /* Destroy objects constructed after cp; Their handles become invalid */
+    void rewind(const Checkpoint& cp) {
+        release(cp.count);
+        _arena.rewind(cp.arena);
+    }
+
+    /* Destroy all objects and free their memory; Slots are kept, so handles
+       to the objects stay detectably released */
+    void clear() {
+        release(1);
+        _arena.clear();
+    }
+
+private:
+
+    struct Slot {
+        Ty* object;
+        void (*destroy)(Ty*);   // nullptr if trivially destructible
+        bool released;          // object destroyed, slot not reused since
+    };
+
+    // segment i has first_segment << i slots, enough for every index up to max_size
+    static const size_t first_segment = 64;
+    static const size_t segment_count = 26;
+    static_assert(max_size + first_segment <= UINT32_MAX, "Indices of segment_of() must fit 32 bits");
+
+    static unsigned high_bit(uint32_t n) {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse(&idx, n);
+        return static_cast<unsigned>(idx);
+#else
+        return 31 - __builtin_clz(n);
+#endif
+    }
+
+    static size_t segment_of(uint32_t index) {
+        return high_bit(index + uint32_t(first_segment)) - high_bit(uint32_t(first_segment));
+    }
+
+    Slot& slot(uint32_t index)const {
+        size_t segment = segment_of(index);
+        return _segments[segment][index + first_segment - (first_segment << segment)];
+    }
+
+    template<typename Sub>
+    Ty* lookup(const Handle<Sub>& h)const {
+        static_assert(std::is_base_of<Ty, Sub>::value, "Handle is not of this pool");
+        assert(h.exists() && _segments[segment_of(h.index())] && "Invalid handle");
+        const Slot& s = slot(h.index());
+#if CSL_HANDLE_CHECKS
+        assert(!s.released && s.object && "Object of handle was released");
+#endif
+        return s.object;
+    }
+
+    // newest first, as objects may refer to older ones
+    void release(size_t count) {
+        while (_count > count) {
+            Slot& s = slot(static_cast<uint32_t>(_count - 1));
+            if (s.destroy) {
+                s.destroy(s.object);
+            }
+            s.object = nullptr;
+            s.released = true;
+            _count--;
+        }
+    }
+
+    ByteArena _arena;
+    std::unique_ptr<Slot[]> _segments[segment_count];   // allocated as used
+    size_t _count;                                      // slots in use; [0] is null
+};
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef CSL_UTIL_HASH_H
+#define CSL_UTIL_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/* 64-bit multiply-xorshift hash over 8-byte words; Upper bits are best mixed */
+inline uint64_t hash_bytes(const char* str, size_t length) {
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = length * k;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t w;
+        memcpy(&w, str + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    // the tail in fixed-size loads, which may overlap bytes already hashed
+    size_t left = length - i;
+    if (left > 0) {
+        uint64_t w;
+        if (length >= 8) {
+            memcpy(&w, str + length - 8, 8);
+        }
+        else if (left >= 4) {
+            uint32_t lo, hi;
+            memcpy(&lo, str, 4);
+            memcpy(&hi, str + length - 4, 4);
+            w = (static_cast<uint64_t>(hi) << 32) | lo;
+        }
+        else {
+            w = static_cast<unsigned char>(str[0]) | static_cast<unsigned char>(str[left / 2]) << 8 |
+                static_cast<uint64_t>(static_cast<unsigned char>(str[left - 1])) << 16;
+        }
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    return h * k;
+}
+
+#endif // !CSL_UTIL_HASH_H
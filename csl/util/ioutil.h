@@ -3,76 +3,213 @@
 #ifndef CSL_UTIL_IOUTIL_H
 #define CSL_UTIL_IOUTIL_H
 
+#include <cerrno>
+#include <cstring>
+#include <istream>
 #include <string>
 
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
+#include "errors.h"
+#include "lineindex.h"
+
+
+/* Reader over a text buffer. The buffer is either copied from a string or 
+   viewed in place (e.g. a MappedFile), which must then outlive the reader. */
 class StrReader {
 public:
 
-    StrReader(const std::string& s): _buffer(s), _iter(_buffer.begin()) {
+    typedef const char* const_iterator;
+
+    StrReader(const std::string& s): _buffer(s), _base(0) {
+        _begin = _iter = _buffer.data();
+        _end = _begin + _buffer.length();
+    }
+
+    /* View of [begin, end) without copying */
+    StrReader(const char* begin, const char* end) : _begin(begin), _end(end), _iter(begin), _base(0) {
 
     }
 
-    std::string::const_iterator iter()const {
+    StrReader(const StrReader&) = delete;
+    StrReader& operator=(const StrReader&) = delete;
+
+    virtual ~StrReader() {
+
+    }
+
+    const_iterator iter()const {
         return _iter;
     }
 
-    std::string::const_iterator end()const {
-        return _buffer.end();
+    const_iterator end()const {
+        return _end;
     }
 
-    int pos()const {
-        return _iter - _buffer.begin();
+    const char* begin_ptr()const {
+        return _begin;
     }
 
-    void forward(unsigned step) {
-        _iter += step;
-        if (_iter >= _buffer.end()) {
-            _iter = _buffer.end();
-        }
+    const char* cur_ptr()const {
+        return _iter;
     }
 
-    void backward(unsigned step) {
-        _iter -= step;
-        if (_iter < _buffer.begin()) {
-            _iter = _buffer.begin();
-        }
+    const char* end_ptr()const {
+        return _end;
+    }
+
+    size_t pos()const {
+        return _iter - _begin;
+    }
+
+    void forward(size_t step) {
+        _iter = step < static_cast<size_t>(_end - _iter) ? _iter + step : _end;
+    }
+
+    void backward(size_t step) {
+        _iter = step < static_cast<size_t>(_iter - _begin) ? _iter - step : _begin;
     }
 
     bool eof()const {
-        return _iter >= _buffer.end();
+        return _iter >= _end;
+    }
+
+    /* Whether only a window of input is in memory, see StreamReader */
+    virtual bool is_stream()const {
+        return false;
+    }
+
+    /* Load more input after end_ptr(), dropping bytes before begin_ptr() + keep.
+       Returns false if there is no more input. */
+    virtual bool refill(size_t /*keep*/) {
+        return false;
+    }
+
+    /* Offset of begin_ptr() in the whole input */
+    size_t base()const {
+        return _base;
+    }
+
+    /* Line index of buffer, built on first use; Not thread-safe */
+    const LineIndex& lines()const {
+        if (!_lines.is_built()) {
+            _lines.build(_begin, _end);
+        }
+        return _lines;
     }
 
-    // This is not efficient for large text!
     // lineno == 0 for first line.
     unsigned lineno()const {
-        unsigned ln = 0;
-        for (auto iter = _iter; iter > _buffer.begin(); --iter) {
-            if (*iter == '\n')ln++;
-        }
-        return ln;
+        return static_cast<unsigned>(lines().line_of(pos()));
     }
 
-    std::string::const_iterator cur_line_begin()const {
-        auto iter = _iter;
-        for (; iter > _buffer.begin(); --iter) {
-            if (*iter == '\n')return ++iter;
-        }
-        return iter;
+    size_t colno()const {
+        return lines().column_of(pos());
     }
 
-    std::string::const_iterator cur_line_end()const {
-        auto iter = _iter;
-        for (; iter < _buffer.end(); ++iter) {
-            if (*iter == '\n')return iter;
+    const_iterator cur_line_begin()const {
+        return _begin + lines().line_begin(lineno());
+    }
+
+    const_iterator cur_line_end()const {
+        return _begin + lines().line_end(lineno());
+    }
+
+protected:
+
+    StrReader() : _begin(nullptr), _end(nullptr), _iter(nullptr), _base(0) {
+
+    }
+
+    std::string _buffer;    // empty for a view
+    const char* _begin;
+    const char* _end;
+    const char* _iter;
+    size_t _base;
+    mutable LineIndex _lines;
+};
+
+
+/* Sliding window over a file descriptor (e.g. a pipe) or std::istream, for input 
+   that is generated on the fly or larger than memory. Only [begin_ptr(), end_ptr()) 
+   is in memory; Positions and line numbers are relative to the window. */
+class StreamReader : public StrReader {
+public:
+
+    explicit StreamReader(std::istream& is, size_t chunk_size = 1 << 16) : 
+        _is(&is), _fd(-1), _chunk_size(chunk_size), _exhausted(false) {
+        _begin = _end = _iter = _buffer.data();
+    }
+
+    explicit StreamReader(int fd, size_t chunk_size = 1 << 16) :
+        _is(nullptr), _fd(fd), _chunk_size(chunk_size), _exhausted(false) {
+        _begin = _end = _iter = _buffer.data();
+    }
+
+    bool is_stream()const {
+        return true;
+    }
+
+    bool refill(size_t keep) {
+        if (_exhausted) {
+            return false;
+        }
+
+        size_t drop = keep < pos() ? keep : pos();
+        size_t live = (_end - _begin) - drop;
+        size_t cur = pos() - drop;
+
+        // window grows only while a single token is longer than a chunk
+        if (_buffer.size() < live + _chunk_size) {
+            std::string window(live + _chunk_size, '\0');
+            memcpy(&window[0], _begin + drop, live);
+            _buffer.swap(window);
         }
-        return iter;
+        else {
+            memmove(&_buffer[0], _begin + drop, live);
+        }
+
+        size_t n = read(&_buffer[live], _buffer.size() - live);
+        _exhausted = n == 0;
+
+        _base += drop;
+        _begin = _buffer.data();
+        _end = _begin + live + n;
+        _iter = _begin + cur;
+        _lines = LineIndex();
+        return n > 0;
     }
 
 private:
 
-    std::string _buffer;
-    std::string::const_iterator _iter;
+    size_t read(char* buf, size_t size) {
+        if (_is) {
+            _is->read(buf, size);
+            return static_cast<size_t>(_is->gcount());
+        }
+        while (true) {
+#if defined(_WIN32)
+            int n = _read(_fd, buf, static_cast<unsigned>(size));
+#else
+            ssize_t n = ::read(_fd, buf, size);
+#endif
+            if (n >= 0) {
+                return static_cast<size_t>(n);
+            }
+            else if (errno != EINTR) {
+                throw CSLError("Cannot read from input");
+            }
+        }
+    }
+
+    std::istream* _is;
+    int _fd;
+    size_t _chunk_size;
+    bool _exhausted;
 };
 
 #endif
\ No newline at end of file
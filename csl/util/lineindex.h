@@ -0,0 +1,97 @@
+#pragma once
+
+#ifndef CSL_UTIL_LINEINDEX_H
+#define CSL_UTIL_LINEINDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define CSL_LINEINDEX_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+
+/* Offsets of line starts in a text buffer, built in one pass.
+   Lines are 0-based; a '\n' belongs to the line it ends. */
+class LineIndex {
+public:
+
+    LineIndex() : _size(0) {
+
+    }
+
+    void build(const char* begin, const char* end) {
+        _size = end - begin;
+        _starts.clear();
+        _starts.reserve(_size / 32 + 1);
+        _starts.push_back(0);
+
+        const char* p = begin;
+#ifdef CSL_LINEINDEX_SSE2
+        const __m128i nl = _mm_set1_epi8('\n');
+        for (; p + 16 <= end; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+            while (mask) {
+                _starts.push_back((p - begin) + lowest_bit(mask) + 1);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; p < end; p++) {
+            if (*p == '\n') {
+                _starts.push_back((p - begin) + 1);
+            }
+        }
+    }
+
+    bool is_built()const {
+        return !_starts.empty();
+    }
+
+    size_t line_count()const {
+        return _starts.size();
+    }
+
+    /* Line containing offset */
+    size_t line_of(size_t offset)const {
+        return std::upper_bound(_starts.begin(), _starts.end(), offset) - _starts.begin() - 1;
+    }
+
+    size_t line_begin(size_t line)const {
+        return _starts[line];
+    }
+
+    /* Offset of the '\n' ending line, or end of buffer */
+    size_t line_end(size_t line)const {
+        return line + 1 < _starts.size() ? _starts[line + 1] - 1 : _size;
+    }
+
+    size_t column_of(size_t offset)const {
+        return offset - _starts[line_of(offset)];
+    }
+
+private:
+
+#ifdef CSL_LINEINDEX_SSE2
+    static unsigned lowest_bit(unsigned mask) {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, mask);
+        return idx;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+#endif
+
+    std::vector<size_t> _starts;
+    size_t _size;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#ifndef CSL_UTIL_MAPPEDFILE_H
+#define CSL_UTIL_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+
+/* Read-only memory map of a whole file, advised for sequential reading.
+   Throws CSLError if the file cannot be opened or mapped. */
+class MappedFile {
+public:
+
+    MappedFile() : _data(nullptr), _size(0) {
+
+    }
+
+    explicit MappedFile(const std::string& filename) : _data(nullptr), _size(0) {
+        open(filename);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    void open(const std::string& filename);
+
+    void close();
+
+    bool is_open()const {
+        return _data != nullptr;
+    }
+
+    const char* data()const {
+        return _data;
+    }
+
+    const char* end()const {
+        return _data + _size;
+    }
+
+    size_t size()const {
+        return _size;
+    }
+
+private:
+
+    const char* _data;      // "" for an empty file, which is not mapped
+    size_t _size;
+};
+
+#endif
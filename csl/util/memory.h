@@ -3,8 +3,16 @@
 #ifndef CSL_UTIL_MEMORY_H
 #define CSL_UTIL_MEMORY_H
 
-#include <list>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hash.h"
 
 struct MemoryBlock {
     void* ptr;
@@ -25,8 +33,8 @@ struct MemoryBlock {
 template<typename Ty>
 class ConstMemoryRef {
 public:
-    typedef typename ConstMemoryRef<Ty> _Myt;
-    typedef typename const Ty* pointer;
+    typedef ConstMemoryRef<Ty> _Myt;
+    typedef const Ty* pointer;
 
     ConstMemoryRef() : _p(nullptr) {
 
@@ -54,6 +62,7 @@ public:
     _Myt& operator=(std::nullptr_t) {
         if (_p) _p->ref--;
         _p = nullptr;
+        return *this;
     }
 
     const Ty& operator*()const {
@@ -103,8 +112,8 @@ protected:
 template<typename Ty>
 class MemoryRef : public ConstMemoryRef<Ty> {
 public:
-    typedef typename MemoryRef<Ty> _Myt;
-    typedef typename Ty* pointer;
+    typedef MemoryRef<Ty> _Myt;
+    typedef Ty* pointer;
 
     MemoryRef() {
 
@@ -153,33 +162,250 @@ public:
 };
 
 
+/* Bump allocator for raw bytes. Blocks are freed together on destruction, 
+   so returned pointers stay valid as long as the arena, or until rewound past. */
+class ByteArena {
+public:
+
+    /* Allocation state to rewind to */
+    struct Checkpoint {
+        size_t used;
+        char* cur;
+        size_t left;
+    };
+
+    explicit ByteArena(size_t block_size = 4096) : _block_size(block_size), _used(0), _cur(nullptr), _left(0), _capacity(0) {
+
+    }
+
+    ByteArena(const ByteArena&) = delete;
+    ByteArena& operator=(const ByteArena&) = delete;
+
+    ~ByteArena() {
+        clear();
+    }
+
+    /* align must be a power of 2, no larger than alignof(max_align_t) */
+    char* allocate(size_t size, size_t align = 1) {
+        size_t pad = (0 - reinterpret_cast<uintptr_t>(_cur)) & (align - 1);
+        if (size + pad > _left) {
+            next_block(size);
+            pad = 0;
+        }
+        char* ret = _cur + pad;
+        _cur += size + pad;
+        _left -= size + pad;
+        return ret;
+    }
+
+    /* Bytes of all blocks */
+    size_t capacity()const {
+        return _capacity;
+    }
+
+    /* Bytes allocated, with padding and block tails too short for an allocation */
+    size_t size()const {
+        size_t n = 0;
+        for (size_t i = 0; i < _used; i++) {
+            n += _blocks[i].size;
+        }
+        return n - _left;
+    }
+
+    /* Free all blocks */
+    void clear() {
+        for (const Block& block : _blocks) {
+            free(block.data);
+        }
+        _blocks.clear();
+        _used = 0;
+        _cur = nullptr;
+        _left = 0;
+        _capacity = 0;
+    }
+
+    /* Take over all blocks of other; Pointers into them stay valid */
+    void splice(ByteArena& other) {
+        _blocks.insert(_blocks.begin() + _used, other._blocks.begin(), other._blocks.end());
+        _used += other._blocks.size();
+        _capacity += other._capacity;
+        other._blocks.clear();
+        other._used = 0;
+        other._cur = nullptr;
+        other._left = 0;
+        other._capacity = 0;
+    }
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp = { _used, _cur, _left };
+        return cp;
+    }
+
+    /* Release everything allocated after cp; Blocks are kept for reuse */
+    void rewind(const Checkpoint& cp) {
+        _used = cp.used;
+        _cur = cp.cur;
+        _left = cp.left;
+    }
+
+private:
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    // Blocks [0, _used) are in use, and _cur is in one of them; the rest are free
+    void next_block(size_t size) {
+        if (_used == _blocks.size() || _blocks[_used].size < size) {
+            Block block;
+            block.size = size > _block_size ? size : _block_size;
+            block.data = static_cast<char*>(malloc(block.size));
+            if (block.data == nullptr) {
+                throw std::bad_alloc();
+            }
+            _blocks.insert(_blocks.begin() + _used, block);
+            _capacity += block.size;
+        }
+        _cur = _blocks[_used].data;
+        _left = _blocks[_used].size;
+        _used++;
+    }
+
+    std::vector<Block> _blocks;
+    size_t _block_size;
+    size_t _used;
+    char* _cur;
+    size_t _left;
+    size_t _capacity;
+};
+
+
+/* Fixed-size slots carved from pages of contiguous slots. Slots are not freed 
+   one by one; pages are freed together by clear() */
+class SlabPool {
+public:
+
+    /* slot_align must be no larger than alignof(max_align_t) */
+    SlabPool(size_t slot_size, size_t slot_align, size_t page_size = 1 << 16) : _size(0) {
+        _slot_size = (slot_size + slot_align - 1) / slot_align * slot_align;
+        _slots_per_page = page_size > _slot_size ? page_size / _slot_size : 1;
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    ~SlabPool() {
+        clear();
+    }
+
+    void* allocate() {
+        if (_size == capacity()) {
+            char* page = static_cast<char*>(malloc(_slots_per_page * _slot_size));
+            if (page == nullptr) {
+                throw std::bad_alloc();
+            }
+            _pages.push_back(page);
+        }
+        return slot(_size++);
+    }
+
+    /* Give back the last allocated slot */
+    void pop_back() {
+        _size--;
+    }
+
+    /* Give back slots from size on; Pages are kept for reuse */
+    void truncate(size_t size) {
+        _size = size;
+    }
+
+    /* i-th allocated slot */
+    void* slot(size_t i)const {
+        return _pages[i / _slots_per_page] + i % _slots_per_page * _slot_size;
+    }
+
+    void clear() {
+        for (char* page : _pages) {
+            free(page);
+        }
+        _pages.clear();
+        _size = 0;
+    }
+
+    /* Slots allocated */
+    size_t size()const {
+        return _size;
+    }
+
+    /* Slots in all pages */
+    size_t capacity()const {
+        return _pages.size() * _slots_per_page;
+    }
+
+    size_t slot_size()const {
+        return _slot_size;
+    }
+
+    size_t page_count()const {
+        return _pages.size();
+    }
+
+    size_t page_bytes()const {
+        return _slots_per_page * _slot_size;
+    }
+
+private:
+
+    std::vector<char*> _pages;
+    size_t _slot_size;
+    size_t _slots_per_page;
+    size_t _size;
+};
+
+
+/* Arena of referenced objects. Each object is constructed in place next to its 
+   MemoryBlock, bump-allocated from large chunks. Objects live until the pool is 
+   destroyed; destructors run in reverse order, and are skipped for trivially 
+   destructible types. */
 class MemoryPool {
 public:
 
-    MemoryPool() {
+    explicit MemoryPool(size_t chunk_size = 1 << 16) : _arena(chunk_size), _dtors(nullptr), _count(0) {
 
     } 
 
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
     ~MemoryPool() {
-        for (auto iter = _mylist.begin(); iter != _mylist.end(); ++iter) {
-            delete iter->ptr;
+        for (DtorNode* d = _dtors; d != nullptr; d = d->next) {
+            d->destroy(d->ptr);
         }
     }
 
+    /* Construct a new object in place */
+    template<typename Ty, typename... Args>
+    MemoryRef<Ty> construct(Args&&... args) {
+        Slot<Ty>* slot = reinterpret_cast<Slot<Ty>*>(_arena.allocate(sizeof(Slot<Ty>), alignof(Slot<Ty>)));
+        Ty* newptr = new (&slot->object) Ty(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<Ty>::value) {
+            add_dtor(newptr, [](void* p) { static_cast<Ty*>(p)->~Ty(); });
+        }
+        _count++;
+        return MemoryRef<Ty>::_build(new (&slot->block) MemoryBlock(newptr));
+    }
+
     /* Allocate a new object; Requires constructor */
     template<typename Ty>
     MemoryRef<Ty> allocate() {
-        Ty* newptr = new Ty();
-        _mylist.push_front(MemoryBlock(newptr));
-        return MemoryRef<Ty>::_build(&_mylist.front());
+        return construct<Ty>();
     }
 
     /* Copy an exist object. Requires the copy constructor */
     template<typename Ty>
     MemoryRef<Ty> assign(const Ty& t) {
-        Ty* newptr = new Ty(t);
-        _mylist.push_front(MemoryBlock(newptr));
-        return MemoryRef<Ty>::_build(&_mylist.front());
+        return construct<Ty>(t);
     }
 
     /* Collect an exist opinter. The pointer must be on HEAP using *NEW*.
@@ -189,14 +415,75 @@ public:
         if (t == nullptr) {
             return MemoryRef<Ty>();
         }
-        _mylist.push_front(MemoryBlock(t));
-        return MemoryRef<Ty>::_build(&_mylist.front());
+        add_dtor(t, [](void* p) { delete static_cast<Ty*>(p); });
+        void* block = _arena.allocate(sizeof(MemoryBlock), alignof(MemoryBlock));
+        _count++;
+        return MemoryRef<Ty>::_build(new (block) MemoryBlock(t));
+    }
+
+    /* Number of objects in pool */
+    size_t size()const {
+        return _count;
     }
 
+    /* Bytes reserved from system */
+    size_t capacity()const {
+        return _arena.capacity();
+    }
+
+    struct DtorNode {
+        void (*destroy)(void*);
+        void* ptr;
+        DtorNode* next;
+    };
+
+    struct Checkpoint {
+        ByteArena::Checkpoint arena;
+        DtorNode* dtors;
+        size_t count;
+    };
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp = { _arena.checkpoint(), _dtors, _count };
+        return cp;
+    }
+
+    /* Destroy objects constructed after cp, and reuse their memory */
+    void rewind(const Checkpoint& cp) {
+        for (; _dtors != cp.dtors; _dtors = _dtors->next) {
+            _dtors->destroy(_dtors->ptr);
+        }
+        _arena.rewind(cp.arena);
+        _count = cp.count;
+    }
 
 private:
 
-    std::list<MemoryBlock> _mylist;
+    template<typename Ty>
+    struct Slot {
+        MemoryBlock block;
+        typename std::aligned_storage<sizeof(Ty), alignof(Ty)>::type object;
+    };
+
+    void add_dtor(void* ptr, void (*destroy)(void*)) {
+        DtorNode* d = reinterpret_cast<DtorNode*>(_arena.allocate(sizeof(DtorNode), alignof(DtorNode)));
+        d->destroy = destroy;
+        d->ptr = ptr;
+        d->next = _dtors;
+        _dtors = d;
+    }
+
+    ByteArena _arena;
+    DtorNode* _dtors;
+    size_t _count;
+};
+
+
+/* Stored before the characters of each string in ConstStringPool */
+struct StringHeader {
+    uint32_t length;
+    uint32_t hash;
+    uint32_t symbol;    // ConstStringPool::no_symbol if not interned
 };
 
 
@@ -224,7 +511,7 @@ public:
     }
 
     std::string to_string()const {
-        return std::string(to_cstr());
+        return std::string(to_cstr(), length());
     }
 
     static StringRef null() {
@@ -235,14 +522,30 @@ public:
         return strcmp(to_cstr(), str.c_str()) < 0;
     }
 
+    /* Symbol id in its pool; ConstStringPool::no_symbol if not interned */
+    uint32_t symbol()const {
+        return header().symbol;
+    }
+
     /* String-like behavior */
 
     size_t length()const {
-        return strlen(to_cstr());
+        return header().length;
+    }
+
+    /* Interned strings of the same pool are equal only if they share an entry */
+    bool operator==(const StringRef& other)const {
+        if (_p == other._p) {
+            return true;
+        }
+        const StringHeader& lhs = header();
+        const StringHeader& rhs = other.header();
+        return lhs.hash == rhs.hash && lhs.length == rhs.length && 
+            memcmp(to_cstr(), other.to_cstr(), lhs.length) == 0;
     }
 
     bool operator==(const std::string& str)const {
-        return strcmp(to_cstr(), str.c_str()) == 0;
+        return length() == str.length() && memcmp(to_cstr(), str.data(), str.length()) == 0;
     }
 
     bool operator==(const char* str)const {
@@ -253,7 +556,7 @@ public:
         return to_string() + str;
     }
 
-    friend static std::string operator+(const std::string& lhs, const StringRef& rhs) {
+    friend std::string operator+(const std::string& lhs, const StringRef& rhs) {
         return lhs + rhs.to_string();
     }
 
@@ -263,27 +566,32 @@ public:
         m._p->ref++;
         return m;
     }
+
+private:
+
+    const StringHeader& header()const {
+        return reinterpret_cast<const StringHeader*>(_p->ptr)[-1];
+    }
 };
 
 
+/* Pool of null-terminated strings with their length and hash. Strings added by 
+   intern() are deduplicated: each distinct string is stored once and numbered 
+   by a dense symbol id. */
 class ConstStringPool {
 public:
 
-    ConstStringPool() {
+    static const uint32_t no_symbol = UINT32_MAX;
 
-    }
+    ConstStringPool() : _arena(1 << 14), _generation(0) {
 
-    ~ConstStringPool() {
-        for (auto& p : _mylist) {
-            free(p.ptr);
-        }
     }
 
+    ConstStringPool(const ConstStringPool&) = delete;
+    ConstStringPool& operator=(const ConstStringPool&) = delete;
+
     StringRef assign(const char* str) {
-        char* newstr = static_cast<char*>(malloc(strlen(str) + 1));
-        memcpy(newstr, str, strlen(str));
-        _mylist.push_front(MemoryBlock(newstr));
-        return StringRef::_build(&_mylist.front());
+        return assign(str, str + strlen(str));
     }
 
     StringRef assign(const std::string& str) {
@@ -291,17 +599,133 @@ public:
     }
 
     StringRef assign(const char* strbegin, const char* strend) {
-        
-        char* newstr = static_cast<char*>(malloc(strend - strbegin + 1));
-        memcpy(newstr, strbegin, strend - strbegin);
-        newstr[strend - strbegin] = '\0';
-        _mylist.push_front(MemoryBlock(newstr));
-        return StringRef::_build(&_mylist.front());
+        size_t length = strend - strbegin;
+        return StringRef::_build(new_entry(strbegin, length, hash(strbegin, length), no_symbol));
+    }
+
+    StringRef intern(const char* strbegin, const char* strend) {
+        return get_symbol(intern_symbol(strbegin, strend));
+    }
+
+    StringRef intern(const std::string& str) {
+        return intern(str.c_str(), str.c_str() + str.length());
+    }
+
+    /* Symbol of string, added if not interned yet */
+    uint32_t intern_symbol(const char* strbegin, const char* strend) {
+        size_t length = strend - strbegin;
+        uint32_t h = hash(strbegin, length);
+        if ((_symbols.size() + 1) * 2 > _slots.size()) {
+            rehash(_slots.empty() ? 64 : _slots.size() * 2);
+        }
+        uint32_t& slot = _slots[find_slot(strbegin, length, h)];
+        if (slot == 0) {
+            _symbols.push_back(new_entry(strbegin, length, h, static_cast<uint32_t>(_symbols.size())));
+            slot = static_cast<uint32_t>(_symbols.size());
+        }
+        return slot - 1;
+    }
+
+    /* Symbol of an interned string, or no_symbol */
+    uint32_t find_symbol(const char* strbegin, const char* strend)const {
+        if (_slots.empty()) {
+            return no_symbol;
+        }
+        size_t length = strend - strbegin;
+        return _slots[find_slot(strbegin, length, hash(strbegin, length))] - 1;   // no_symbol if empty
+    }
+
+    StringRef get_symbol(uint32_t symbol)const {
+        return StringRef::_build(_symbols.at(symbol));
+    }
+
+    size_t symbol_count()const {
+        return _symbols.size();
+    }
+
+    /* Bytes of strings with their headers */
+    size_t bytes()const {
+        return _arena.size();
+    }
+
+    struct Checkpoint {
+        ByteArena::Checkpoint arena;
+        size_t symbol_count;
+    };
+
+    Checkpoint checkpoint()const {
+        Checkpoint cp = { _arena.checkpoint(), _symbols.size() };
+        return cp;
+    }
+
+    /* Release strings added after cp, in time of symbols added since */
+    void rewind(const Checkpoint& cp) {
+        // Removed latest first, no symbol left has a probe sequence passing their slots
+        while (_symbols.size() > cp.symbol_count) {
+            const char* text = static_cast<const char*>(_symbols.back()->ptr);
+            const StringHeader& header = reinterpret_cast<const StringHeader*>(text)[-1];
+            _slots[find_slot(text, header.length, header.hash)] = 0;
+            _symbols.pop_back();
+        }
+        _arena.rewind(cp.arena);
+        _generation++;
+    }
+
+    /* Changes on rewind, when symbols may be reused for other strings */
+    size_t generation()const {
+        return _generation;
+    }
+
+    static uint32_t hash(const char* str, size_t length) {
+        return static_cast<uint32_t>(hash_bytes(str, length) >> 32);
     }
 
 private:
 
-    std::list<MemoryBlock> _mylist;
+    MemoryBlock* new_entry(const char* str, size_t length, uint32_t h, uint32_t symbol) {
+        char* buf = _arena.allocate(sizeof(MemoryBlock) + sizeof(StringHeader) + length + 1, alignof(MemoryBlock));
+        StringHeader* header = reinterpret_cast<StringHeader*>(buf + sizeof(MemoryBlock));
+        header->length = static_cast<uint32_t>(length);
+        header->hash = h;
+        header->symbol = symbol;
+        char* text = reinterpret_cast<char*>(header + 1);
+        memcpy(text, str, length);
+        text[length] = '\0';
+        return new (buf) MemoryBlock(text);
+    }
+
+    /* Slot holding the symbol of string (plus 1), or the empty slot to insert at */
+    size_t find_slot(const char* str, size_t length, uint32_t h)const {
+        size_t mask = _slots.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            if (_slots[i] == 0) {
+                return i;
+            }
+            const char* text = static_cast<const char*>(_symbols[_slots[i] - 1]->ptr);
+            const StringHeader& header = reinterpret_cast<const StringHeader*>(text)[-1];
+            if (header.hash == h && header.length == length && memcmp(text, str, length) == 0) {
+                return i;
+            }
+        }
+    }
+
+    void rehash(size_t slot_count) {
+        _slots.assign(slot_count, 0);
+        size_t mask = slot_count - 1;
+        for (uint32_t symbol = 0; symbol < _symbols.size(); symbol++) {
+            uint32_t h = reinterpret_cast<const StringHeader*>(_symbols[symbol]->ptr)[-1].hash;
+            size_t i = h & mask;
+            while (_slots[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            _slots[i] = symbol + 1;
+        }
+    }
+
+    ByteArena _arena;
+    std::vector<MemoryBlock*> _symbols;     // entry of each symbol
+    std::vector<uint32_t> _slots;           // open addressing on hash; symbol + 1, 0 if empty
+    size_t _generation;
 };
 
 #endif
\ No newline at end of file
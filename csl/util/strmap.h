@@ -2,10 +2,26 @@
 #ifndef STRMAP_H
 #define STRMAP_H
 
-#include <map>
-#include <set>
-#include <list>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hash.h"
+#include "memory.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define CSL_STRMAP_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #define Min(a, b) (a < b ? (a) : (b))
 
@@ -76,14 +92,308 @@ private:
 };
 
 
-/* Implementation of std::map on StringTmpRef */
+/* Open-addressing hash table of entries keyed by string, in SwissTable layout:
+   one control byte per slot holds 7 bits of the key hash or marks the slot empty,
+   and a group of control bytes (16 with SSE2, 8 otherwise) is matched at once.
+   Keys are copied to an arena, so entries hold a stable StringTmpRef.
+   Entries are never erased. Iteration order is unspecified. */
+template<typename Entry>
+class FlatStrTable {
+public:
+
+    template<typename E>
+    class basic_iterator {
+    public:
+
+        basic_iterator() : _table(nullptr), _index(0) {
+
+        }
+
+        // iterator to const_iterator
+        template<typename F, typename = typename std::enable_if<std::is_convertible<F*, E*>::value>::type>
+        basic_iterator(const basic_iterator<F>& other) : _table(other._table), _index(other._index) {
+
+        }
+
+        E& operator*()const {
+            return _table->slot(_index);
+        }
+
+        E* operator->()const {
+            return &_table->slot(_index);
+        }
+
+        basic_iterator& operator++() {
+            _index = _table->next_full(_index + 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        bool operator==(const basic_iterator& other)const {
+            return _index == other._index;
+        }
+
+        bool operator!=(const basic_iterator& other)const {
+            return _index != other._index;
+        }
+
+    private:
+
+        template<typename> friend class basic_iterator;
+        friend class FlatStrTable;
+
+        basic_iterator(const FlatStrTable* table, size_t index) : _table(const_cast<FlatStrTable*>(table)), _index(index) {
+
+        }
+
+        FlatStrTable* _table;
+        size_t _index;
+    };
+
+    typedef basic_iterator<Entry> iterator;
+    typedef basic_iterator<const Entry> const_iterator;
+
+    FlatStrTable() : _size(0), _arena(1 << 12) {
+
+    }
+
+    FlatStrTable(const FlatStrTable&) = delete;
+    FlatStrTable& operator=(const FlatStrTable&) = delete;
+
+    ~FlatStrTable() {
+        for (size_t i = 0; i < _slots.size(); i++) {
+            if (is_full(_ctrl[i])) {
+                slot(i).~Entry();
+            }
+        }
+    }
+
+    iterator begin() {
+        return iterator(this, next_full(0));
+    }
+
+    iterator end() {
+        return iterator(this, _slots.size());
+    }
+
+    const_iterator begin()const {
+        return const_iterator(this, next_full(0));
+    }
+
+    const_iterator end()const {
+        return const_iterator(this, _slots.size());
+    }
+
+    size_t size()const {
+        return _size;
+    }
+
+    const_iterator find(const StringTmpRef& key)const {
+        return const_iterator(this, find_index(key, hash_bytes(key.get(), key.length())));
+    }
+
+    iterator find(const StringTmpRef& key) {
+        return iterator(this, find_index(key, hash_bytes(key.get(), key.length())));
+    }
+
+    /* Insert an entry constructed from (key copied to arena, args...) unless key exists */
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const StringTmpRef& key, Args&&... args) {
+        uint64_t h = hash_bytes(key.get(), key.length());
+        size_t index = find_index(key, h);
+        if (index != _slots.size()) {
+            return std::make_pair(iterator(this, index), false);
+        }
+        if ((_size + 1) * 8 > _slots.size() * 7) {
+            rehash(_slots.empty() ? size_t(Group::width) : _slots.size() * 2);
+        }
+
+        char* text = _arena.allocate(key.length() + 1);
+        memcpy(text, key.get(), key.length());
+        text[key.length()] = '\0';
+
+        index = find_empty(h);
+        new (&_slots[index]) Entry(StringTmpRef(text, text + key.length()), std::forward<Args>(args)...);
+        _ctrl[index] = h2(h);
+        _size++;
+        return std::make_pair(iterator(this, index), true);
+    }
+
+private:
+
+    enum : int8_t { empty = -128 };     // 0x80; full slots are 0..127
+
+    static bool is_full(int8_t c) {
+        return c >= 0;
+    }
+
+    static unsigned lowest_bit(uint32_t mask) {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, mask);
+        return idx;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    /* Matches of a group of control bytes: bit (i << shift) set if byte i matches */
+    struct Group {
+#ifdef CSL_STRMAP_SSE2
+        enum { width = 16, shift = 0 };
+
+        explicit Group(const int8_t* ctrl) : bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {
+
+        }
+
+        uint64_t match(int8_t c)const {
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c))));
+        }
+
+        uint64_t match_empty()const {
+            return match(empty);
+        }
+
+        __m128i bytes;
+#else
+        enum { width = 8, shift = 3 };
+
+        explicit Group(const int8_t* ctrl) {
+            memcpy(&bytes, ctrl, sizeof(bytes));
+        }
+
+        // may report false matches after a true one; Keys are compared anyway
+        uint64_t match(int8_t c)const {
+            const uint64_t lsbs = 0x0101010101010101ull, msbs = 0x8080808080808080ull;
+            uint64_t x = bytes ^ (lsbs * static_cast<uint8_t>(c));
+            return (x - lsbs) & ~x & msbs;
+        }
+
+        uint64_t match_empty()const {
+            return bytes & 0x8080808080808080ull;
+        }
+
+        uint64_t bytes;
+#endif
+    };
+
+    // first match of mask, then removed from mask
+    static size_t next_match(uint64_t& mask) {
+        uint32_t low = static_cast<uint32_t>(mask);
+        size_t bit = low ? lowest_bit(low) : 32 + lowest_bit(static_cast<uint32_t>(mask >> 32));
+        mask &= mask - 1;
+        return bit >> Group::shift;
+    }
+
+    static int8_t h2(uint64_t h) {
+        return static_cast<int8_t>(h >> 57);
+    }
+
+    // first group of the probe sequence
+    size_t h1(uint64_t h)const {
+        return static_cast<size_t>(h >> 25) & (_slots.size() / Group::width - 1);
+    }
+
+    /* Index of key, or _slots.size() if absent. Groups are probed
+       quadratically, until one with an empty slot */
+    size_t find_index(const StringTmpRef& key, uint64_t h)const {
+        if (_size == 0) {
+            return _slots.size();
+        }
+        size_t mask = _slots.size() / Group::width - 1;
+        size_t g = h1(h);
+        for (size_t step = 1; ; step++) {
+            Group group(&_ctrl[g * Group::width]);
+            for (uint64_t m = group.match(h2(h)); m != 0; ) {
+                size_t i = g * Group::width + next_match(m);
+                const StringTmpRef& k = slot(i).first_key();
+                if (k.length() == key.length() && memcmp(k.get(), key.get(), key.length()) == 0) {
+                    return i;
+                }
+            }
+            if (group.match_empty() != 0) {
+                return _slots.size();
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    size_t find_empty(uint64_t h)const {
+        size_t mask = _slots.size() / Group::width - 1;
+        size_t g = h1(h);
+        for (size_t step = 1; ; step++) {
+            uint64_t m = Group(&_ctrl[g * Group::width]).match_empty();
+            if (m != 0) {
+                return g * Group::width + next_match(m);
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    size_t next_full(size_t i)const {
+        while (i < _slots.size() && !is_full(_ctrl[i])) {
+            i++;
+        }
+        return i;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<int8_t> ctrl(capacity, int8_t(empty));
+        std::vector<Slot> slots(capacity);
+        ctrl.swap(_ctrl);
+        slots.swap(_slots);
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (is_full(ctrl[i])) {
+                Entry& e = *reinterpret_cast<Entry*>(&slots[i]);
+                const StringTmpRef& key = e.first_key();
+                uint64_t h = hash_bytes(key.get(), key.length());
+                size_t j = find_empty(h);
+                new (&_slots[j]) Entry(std::move(e));
+                _ctrl[j] = h2(h);
+                e.~Entry();
+            }
+        }
+    }
+
+    Entry& slot(size_t i)const {
+        return *reinterpret_cast<Entry*>(const_cast<Slot*>(&_slots[i]));
+    }
+
+    typedef typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type Slot;
+
+    std::vector<int8_t> _ctrl;
+    std::vector<Slot> _slots;
+    size_t _size;
+    ByteArena _arena;   // keys
+};
+
+
+/* Map from string to Ty, looked up by StringTmpRef, std::string or const char* */
 template<typename Ty>
 class StrMap {
 public:
 
-    typedef typename std::map<StringTmpRef, Ty> _MyMap;
-    typedef typename _MyMap::const_iterator const_iterator;
-    typedef typename _MyMap::iterator iterator;
+    /* Entry of key and value; first refers to the key kept by the map */
+    struct value_type : std::pair<StringTmpRef, Ty> {
+
+        template<typename... Args>
+        value_type(const StringTmpRef& key, Args&&... args) : std::pair<StringTmpRef, Ty>(key, Ty(std::forward<Args>(args)...)) {
+
+        }
+
+        const StringTmpRef& first_key()const {
+            return this->first;
+        }
+    };
+
+    typedef FlatStrTable<value_type> _MyTable;
+    typedef typename _MyTable::const_iterator const_iterator;
+    typedef typename _MyTable::iterator iterator;
 
     StrMap() {
 
@@ -91,21 +401,20 @@ public:
 
     StrMap(const std::initializer_list<std::pair<std::string, Ty> >& init_list) {
         for (const auto& p : init_list) {
-            _strkeys.push_front(p.first);
-            _map.insert({ StringTmpRef(_strkeys.front()), p.second });
+            insert(p);
         }
     }
 
     const_iterator begin()const {
-        return _map.begin();
+        return _table.begin();
     }
 
     const_iterator end()const {
-        return _map.end();
+        return _table.end();
     }
 
     const_iterator find(const StringTmpRef& str)const {
-        return _map.find(str);
+        return _table.find(str);
     }
 
     const_iterator find(const std::string& str)const {
@@ -117,44 +426,62 @@ public:
     }
 
     bool has_key(const StringTmpRef& str)const {
-        return _map.find(str) != _map.end();
+        return find(str) != end();
+    }
+
+    size_t size()const {
+        return _table.size();
     }
 
     std::pair<iterator, bool> insert(const std::pair<std::string, Ty>& p) {
-        _strkeys.push_front(p.first);
-        auto insert_ret = _map.insert({StringTmpRef(_strkeys.front()), p.second });
-        if (!insert_ret.second) { // insert unsuccessful
-            _strkeys.pop_front();   // undo local copy
-        }
-        return insert_ret;
+        return _table.emplace(StringTmpRef(p.first), p.second);
+    }
+
+    std::pair<iterator, bool> insert(const StringTmpRef& key, const Ty& value) {
+        return _table.emplace(key, value);
     }
 
     const Ty& at(const StringTmpRef& str)const {
-        return _map.at(str);
+        const_iterator it = find(str);
+        if (it == end()) {
+            throw std::out_of_range("Key not found");
+        }
+        return it->second;
     }
 
     const Ty& at(const char* str)const {
-        return _map.at(StringTmpRef(str));
+        return at(StringTmpRef(str));
     }
 
     const Ty& at(const std::string& str)const {
-        return _map.at(StringTmpRef(str));
+        return at(StringTmpRef(str));
     }
 
 private:
 
-    std::list<std::string> _strkeys;
-    _MyMap _map;
+    _MyTable _table;
 };
 
 
-
+/* Set of strings, looked up by StringTmpRef, std::string or const char* */
 class StrSet {
 public:
 
-    typedef std::set<StringTmpRef> _MySet;
-    typedef _MySet::const_iterator const_iterator;
-    typedef _MySet::iterator iterator;
+    /* Key kept by the set */
+    struct value_type : StringTmpRef {
+
+        value_type(const StringTmpRef& key) : StringTmpRef(key) {
+
+        }
+
+        const StringTmpRef& first_key()const {
+            return *this;
+        }
+    };
+
+    typedef FlatStrTable<value_type> _MyTable;
+    typedef _MyTable::const_iterator const_iterator;
+    typedef _MyTable::iterator iterator;
 
     StrSet() {
 
@@ -162,33 +489,32 @@ public:
 
     StrSet(const std::initializer_list<std::string>& init_list) {
         for (const auto& p : init_list) {
-            _strkeys.push_front(p);
-            _set.insert(StringTmpRef(_strkeys.front()));
+            insert(p);
         }
     }
 
     const_iterator begin()const {
-        return _set.begin();
+        return _table.begin();
     }
 
     const_iterator end()const {
-        return _set.end();
+        return _table.end();
     }
 
     const_iterator find(const StringTmpRef& str)const {
-        return _set.find(str);
+        return _table.find(str);
     }
 
     const_iterator find(const std::string& str)const {
-        return _set.find(StringTmpRef(str));
+        return find(StringTmpRef(str));
     }
 
     const_iterator find(const char* str)const {
-        return _set.find(StringTmpRef(str));
+        return find(StringTmpRef(str));
     }
 
     bool has_key(const StringTmpRef& str)const {
-        return _set.find(str) != _set.end();
+        return find(str) != end();
     }
 
     bool has_key(const char* str)const {
@@ -199,17 +525,23 @@ public:
         return has_key(StringTmpRef(str));
     }
 
+    size_t size()const {
+        return _table.size();
+    }
+
     std::pair<iterator, bool> insert(const std::string& str) {
-        _strkeys.push_front(str);
-        return _set.insert(StringTmpRef(_strkeys.front()));
+        return insert(StringTmpRef(str));
+    }
+
+    std::pair<iterator, bool> insert(const StringTmpRef& str) {
+        return _table.emplace(str);
     }
 
 private:
 
-    std::list<std::string> _strkeys;
-    _MySet _set;
+    _MyTable _table;
 };
 
 
 #undef Min
-#endif
\ No newline at end of file
+#endif
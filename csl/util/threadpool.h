@@ -0,0 +1,218 @@
+#pragma once
+
+#ifndef CSL_UTIL_THREADPOOL_H
+#define CSL_UTIL_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/* Fixed-size pool of worker threads running tasks in FIFO order, with a
+   work-stealing loop over index ranges (parallel_for) */
+class ThreadPool {
+public:
+
+    /* thread_count == 0 uses hardware concurrency */
+    explicit ThreadPool(size_t thread_count = 0) : _stop(false) {
+        if (thread_count == 0) {
+            thread_count = std::thread::hardware_concurrency();
+        }
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+        for (size_t i = 0; i < thread_count; i++) {
+            _workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        for (auto& t : _workers) {
+            t.join();
+        }
+    }
+
+    size_t size()const {
+        return _workers.size();
+    }
+
+    /* Queue task; Exceptions thrown by task are rethrown by future::get() */
+    template<typename Fn>
+    auto submit(Fn task) -> std::future<decltype(task())> {
+        typedef decltype(task()) result_type;
+
+        auto packed = std::make_shared<std::packaged_task<result_type()>>(std::move(task));
+        std::future<result_type> result = packed->get_future();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.emplace_back([packed]() { (*packed)(); });
+        }
+        _cond.notify_one();
+        return result;
+    }
+
+    /* Run fn(i) for each i in [0, count) on the calling thread and the workers. Each
+       runs a contiguous range of indices in order, then steals the back half of the
+       largest range left, so uneven items balance out. Workers busy elsewhere are not
+       waited for, so it may be called from a task of the pool. Rethrows an exception
+       of fn once all items are done */
+    template<typename Fn>
+    void parallel_for(size_t count, Fn fn) {
+        if (count == 0) {
+            return;
+        }
+        std::shared_ptr<Loop> loop = std::make_shared<Loop>(std::min(count, size() + 1), count);
+        std::function<void(size_t)> body = fn;
+        loop->fn = &body;
+
+        for (size_t i = 1; i < loop->ranges.size(); i++) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.emplace_back([loop]() { loop->run(); });
+        }
+        _cond.notify_all();
+        loop->run();
+
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->done.wait(lock, [&]() { return loop->left == 0; });
+        if (loop->error) {
+            std::rethrow_exception(loop->error);
+        }
+    }
+
+private:
+
+    /* State of a parallel_for(), shared with the workers that join it */
+    struct Loop {
+
+        struct Range {
+            std::mutex mutex;
+            size_t begin, end;
+        };
+
+        std::vector<Range> ranges;      // one per thread joining
+        std::atomic<size_t> joined;
+        std::function<void(size_t)>* fn;    // valid while items are left
+
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t left;                    // items not done
+        std::exception_ptr error;
+
+        Loop(size_t threads, size_t count) : ranges(threads), joined(0), fn(nullptr), left(count) {
+            for (size_t i = 0; i < threads; i++) {
+                ranges[i].begin = count * i / threads;
+                ranges[i].end = count * (i + 1) / threads;
+            }
+        }
+
+        void run() {
+            size_t self = joined++;
+            if (self >= ranges.size()) {
+                return;
+            }
+            size_t i;
+            while (true) {
+                if (!pop(ranges[self], i)) {
+                    if (!steal(self)) {
+                        return;
+                    }
+                    continue;
+                }
+                try {
+                    (*fn)(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--left == 0) {
+                    done.notify_all();
+                }
+            }
+        }
+
+        static bool pop(Range& range, size_t& i) {
+            std::lock_guard<std::mutex> lock(range.mutex);
+            if (range.begin == range.end) {
+                return false;
+            }
+            i = range.begin++;
+            return true;
+        }
+
+        /* Move the back half of the largest range to ranges[self]; false if all are empty */
+        bool steal(size_t self) {
+            while (true) {
+                size_t victim = self, most = 0;
+                for (size_t v = 0; v < ranges.size(); v++) {
+                    std::lock_guard<std::mutex> lock(ranges[v].mutex);
+                    if (ranges[v].end - ranges[v].begin > most) {
+                        victim = v;
+                        most = ranges[v].end - ranges[v].begin;
+                    }
+                }
+                if (most == 0) {
+                    return false;
+                }
+                size_t begin, end;
+                {
+                    std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+                    Range& r = ranges[victim];
+                    if (r.begin == r.end) {
+                        continue;   // taken meanwhile
+                    }
+                    begin = r.begin + (r.end - r.begin) / 2;
+                    end = r.end;
+                    r.end = begin;
+                }
+                std::lock_guard<std::mutex> lock(ranges[self].mutex);
+                ranges[self].begin = begin;
+                ranges[self].end = end;
+                return true;
+            }
+        }
+    };
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+                if (_tasks.empty()) {
+                    return;     // stopped and drained
+                }
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _stop;
+};
+
+#endif
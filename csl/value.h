@@ -4,6 +4,7 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 
 #include "util/memory.h"
@@ -55,29 +56,35 @@ public:
 
     }
 
+    /* Values up to 8 bytes are stored inline, without allocation */
     Constant(const TypeRef& tp, const char* v_start, size_t size) :
-        Value(tp, true), buffer(v_start, v_start + size) {
-
+        Value(tp, true), size(size) {
+        if (size <= sizeof(small)) {
+            memcpy(small, v_start, size);
+        }
+        else {
+            buffer.assign(v_start, v_start + size);
+        }
     }
 
     bool get_bool()const {
         assert(type->get_id() == Type::BOOL && "Is not boolean");
-        return *(bool*)&buffer[0];
+        return *(bool*)data();
     }
 
     char get_char()const {
         assert(type->get_id() == Type::CHAR && "Is not char");
-        return buffer[0];
+        return data()[0];
     }
 
     unsigned get_int()const {
         assert(type->get_id() == Type::INT && "Is not int");
-        return *(int*)&buffer[0];
+        return *(int*)data();
     }
 
     double get_float()const {
         assert(type->get_id() == Type::FLOAT && "Is not float");
-        return *(float*)&buffer[0];
+        return *(double*)data();
     }
 
     unsigned get_integer_value()const {
@@ -100,18 +107,30 @@ public:
 
     // output raw data
     const char* get_string()const {
-        return &buffer[0];
+        return data();
     }
 
     ByteRef get_byteref()const {
-        return buffer;
+        return ByteRef(data(), data() + size);
+    }
+
+    size_t get_size()const {
+        return size;
     }
 
 private:
+
+    const char* data()const {
+        return size <= sizeof(small) ? small : &buffer[0];
+    }
+
+    size_t size;
+    char small[8];
     ByteRef buffer;
 };
 
 typedef ConstMemoryRef<Constant> ConstantRef;
+typedef Handle<Constant> ConstantHandle;   // in a HandlePool<Constant>
 
 class GlobalValue : public Value {
 public: